@@ -0,0 +1,178 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BENCH_UTILS_H_INCLUDED
+#define BENCH_UTILS_H_INCLUDED
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Helpers shared by the msr_bench scenarios. */
+
+struct BenchOptions
+{
+    double sampleRate   = 30000.0;
+    double spikeRateHz  = 20.0;    // per channel
+    int numChannels     = 16;
+    int bufferSize      = 1024;
+    double seconds      = 600.0;   // simulated duration
+    double timeConstMs  = 1000.0;
+    unsigned seed       = 1;
+    std::string scenario = "all";
+    bool check          = false;   // run the correctness and throughput checks instead
+    double maxNsPerSample = 5.0;   // throughput check threshold
+};
+
+// returns false (after printing usage) if an argument could not be parsed
+inline bool parseBenchOptions(int argc, char* argv[], BenchOptions& opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--check")
+        {
+            opts.check = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        const char* val = argv[++i];
+
+        if (arg == "--samplerate")    opts.sampleRate = std::atof(val);
+        else if (arg == "--rate")     opts.spikeRateHz = std::atof(val);
+        else if (arg == "--channels") opts.numChannels = std::atoi(val);
+        else if (arg == "--buffer")   opts.bufferSize = std::atoi(val);
+        else if (arg == "--seconds")  opts.seconds = std::atof(val);
+        else if (arg == "--tau")      opts.timeConstMs = std::atof(val);
+        else if (arg == "--seed")     opts.seed = static_cast<unsigned>(std::atoi(val));
+        else if (arg == "--scenario") opts.scenario = val;
+        else if (arg == "--max-ns")   opts.maxNsPerSample = std::atof(val);
+        else
+        {
+            return false;
+        }
+    }
+
+    return opts.sampleRate > 0 && opts.spikeRateHz >= 0 && opts.numChannels > 0
+        && opts.bufferSize > 0 && opts.seconds > 0 && opts.timeConstMs > 0 && opts.maxNsPerSample > 0;
+}
+
+/* Generates independent Poisson spike trains for a number of channels, one block
+ * at a time. Spikes are returned merged across channels and sorted by sample position.
+ */
+class SpikeTrainGenerator
+{
+public:
+    SpikeTrainGenerator(int numChannels, double ratePerSample, unsigned seed)
+        : nextSpike     (numChannels)
+        , rng           (seed)
+        , interval      (ratePerSample > 0 ? ratePerSample : 1e-300)
+        , blockStart    (0)
+    {
+        for (double& next : nextSpike)
+        {
+            next = interval(rng);
+        }
+    }
+
+    // fills positions (relative to the block start) and channels of all spikes in the next block
+    void nextBlock(int blockSize, std::vector<int>& positions, std::vector<int>& channels)
+    {
+        positions.clear();
+        channels.clear();
+        double blockEnd = blockStart + blockSize;
+
+        for (int chan = 0; chan < static_cast<int>(nextSpike.size()); ++chan)
+        {
+            double& next = nextSpike[chan];
+            while (next < blockEnd)
+            {
+                positions.push_back(static_cast<int>(next - blockStart));
+                channels.push_back(chan);
+                next += interval(rng);
+            }
+        }
+        blockStart = blockEnd;
+
+        // sort both arrays by position
+        order.resize(positions.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = static_cast<int>(i);
+        }
+        std::stable_sort(order.begin(), order.end(),
+            [&](int a, int b) { return positions[a] < positions[b]; });
+
+        scratch.assign(positions.begin(), positions.end());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            positions[i] = scratch[order[i]];
+        }
+        scratch.assign(channels.begin(), channels.end());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            channels[i] = scratch[order[i]];
+        }
+    }
+
+private:
+    std::vector<double> nextSpike;
+    std::mt19937_64 rng;
+    std::exponential_distribution<double> interval;
+    double blockStart;
+
+    std::vector<int> order;
+    std::vector<int> scratch;
+};
+
+class Stopwatch
+{
+public:
+    void start()
+    {
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    void stop()
+    {
+        elapsed += std::chrono::steady_clock::now() - startTime;
+    }
+
+    double getNanoseconds() const
+    {
+        return std::chrono::duration<double, std::nano>(elapsed).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::duration::zero();
+};
+
+#endif // BENCH_UTILS_H_INCLUDED
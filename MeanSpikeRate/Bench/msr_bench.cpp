@@ -0,0 +1,2722 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Headless benchmark for the rate estimation core. Replays synthetic Poisson spike
+ * trains through RateEstimator block by block and reports the processing cost.
+ *
+ * Usage: msr_bench [--samplerate Hz] [--rate Hz/channel] [--channels N]
+ *                  [--buffer samples] [--seconds T] [--tau ms] [--seed S]
+ *                  [--scenario all|estimator|electrodes|timeconsts|batch|dispatch|selection|fill|accuracy|kernels|decimation|threshold|export|stats|units|gating|channelsync|parallel]
+ *        msr_bench --check [--max-ns ns/sample]
+ *
+ * --check runs a fixed set of correctness checks and throughput limits on the rate core
+ * instead (registered with CTest), and exits with a nonzero status if any of them fail.
+ */
+
+#include "BenchUtils.h"
+#include "../Source/RateCore/RateEstimator.h"
+#include "../Source/RateCore/ParallelRateEstimator.h"
+#include "../Source/RateCore/ChannelLookup.h"
+#include "../Source/RateCore/ChannelSelection.h"
+#include "../Source/RateCore/DecayKernel.h"
+#include "../Source/RateCore/SpikeBatch.h"
+#include "../Source/RateCore/SpikeTimeMapping.h"
+#include "../Source/RateCore/TimeConstRamp.h"
+#include "../Source/RateCore/UnitRateTable.h"
+#include "../Source/RateCore/WaveformFeatures.h"
+#include "../Source/RateCore/RateFrameWriter.h"
+#include "../Source/RateCore/WorkerPool.h"
+#include "../Source/RateCore/BlockStats.h"
+#include "../Reader/RateFrameReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h> // getpid
+#endif
+
+static void printUsage()
+{
+    std::printf("Usage: msr_bench [--samplerate Hz] [--rate Hz/channel] [--channels N]\n"
+                "                 [--buffer samples] [--seconds T] [--tau ms] [--seed S]\n"
+                "                 [--scenario all|estimator|electrodes|timeconsts|batch|dispatch|selection|fill|accuracy|kernels|decimation|threshold|export|stats|units|gating|channelsync|parallel]\n"
+                "       msr_bench --check [--max-ns ns/sample]\n");
+}
+
+static void benchEstimator(const BenchOptions& opts)
+{
+    RateEstimator estimator;
+    estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+    estimator.setSourceGain(0, 1.0 / opts.numChannels);
+
+    SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    std::vector<float> output(opts.bufferSize);
+
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    long long numSpikes = 0;
+    double checksum = 0;
+    Stopwatch watch;
+
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        generator.nextBlock(opts.bufferSize, positions, channels);
+        numSpikes += positions.size();
+
+        watch.start();
+        estimator.processBlock(output.data(), opts.bufferSize, positions.data(),
+            static_cast<int>(positions.size()));
+        watch.stop();
+
+        checksum += output[0];
+    }
+
+    double ns = watch.getNanoseconds();
+    double numSamples = static_cast<double>(numBlocks) * opts.bufferSize;
+
+    std::printf("estimator: %lld blocks x %d samples, %lld spikes\n", numBlocks, opts.bufferSize, numSpikes);
+    std::printf("  %.3f ns/sample, %.3e spikes/sec, %.1fx real time (checksum %g)\n",
+        ns / numSamples, numSpikes / (ns * 1e-9), opts.seconds / (ns * 1e-9), checksum);
+}
+
+/* Per-electrode output: one estimator state and output buffer per channel. */
+static void benchElectrodeOutputs(const BenchOptions& opts)
+{
+    RateEstimator estimator;
+    estimator.setNumStates(opts.numChannels);
+    estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+    SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+
+    std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * opts.numChannels);
+    std::vector<float*> outputs(opts.numChannels);
+    for (int chan = 0; chan < opts.numChannels; ++chan)
+    {
+        outputs[chan] = outputData.data() + static_cast<size_t>(chan) * opts.bufferSize;
+    }
+
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    long long numSpikes = 0;
+    double checksum = 0;
+    Stopwatch watch;
+
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        generator.nextBlock(opts.bufferSize, positions, channels);
+        numSpikes += positions.size();
+
+        watch.start();
+        estimator.processBlock(outputs.data(), opts.bufferSize, positions.data(), channels.data(),
+            static_cast<int>(positions.size()));
+        watch.stop();
+
+        checksum += outputData[0];
+    }
+
+    double ns = watch.getNanoseconds();
+    double numSamples = static_cast<double>(numBlocks) * opts.bufferSize * opts.numChannels;
+
+    std::printf("electrodes: %lld blocks x %d samples x %d outputs, %lld spikes\n",
+        numBlocks, opts.bufferSize, opts.numChannels, numSpikes);
+    std::printf("  %.3f ns/output sample, %.3e spikes/sec, %.1fx real time (checksum %g)\n",
+        ns / numSamples, numSpikes / (ns * 1e-9), opts.seconds / (ns * 1e-9), checksum);
+}
+
+/* Mean rate at 4 time constants (10 ms to 10 s): a bank of 4 time constants in one
+ * estimator compared to 4 separate single-time-constant estimators (i.e. chained plugin
+ * instances, minus the additional event dispatch cost each of them has).
+ */
+static void benchTimeConstBank(const BenchOptions& opts)
+{
+    const double timeConstsMs[] = { 10.0, 100.0, 1000.0, 10000.0 };
+    const int NUM_TAUS = 4;
+
+    RateEstimator bank;
+    bank.setNumStates(1, NUM_TAUS);
+    std::vector<RateEstimator> separate(NUM_TAUS);
+    for (int kTau = 0; kTau < NUM_TAUS; ++kTau)
+    {
+        bank.setTimeConstant(kTau, timeConstsMs[kTau], opts.sampleRate);
+        separate[kTau].setTimeConstant(timeConstsMs[kTau], opts.sampleRate);
+        separate[kTau].setSourceGain(0, 1.0 / opts.numChannels);
+    }
+    bank.setSourceGain(0, 1.0 / opts.numChannels);
+
+    SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+
+    std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * NUM_TAUS);
+    float* outputs[NUM_TAUS];
+    for (int kTau = 0; kTau < NUM_TAUS; ++kTau)
+    {
+        outputs[kTau] = outputData.data() + static_cast<size_t>(kTau) * opts.bufferSize;
+    }
+
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    Stopwatch bankWatch;
+    Stopwatch separateWatch;
+
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        generator.nextBlock(opts.bufferSize, positions, channels);
+        int numSpikes = static_cast<int>(positions.size());
+
+        separateWatch.start();
+        for (int kTau = 0; kTau < NUM_TAUS; ++kTau)
+        {
+            separate[kTau].processBlock(outputs[kTau], opts.bufferSize, positions.data(), numSpikes);
+        }
+        separateWatch.stop();
+
+        // all spikes go to the single source
+        channels.assign(positions.size(), 0);
+        bankWatch.start();
+        bank.processBlock(outputs, opts.bufferSize, positions.data(), channels.data(), numSpikes);
+        bankWatch.stop();
+    }
+
+    double numSamples = static_cast<double>(numBlocks) * opts.bufferSize;
+    std::printf("time constants: %lld blocks x %d samples x %d time constants\n", numBlocks, opts.bufferSize, NUM_TAUS);
+    std::printf("  separate: %.3f ns/sample\n", separateWatch.getNanoseconds() / numSamples);
+    std::printf("  bank:     %.3f ns/sample\n", bankWatch.getNanoseconds() / numSamples);
+}
+
+/* Per-electrode output with each smoothing kernel. Also reports the average output over
+ * the second half of the run, which should approach the spike rate for every kernel.
+ */
+static void benchKernels(const BenchOptions& opts)
+{
+    std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * opts.numChannels);
+    std::vector<float*> outputs(opts.numChannels);
+    for (int chan = 0; chan < opts.numChannels; ++chan)
+    {
+        outputs[chan] = outputData.data() + static_cast<size_t>(chan) * opts.bufferSize;
+    }
+
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    std::printf("kernels: %lld blocks x %d samples x %d outputs\n", numBlocks, opts.bufferSize, opts.numChannels);
+
+    for (int type = 0; type < NUM_KERNEL_TYPES; ++type)
+    {
+        RateEstimator estimator;
+        estimator.setKernel(static_cast<RateKernelType>(type));
+        estimator.setNumStates(opts.numChannels);
+        estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+        SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+        std::vector<int> positions;
+        std::vector<int> channels;
+
+        double sum = 0;
+        long long numSummed = 0;
+        Stopwatch watch;
+
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            generator.nextBlock(opts.bufferSize, positions, channels);
+
+            watch.start();
+            estimator.processBlock(outputs.data(), opts.bufferSize, positions.data(), channels.data(),
+                static_cast<int>(positions.size()));
+            watch.stop();
+
+            if (block >= numBlocks / 2)
+            {
+                for (float value : outputData)
+                {
+                    sum += value;
+                }
+                numSummed += outputData.size();
+            }
+        }
+
+        double numSamples = static_cast<double>(numBlocks) * opts.bufferSize * opts.numChannels;
+        std::printf("  %-11s %.3f ns/output sample, average output %.3f Hz\n",
+            getKernelName(static_cast<RateKernelType>(type)), watch.getNanoseconds() / numSamples,
+            numSummed > 0 ? sum / numSummed : 0.0);
+    }
+}
+
+/* Per-electrode output with spikes collected in a SpikeBatch. Spikes are added as two
+ * streams (even and odd channels) one after the other, as a Merger would deliver them,
+ * so the batch has to sort them. Reports the cost including collection and sorting.
+ */
+static void benchSpikeBatch(const BenchOptions& opts)
+{
+    RateEstimator estimator;
+    estimator.setNumStates(opts.numChannels);
+    estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+    SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    SpikeBatch batch(1 << 16);
+
+    std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * opts.numChannels);
+    std::vector<float*> outputs(opts.numChannels);
+    for (int chan = 0; chan < opts.numChannels; ++chan)
+    {
+        outputs[chan] = outputData.data() + static_cast<size_t>(chan) * opts.bufferSize;
+    }
+
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    long long numSpikes = 0;
+    long long numDropped = 0;
+    Stopwatch watch;
+
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        generator.nextBlock(opts.bufferSize, positions, channels);
+        numSpikes += positions.size();
+
+        watch.start();
+        batch.clear();
+        for (int stream = 0; stream < 2; ++stream)
+        {
+            for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+            {
+                if (channels[kSpike] % 2 == stream)
+                {
+                    batch.add(positions[kSpike], channels[kSpike]);
+                }
+            }
+        }
+        batch.prepare(opts.bufferSize);
+        estimator.processBlock(outputs.data(), opts.bufferSize, batch);
+        watch.stop();
+
+        numDropped += batch.getAndResetNumDropped();
+    }
+
+    double ns = watch.getNanoseconds();
+    double numSamples = static_cast<double>(numBlocks) * opts.bufferSize * opts.numChannels;
+
+    std::printf("batch: %lld blocks x %d samples x %d outputs, %lld spikes (%lld dropped), 2 merged streams\n",
+        numBlocks, opts.bufferSize, opts.numChannels, numSpikes, numDropped);
+    std::printf("  %.3f ns/output sample, %.3e spikes/sec\n", ns / numSamples, numSpikes / (ns * 1e-9));
+}
+
+/* Per-electrode output, written out for every sample vs. only read out every D samples
+ * (or once per block, D = buffer size). Reports the cost per block and the largest
+ * difference between the readouts and the full output at the same samples.
+ */
+static void benchDecimation(const BenchOptions& opts)
+{
+    const int intervals[] = { 1, 10, 100, 1000, opts.bufferSize };
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    int numStates = opts.numChannels;
+
+    std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * numStates);
+    std::vector<float*> outputs(numStates);
+    for (int chan = 0; chan < numStates; ++chan)
+    {
+        outputs[chan] = outputData.data() + static_cast<size_t>(chan) * opts.bufferSize;
+    }
+    std::vector<float> readouts(static_cast<size_t>(opts.bufferSize) * numStates);
+
+    std::printf("decimation: %lld blocks x %d samples x %d outputs\n", numBlocks, opts.bufferSize, numStates);
+
+    for (int interval : intervals)
+    {
+        RateEstimator estimator;
+        estimator.setNumStates(numStates);
+        estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+        // for checking the readouts
+        RateEstimator reference;
+        reference.setNumStates(numStates);
+        reference.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+        SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+        std::vector<int> positions;
+        std::vector<int> channels;
+        SpikeBatch batch(1 << 16);
+
+        int phase = interval - 1; // position of the next readout from the start of the block
+        double maxError = 0;
+        Stopwatch watch;
+
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            generator.nextBlock(opts.bufferSize, positions, channels);
+
+            watch.start();
+            batch.clear();
+            for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+            {
+                batch.add(positions[kSpike], channels[kSpike]);
+            }
+            batch.prepare(opts.bufferSize);
+
+            int numReadouts = 0;
+            if (interval == 1)
+            {
+                estimator.processBlock(outputs.data(), opts.bufferSize, batch);
+            }
+            else
+            {
+                numReadouts = estimator.processBlockReadout(opts.bufferSize, batch, phase, interval, readouts.data());
+            }
+            watch.stop();
+
+            if (interval > 1)
+            {
+                reference.processBlock(outputs.data(), opts.bufferSize, batch);
+                for (int kRead = 0; kRead < numReadouts; ++kRead)
+                {
+                    int pos = phase + kRead * interval;
+                    for (int state = 0; state < numStates; ++state)
+                    {
+                        double diff = std::abs(readouts[kRead * numStates + state] - outputs[state][pos]);
+                        maxError = std::max(maxError, diff);
+                    }
+                }
+                phase = (phase + numReadouts * interval) - opts.bufferSize;
+            }
+        }
+
+        std::printf("  every %-5d %.1f ns/block (max readout error %.2e Hz)\n", interval,
+            watch.getNanoseconds() / numBlocks, maxError);
+    }
+}
+
+/* Per-electrode output with threshold detection off, on (crossings solved in closed form
+ * at each spike), and with crossings found instead by scanning every output sample.
+ * The on = 1.5x and off = 1x the spike rate thresholds make the outputs cross often.
+ * Checks that the solved crossings match the scanned ones to within a sample (the
+ * output is rounded to float, so a sample right at the threshold can go either way).
+ */
+static void benchThreshold(const BenchOptions& opts)
+{
+    const double onLevel = 1.5 * opts.spikeRateHz;
+    const double offLevel = opts.spikeRateHz;
+
+    std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * opts.numChannels);
+    std::vector<float*> outputs(opts.numChannels);
+    for (int chan = 0; chan < opts.numChannels; ++chan)
+    {
+        outputs[chan] = outputData.data() + static_cast<size_t>(chan) * opts.bufferSize;
+    }
+
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    std::printf("threshold: %lld blocks x %d samples x %d outputs, on %.1f Hz, off %.1f Hz\n",
+        numBlocks, opts.bufferSize, opts.numChannels, onLevel, offLevel);
+
+    auto byStateAndPosition = [](const ThresholdCrossing& a, const ThresholdCrossing& b)
+    {
+        return a.state < b.state || (a.state == b.state && a.samplePosition < b.samplePosition);
+    };
+
+    const char* const modes[] = { "off", "solved", "scanned" };
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        RateEstimator estimator;
+        estimator.setNumStates(opts.numChannels);
+        estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+        if (mode == 1)
+        {
+            estimator.setThreshold(onLevel, offLevel);
+        }
+
+        SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+        std::vector<int> positions;
+        std::vector<int> channels;
+        std::vector<char> above(opts.numChannels, 0);
+        std::vector<ThresholdCrossing> scanned;
+        std::vector<ThresholdCrossing> solved;
+
+        long long numCrossings = 0;
+        long long numMismatched = 0;
+        Stopwatch watch;
+
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            generator.nextBlock(opts.bufferSize, positions, channels);
+
+            watch.start();
+            estimator.processBlock(outputs.data(), opts.bufferSize, positions.data(), channels.data(),
+                static_cast<int>(positions.size()));
+
+            if (mode == 2)
+            {
+                scanned.clear();
+                for (int state = 0; state < opts.numChannels; ++state)
+                {
+                    const float* out = outputs[state];
+                    for (int sample = 0; sample < opts.bufferSize; ++sample)
+                    {
+                        if (above[state] ? out[sample] < offLevel : out[sample] >= onLevel)
+                        {
+                            above[state] = !above[state];
+                            ThresholdCrossing crossing = { sample, state, above[state] != 0 };
+                            scanned.push_back(crossing);
+                        }
+                    }
+                }
+            }
+            watch.stop();
+
+            if (mode == 1)
+            {
+                numCrossings += estimator.getCrossings().size();
+            }
+            else if (mode == 2)
+            {
+                numCrossings += scanned.size();
+            }
+        }
+
+        if (mode == 1)
+        {
+            // replay the same spikes, comparing against a scan of the output
+            RateEstimator check;
+            check.setNumStates(opts.numChannels);
+            check.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+            check.setThreshold(onLevel, offLevel);
+
+            SpikeTrainGenerator checkGenerator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+            std::fill(above.begin(), above.end(), 0);
+            for (long long block = 0; block < numBlocks; ++block)
+            {
+                checkGenerator.nextBlock(opts.bufferSize, positions, channels);
+                check.processBlock(outputs.data(), opts.bufferSize, positions.data(), channels.data(),
+                    static_cast<int>(positions.size()));
+
+                scanned.clear();
+                for (int state = 0; state < opts.numChannels; ++state)
+                {
+                    for (int sample = 0; sample < opts.bufferSize; ++sample)
+                    {
+                        float value = outputs[state][sample];
+                        if (above[state] ? value < offLevel : value >= onLevel)
+                        {
+                            above[state] = !above[state];
+                            ThresholdCrossing crossing = { sample, state, above[state] != 0 };
+                            scanned.push_back(crossing);
+                        }
+                    }
+                }
+
+                solved = check.getCrossings();
+                std::sort(solved.begin(), solved.end(), byStateAndPosition);
+                bool match = solved.size() == scanned.size();
+                for (size_t k = 0; match && k < solved.size(); ++k)
+                {
+                    match = solved[k].state == scanned[k].state && solved[k].rising == scanned[k].rising
+                        && std::abs(solved[k].samplePosition - scanned[k].samplePosition) <= 1;
+                }
+                if (!match)
+                {
+                    ++numMismatched;
+                    // resynchronize with the solved state
+                    for (const ThresholdCrossing& crossing : solved)
+                    {
+                        above[crossing.state] = crossing.rising;
+                    }
+                }
+            }
+        }
+
+        double numSamples = static_cast<double>(numBlocks) * opts.bufferSize * opts.numChannels;
+        std::printf("  %-8s %.3f ns/output sample", modes[mode], watch.getNanoseconds() / numSamples);
+        if (mode == 1)
+        {
+            std::printf(", %lld crossings, %lld of %lld blocks differ from the scan", numCrossings, numMismatched, numBlocks);
+        }
+        else if (mode == 2)
+        {
+            std::printf(", %lld crossings", numCrossings);
+        }
+        std::printf("\n");
+    }
+}
+
+/* Per-electrode rates exported through shared memory, as the plugin does: a writer thread
+ * processes blocks in real time (paced by the sample rate) and writes a frame every 1 ms,
+ * while a reader thread (in the same process, but going through its own mapping of the
+ * region) busy-polls for them. The frame timestamps carry the time at which they were
+ * written, so the reader can measure the latency of each one. Runs for at most 10 s.
+ */
+static void benchExport(const BenchOptions& opts)
+{
+#ifdef _WIN32
+    (void)opts;
+    std::printf("export: shared memory export is not available on Windows\n");
+#else
+    const int interval = std::max(1, static_cast<int>(opts.sampleRate / 1000));
+    const double seconds = std::min(opts.seconds, 10.0);
+    long long numBlocks = static_cast<long long>(seconds * opts.sampleRate / opts.bufferSize);
+    std::string name = "/msr-bench-" + std::to_string(getpid());
+
+    RateFrameWriter writer;
+    if (!writer.open(name, opts.numChannels, 1, opts.numChannels, 4096, opts.sampleRate))
+    {
+        std::printf("export: could not create shared memory %s\n", name.c_str());
+        return;
+    }
+
+    RateFrameReader reader;
+    if (!reader.open(name))
+    {
+        std::printf("export: could not open shared memory %s\n", name.c_str());
+        return;
+    }
+
+    std::printf("export: %lld blocks x %d samples x %d outputs in real time, a frame every %d samples\n",
+        numBlocks, opts.bufferSize, opts.numChannels, interval);
+
+    std::atomic<bool> writerDone(false);
+    std::vector<double> latencies;
+    latencies.reserve(static_cast<size_t>(numBlocks * (opts.bufferSize / interval + 1)));
+    long long numBadFrames = 0;
+
+    std::thread readerThread([&]()
+    {
+        std::vector<float> values(reader.getNumValues());
+        int64_t timestamp;
+        while (true)
+        {
+            bool done = writerDone.load(std::memory_order_acquire);
+            while (reader.readNext(&timestamp, values.data()))
+            {
+                auto now = std::chrono::steady_clock::now().time_since_epoch();
+                latencies.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - timestamp));
+                numBadFrames += values[0] < 0; // (keeps the copy from being optimized out)
+            }
+            if (done)
+            {
+                break;
+            }
+        }
+    });
+
+    RateEstimator estimator;
+    estimator.setNumStates(opts.numChannels);
+    estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+    SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    SpikeBatch batch(1 << 16);
+    std::vector<float> readouts(static_cast<size_t>(opts.bufferSize / interval + 1) * opts.numChannels);
+
+    Stopwatch writeWatch;
+    long long numFrames = 0;
+    int phase = interval - 1;
+    auto blockDuration = std::chrono::duration<double>(opts.bufferSize / opts.sampleRate);
+    auto start = std::chrono::steady_clock::now();
+
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(blockDuration * (block + 1)));
+
+        generator.nextBlock(opts.bufferSize, positions, channels);
+        batch.clear();
+        for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+        {
+            batch.add(positions[kSpike], channels[kSpike]);
+        }
+        batch.prepare(opts.bufferSize);
+
+        int numReadouts = estimator.processBlockReadout(opts.bufferSize, batch, phase, interval, readouts.data());
+        phase = phase + numReadouts * interval - opts.bufferSize;
+
+        writeWatch.start();
+        for (int kRead = 0; kRead < numReadouts; ++kRead)
+        {
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            writer.write(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+                readouts.data() + static_cast<size_t>(kRead) * opts.numChannels);
+        }
+        writeWatch.stop();
+        numFrames += numReadouts;
+    }
+
+    writerDone.store(true, std::memory_order_release);
+    readerThread.join();
+    uint64_t numLost = reader.getNumLost();
+    reader.close();
+    writer.close();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p)
+    {
+        return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+
+    std::printf("  write %.1f ns/frame, %lld frames written, %zu read, %llu lost\n",
+        numFrames > 0 ? writeWatch.getNanoseconds() / numFrames : 0.0, numFrames, latencies.size(),
+        static_cast<unsigned long long>(numLost));
+    std::printf("  latency: median %.0f ns, 99%% %.0f ns, 99.9%% %.0f ns, max %.0f ns\n",
+        percentile(0.5), percentile(0.99), percentile(0.999), percentile(1.0));
+#endif
+}
+
+/* Cost of the plugin's optional instrumentation (built with MSR_INSTRUMENTATION): single
+ * output estimation with each block timed and recorded in a BlockStats vs. without.
+ * Prints the recorded statistics as the plugin logs them.
+ */
+static void benchStats(const BenchOptions& opts)
+{
+    std::vector<float> output(opts.bufferSize);
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    std::printf("stats: %lld blocks x %d samples, %d channels into one output\n", numBlocks, opts.bufferSize, opts.numChannels);
+
+    BlockStats stats;
+    for (int recording = 0; recording < 2; ++recording)
+    {
+        RateEstimator estimator;
+        estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+        estimator.setSourceGain(0, 1.0 / opts.numChannels);
+
+        SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+        std::vector<int> positions;
+        std::vector<int> channels;
+        Stopwatch watch;
+
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            generator.nextBlock(opts.bufferSize, positions, channels);
+            int numSpikes = static_cast<int>(positions.size());
+
+            watch.start();
+            if (recording)
+            {
+                int64_t startNs = getStatsTimeNs();
+                int maxFill = 0;
+                int lastPosition = 0;
+                for (int pos : positions)
+                {
+                    maxFill = std::max(maxFill, pos - lastPosition);
+                    lastPosition = pos;
+                }
+                maxFill = std::max(maxFill, opts.bufferSize - lastPosition);
+
+                estimator.processBlock(output.data(), opts.bufferSize, positions.data(), numSpikes);
+                stats.addBlock(getStatsTimeNs() - startNs, numSpikes, 0, maxFill);
+            }
+            else
+            {
+                estimator.processBlock(output.data(), opts.bufferSize, positions.data(), numSpikes);
+            }
+            watch.stop();
+        }
+
+        std::printf("  %-9s %.1f ns/block\n", recording ? "recorded" : "plain", watch.getNanoseconds() / numBlocks);
+    }
+
+    std::printf("%s", stats.toString().c_str());
+}
+
+/* Electrode toggles with group outputs (8 electrodes per group), one random electrode
+ * toggled per block. Compares recounting the selected electrodes of each group by scanning
+ * all of them (as the plugin used to on every change) with reading the counts that
+ * ChannelSelection keeps up to date on each toggle, and reports the largest step in the
+ * output at the start of a block after a toggle with each spike weighted when it is added
+ * vs. the sum divided on output.
+ */
+static void benchSelection(const BenchOptions& opts)
+{
+    const int GROUP_SIZE = 8;
+    int numGroups = (opts.numChannels + GROUP_SIZE - 1) / GROUP_SIZE;
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    std::printf("selection: %lld blocks x %d samples, %d channels in %d groups, one toggle per block\n",
+        numBlocks, opts.bufferSize, opts.numChannels, numGroups);
+
+    std::vector<int> channelGroups(opts.numChannels);
+    for (int chan = 0; chan < opts.numChannels; ++chan)
+    {
+        channelGroups[chan] = chan / GROUP_SIZE;
+    }
+
+    std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * numGroups);
+    std::vector<float*> outputs(numGroups);
+    for (int group = 0; group < numGroups; ++group)
+    {
+        outputs[group] = outputData.data() + static_cast<size_t>(group) * opts.bufferSize;
+    }
+
+    for (int normalizeOnOutput = 0; normalizeOnOutput < 2; ++normalizeOnOutput)
+    {
+        ChannelSelection selection;
+        selection.resize(opts.numChannels);
+        selection.setGroups(channelGroups.data(), numGroups);
+
+        RateEstimator estimator;
+        estimator.setNumStates(numGroups);
+        estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+        SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+        std::mt19937 rng(opts.seed + 1);
+        std::uniform_int_distribution<int> pickChannel(0, opts.numChannels - 1);
+        std::vector<int> positions;
+        std::vector<int> channels;
+        std::vector<int> scanCounts(numGroups);
+        std::vector<int> counts(numGroups);
+        std::vector<float> lastValues(numGroups, 0.0f);
+        long long countCheck = 0;
+        double maxStep = 0;
+        Stopwatch scanWatch;
+        Stopwatch countWatch;
+
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            // keep at least one electrode selected in each group
+            int toggled = pickChannel(rng);
+            bool enable = !selection.isEnabled(toggled)
+                || selection.getNumEnabled(channelGroups[toggled]) == 1;
+            selection.setEnabled(toggled, enable);
+
+            scanWatch.start();
+            std::fill(scanCounts.begin(), scanCounts.end(), 0);
+            for (int chan = 0; chan < opts.numChannels; ++chan)
+            {
+                scanCounts[channelGroups[chan]] += selection.isEnabled(chan);
+            }
+            scanWatch.stop();
+
+            countWatch.start();
+            for (int group = 0; group < numGroups; ++group)
+            {
+                counts[group] = selection.getNumEnabled(group);
+            }
+            countWatch.stop();
+
+            for (int group = 0; group < numGroups; ++group)
+            {
+                double scale = counts[group] > 0 ? 1.0 / counts[group] : 0.0;
+                estimator.setSourceGain(group, normalizeOnOutput ? 1.0 : scale);
+                estimator.setSourceOutputScale(group, normalizeOnOutput ? scale : 1.0);
+                countCheck += counts[group] != scanCounts[group];
+            }
+
+            generator.nextBlock(opts.bufferSize, positions, channels);
+            int numKept = 0;
+            for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+            {
+                if (selection.isEnabled(channels[kSpike]))
+                {
+                    positions[numKept] = positions[kSpike];
+                    channels[numKept++] = channelGroups[channels[kSpike]];
+                }
+            }
+            estimator.processBlock(outputs.data(), opts.bufferSize, positions.data(), channels.data(), numKept);
+
+            // (the decay over one sample is negligible next to a step from a toggle, but a spike on the first sample isn't)
+            int group = channelGroups[toggled];
+            bool spikeAtStart = false;
+            for (int kSpike = 0; kSpike < numKept && positions[kSpike] == 0; ++kSpike)
+            {
+                spikeAtStart |= channels[kSpike] == group;
+            }
+            if (block > 0 && lastValues[group] > 0 && !spikeAtStart)
+            {
+                double step = std::abs(outputs[group][0] - lastValues[group]) / lastValues[group];
+                maxStep = std::max(maxStep, step);
+            }
+            for (int kGroup = 0; kGroup < numGroups; ++kGroup)
+            {
+                lastValues[kGroup] = outputs[kGroup][opts.bufferSize - 1];
+            }
+        }
+
+        if (normalizeOnOutput == 0)
+        {
+            std::printf("  counts by scan:        %.1f ns/toggle\n", scanWatch.getNanoseconds() / numBlocks);
+            std::printf("  incremental counts:    %.1f ns/toggle (%lld mismatches)\n", countWatch.getNanoseconds() / numBlocks, countCheck);
+        }
+        std::printf("  %-22s largest output step at a toggle %.3g%%\n",
+            normalizeOnOutput ? "divide on output:" : "weight spikes:", 100 * maxStep);
+    }
+}
+
+/* Spike channel names before and after a signal chain update for the channelsync scenario and
+ * check: of numChannels tetrodes, every tenth is removed, neighbouring pairs swap places and as
+ * many new ones as were removed are added at the end. */
+static void makeChannelNames(int numChannels, std::vector<std::string>& oldNames, std::vector<std::string>& newNames)
+{
+    oldNames.clear();
+    newNames.clear();
+    for (int chan = 0; chan < numChannels; ++chan)
+    {
+        oldNames.push_back("Tetrode " + std::to_string(chan + 1));
+        if (chan % 10 != 9)
+        {
+            newNames.push_back(oldNames.back());
+        }
+    }
+
+    for (size_t kName = 0; kName + 1 < newNames.size(); kName += 2)
+    {
+        std::swap(newNames[kName], newNames[kName + 1]);
+    }
+
+    for (int chan = numChannels; newNames.size() < oldNames.size(); ++chan)
+    {
+        newNames.push_back("Tetrode " + std::to_string(chan + 1));
+    }
+}
+
+// index of each new channel among the old ones (or -1), by searching the old names for each one
+static void matchChannelsBySearch(const std::vector<std::string>& oldNames, const std::vector<std::string>& newNames,
+    std::vector<int>& oldIndices)
+{
+    oldIndices.resize(newNames.size());
+    for (size_t kNew = 0; kNew < newNames.size(); ++kNew)
+    {
+        auto it = std::find(oldNames.begin(), oldNames.end(), newNames[kNew]);
+        oldIndices[kNew] = it == oldNames.end() ? -1 : static_cast<int>(it - oldNames.begin());
+    }
+}
+
+static std::vector<uint64_t> makeNameKeys(const std::vector<std::string>& names)
+{
+    std::vector<uint64_t> keys;
+    for (const std::string& name : names)
+    {
+        keys.push_back(ChannelLookup::keyForName(name.data(), name.size()));
+    }
+    return keys;
+}
+
+// settings of the channels before the update: every third one is disabled, and weights and gates vary
+static void makeChannelSettings(const std::vector<std::string>& names, ChannelSelection& selection,
+    std::vector<uint64_t>& keys, std::vector<WaveformGate>& gates)
+{
+    int numChannels = static_cast<int>(names.size());
+    keys = makeNameKeys(names);
+    selection.resize(numChannels);
+    gates.assign(numChannels, WaveformGate());
+    for (int chan = 0; chan < numChannels; ++chan)
+    {
+        selection.setEnabled(chan, chan % 3 != 0);
+        selection.setWeight(chan, 1.0f + (chan % 4) * 0.5f);
+        gates[chan].minPeak = static_cast<float>(chan);
+    }
+}
+
+// the carry-over of MeanSpikeRate::updateSettings: hashes the new names, remaps the selection and carries the gates over
+static void carryOverChannels(const std::vector<std::string>& newNames, ChannelSelection& selection,
+    std::vector<uint64_t>& keys, std::vector<WaveformGate>& gates, std::vector<int>& oldIndices)
+{
+    std::vector<uint64_t> newKeys = makeNameKeys(newNames);
+    selection.remap(keys.data(), newKeys.data(), static_cast<int>(newKeys.size()), oldIndices);
+
+    std::vector<WaveformGate> newGates;
+    newGates.reserve(oldIndices.size());
+    for (int oldIndex : oldIndices)
+    {
+        newGates.push_back(oldIndex == -1 ? WaveformGate() : gates[oldIndex]);
+    }
+    keys.swap(newKeys);
+    gates.swap(newGates);
+}
+
+// whether each new channel has the settings of the old one it matches (see makeChannelSettings)
+static bool checkCarriedOver(const std::vector<int>& oldIndices, const ChannelSelection& selection,
+    const std::vector<WaveformGate>& gates)
+{
+    for (size_t kNew = 0; kNew < oldIndices.size(); ++kNew)
+    {
+        int chan = static_cast<int>(kNew);
+        int oldIndex = oldIndices[kNew];
+        bool enabled = oldIndex == -1 || oldIndex % 3 != 0;
+        float weight = oldIndex == -1 ? 1.0f : 1.0f + (oldIndex % 4) * 0.5f;
+        float minPeak = oldIndex == -1 ? WaveformGate().minPeak : static_cast<float>(oldIndex);
+        if (selection.isEnabled(chan) != enabled || selection.getWeight(chan) != weight || gates[kNew].minPeak != minPeak)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Cost of carrying the selection over to the new spike channels after a signal chain update,
+ * by searching for each channel's name vs. the processor's carry-over (which looks it up). */
+static void benchChannelSync(const BenchOptions& opts)
+{
+    std::printf("channelsync: carrying the selection over a signal chain update\n");
+    std::printf("  %8s %16s %16s\n", "channels", "search (us)", "lookup (us)");
+
+    for (int numChannels = 250; numChannels <= 8000; numChannels *= 2)
+    {
+        std::vector<std::string> oldNames;
+        std::vector<std::string> newNames;
+        makeChannelNames(numChannels, oldNames, newNames);
+        ChannelSelection selection;
+        std::vector<uint64_t> keys;
+        std::vector<WaveformGate> gates;
+        std::vector<int> searchIndices;
+        std::vector<int> lookupIndices;
+
+        const int REPEATS = 5;
+        Stopwatch searchWatch;
+        Stopwatch lookupWatch;
+        for (int repeat = 0; repeat < REPEATS; ++repeat)
+        {
+            searchWatch.start();
+            matchChannelsBySearch(oldNames, newNames, searchIndices);
+            searchWatch.stop();
+
+            makeChannelSettings(oldNames, selection, keys, gates);
+            lookupWatch.start();
+            carryOverChannels(newNames, selection, keys, gates, lookupIndices);
+            lookupWatch.stop();
+        }
+
+        std::printf("  %8d %16.1f %16.1f%s\n", numChannels, searchWatch.getNanoseconds() / REPEATS / 1000,
+            lookupWatch.getNanoseconds() / REPEATS / 1000, searchIndices == lookupIndices ? "" : " (MISMATCH)");
+    }
+    (void)opts;
+}
+
+/* Per-electrode bank of states for the parallel scenario and check: each electrode at each time
+ * constant, processed by a ParallelRateEstimator with the given number of threads (and workers
+ * running if there are several) vs. a RateEstimator. Either every sample is written out, or the
+ * states are only read out every readoutInterval samples. */
+struct ParallelRunResult
+{
+    double parallelUs;          // per block
+    double singleUs;
+    int maxThreadsUsed;
+    bool identical;             // outputs, readouts and threshold crossings
+    long long numCrossings;
+};
+
+static ParallelRunResult runParallelBank(int numElectrodes, const std::vector<double>& timeConstsMs, int numThreads,
+    long long minWorkPerThread, int readoutInterval, double thresholdHz, long long numBlocks, const BenchOptions& opts)
+{
+    int numTimeConsts = static_cast<int>(timeConstsMs.size());
+    int numStates = numElectrodes * numTimeConsts;
+
+    ParallelRateEstimator parallel;
+    parallel.setNumThreads(numThreads);
+    parallel.setMinWorkPerThread(minWorkPerThread);
+    parallel.setNumStates(numElectrodes, numTimeConsts);
+    int maxReadouts = readoutInterval > 0 ? (opts.bufferSize - 1) / readoutInterval + 1 : 0;
+    parallel.setReadoutCapacity(maxReadouts);
+    parallel.startWorkers();
+
+    RateEstimator single;
+    single.setNumStates(numElectrodes, numTimeConsts);
+    for (int kTau = 0; kTau < numTimeConsts; ++kTau)
+    {
+        parallel.setTimeConstant(kTau, timeConstsMs[kTau], opts.sampleRate);
+        single.setTimeConstant(kTau, timeConstsMs[kTau], opts.sampleRate);
+    }
+    parallel.setThreshold(thresholdHz, thresholdHz / 2);
+    single.setThreshold(thresholdHz, thresholdHz / 2);
+
+    std::vector<float> parallelData(static_cast<size_t>(opts.bufferSize) * numStates);
+    std::vector<float> singleData(parallelData.size());
+    std::vector<float*> parallelOutputs(numStates);
+    std::vector<float*> singleOutputs(numStates);
+    for (int state = 0; state < numStates; ++state)
+    {
+        parallelOutputs[state] = parallelData.data() + static_cast<size_t>(state) * opts.bufferSize;
+        singleOutputs[state] = singleData.data() + static_cast<size_t>(state) * opts.bufferSize;
+    }
+    std::vector<float> parallelReadouts(static_cast<size_t>(maxReadouts) * numStates);
+    std::vector<float> singleReadouts(parallelReadouts.size());
+
+    SpikeTrainGenerator generator(numElectrodes, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    SpikeBatch batch(1 << 16);
+    std::vector<ThresholdCrossing> parallelCrossings;
+    std::vector<ThresholdCrossing> singleCrossings;
+    auto byStateAndPosition = [](const ThresholdCrossing& a, const ThresholdCrossing& b)
+    {
+        return a.state < b.state || (a.state == b.state && a.samplePosition < b.samplePosition);
+    };
+
+    ParallelRunResult result = { 0, 0, 0, true, 0 };
+    Stopwatch parallelWatch;
+    Stopwatch singleWatch;
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        generator.nextBlock(opts.bufferSize, positions, channels);
+        batch.clear();
+        for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+        {
+            batch.add(positions[kSpike], channels[kSpike]);
+        }
+        batch.prepare(opts.bufferSize);
+
+        if (readoutInterval > 0)
+        {
+            parallelWatch.start();
+            parallel.processBlockReadout(nullptr, opts.bufferSize, batch, 0, readoutInterval, parallelReadouts.data());
+            parallelWatch.stop();
+
+            singleWatch.start();
+            single.processBlockReadout(opts.bufferSize, batch, 0, readoutInterval, singleReadouts.data());
+            singleWatch.stop();
+
+            result.identical &= parallelReadouts == singleReadouts;
+        }
+        else
+        {
+            parallelWatch.start();
+            parallel.processBlock(parallelOutputs.data(), opts.bufferSize, batch);
+            parallelWatch.stop();
+
+            singleWatch.start();
+            single.processBlock(singleOutputs.data(), opts.bufferSize, batch);
+            singleWatch.stop();
+
+            result.identical &= parallelData == singleData;
+        }
+        result.maxThreadsUsed = std::max(result.maxThreadsUsed, parallel.getNumThreadsUsed());
+
+        // (crossings are only sorted within each state)
+        parallelCrossings = parallel.getCrossings();
+        singleCrossings = single.getCrossings();
+        std::sort(parallelCrossings.begin(), parallelCrossings.end(), byStateAndPosition);
+        std::sort(singleCrossings.begin(), singleCrossings.end(), byStateAndPosition);
+        bool sameCrossings = parallelCrossings.size() == singleCrossings.size();
+        for (size_t kCross = 0; sameCrossings && kCross < singleCrossings.size(); ++kCross)
+        {
+            sameCrossings = parallelCrossings[kCross].state == singleCrossings[kCross].state
+                && parallelCrossings[kCross].samplePosition == singleCrossings[kCross].samplePosition
+                && parallelCrossings[kCross].rising == singleCrossings[kCross].rising;
+        }
+        result.identical &= sameCrossings;
+        result.numCrossings += singleCrossings.size();
+    }
+    parallel.stopWorkers();
+
+    result.parallelUs = parallelWatch.getNanoseconds() / numBlocks / 1000;
+    result.singleUs = singleWatch.getNanoseconds() / numBlocks / 1000;
+    return result;
+}
+
+/* Scaling of a 1000 electrode x 4 time constant bank with the number of threads of a
+ * ParallelRateEstimator, written out on every sample and read out every millisecond. */
+static void benchParallel(const BenchOptions& opts)
+{
+    const int NUM_ELECTRODES = 1000;
+    std::vector<double> timeConstsMs;
+    timeConstsMs.push_back(10.0);
+    timeConstsMs.push_back(100.0);
+    timeConstsMs.push_back(1000.0);
+    timeConstsMs.push_back(10000.0);
+    long long numBlocks = static_cast<long long>(std::min(opts.seconds, 10.0) * opts.sampleRate / opts.bufferSize);
+
+    int numCpus = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads <= std::max(8, numCpus); threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    if (std::find(threadCounts.begin(), threadCounts.end(), numCpus) == threadCounts.end())
+    {
+        threadCounts.push_back(numCpus);
+    }
+
+    std::printf("parallel: %lld blocks x %d samples, %d electrodes x %d time constants, %d CPU(s) available\n",
+        numBlocks, opts.bufferSize, NUM_ELECTRODES, static_cast<int>(timeConstsMs.size()), numCpus);
+    for (int readout = 0; readout < 2; ++readout)
+    {
+        int readoutInterval = readout ? static_cast<int>(opts.sampleRate / 1000) : 0;
+        std::printf("  %s\n", readout ? "read out every ms:" : "written every sample:");
+        std::printf("  %8s %14s %14s %10s\n", "threads", "parallel (us)", "single (us)", "speedup");
+        for (int threads : threadCounts)
+        {
+            ParallelRunResult result = runParallelBank(NUM_ELECTRODES, timeConstsMs, threads,
+                ParallelRateEstimator::DEFAULT_MIN_WORK_PER_THREAD, readoutInterval, 0, numBlocks, opts);
+            std::printf("  %8d %14.1f %14.1f %9.2fx%s\n", threads, result.parallelUs, result.singleUs,
+                result.singleUs / result.parallelUs, result.identical ? "" : " (OUTPUT DIFFERS)");
+        }
+    }
+}
+
+/* Sorted units for the units scenario and check: each electrode has UNITS_PER_ELECTRODE units
+ * in each of two generations, which take turns spiking (as if the electrode were re-sorted)
+ * every epoch. Unit u is on electrode u / (2 * UNITS_PER_ELECTRODE). */
+static const int UNITS_PER_ELECTRODE = 4;
+
+struct UnitRunResult
+{
+    double tableSpikeNs;        // adding spikes to the unit table
+    double tableReadoutNs;      // reading it out
+    double estimatorNs;         // one estimator state per unit
+    long long numSpikes;
+    long long numReadouts;
+    int maxUnits;               // most units in the table at once
+    long long numDropped;
+    double maxError;            // largest difference between the readouts (relative above 1 Hz)
+};
+
+/* Runs the spikes of numElectrodes electrodes' units through a UnitRateTable and through an
+ * estimator with one source per unit, reading both out every readoutInterval samples. */
+static UnitRunResult runUnits(int numElectrodes, double rateHz, double sampleRate, const std::vector<double>& timeConstsMs,
+    int blockSize, long long numBlocks, int readoutInterval, long long epochSamples, unsigned seed)
+{
+    int numUnits = numElectrodes * 2 * UNITS_PER_ELECTRODE;
+    int numTimeConsts = static_cast<int>(timeConstsMs.size());
+
+    UnitRateTable table;
+    table.setCapacity(numUnits, numTimeConsts);
+    RateEstimator estimator;
+    estimator.setNumStates(numUnits, numTimeConsts);
+    for (int kTau = 0; kTau < numTimeConsts; ++kTau)
+    {
+        table.setTimeConstant(kTau, timeConstsMs[kTau], sampleRate);
+        estimator.setTimeConstant(kTau, timeConstsMs[kTau], sampleRate);
+    }
+
+    SpikeTrainGenerator generator(numUnits, rateHz / sampleRate, seed);
+    std::mt19937 rng(seed + 1);
+    std::uniform_int_distribution<int> pickSubSample(0, SpikeTimeMapping::SUB_SAMPLE_STEPS - 1);
+    std::vector<int> positions;
+    std::vector<int> units;
+    std::vector<int> subSamples;
+    SpikeBatch batch(1 << 16);
+
+    int numStates = numUnits * numTimeConsts;
+    int maxReadoutsPerBlock = blockSize / readoutInterval + 1;
+    std::vector<float> estimatorReadouts(static_cast<size_t>(maxReadoutsPerBlock) * numStates);
+    std::vector<float> tableReadout(numStates);
+    std::vector<int> unitSlots(numUnits, -1);
+
+    UnitRunResult result = UnitRunResult();
+    Stopwatch spikeWatch;
+    Stopwatch readoutWatch;
+    Stopwatch estimatorWatch;
+    int phase = readoutInterval - 1; // position of the next readout from the start of the block
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        long long blockStart = block * blockSize;
+        generator.nextBlock(blockSize, positions, units);
+        int numKept = 0;
+        for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+        {
+            int unit = units[kSpike];
+            if ((unit / UNITS_PER_ELECTRODE) % 2 == ((blockStart + positions[kSpike]) / epochSamples) % 2)
+            {
+                positions[numKept] = positions[kSpike];
+                units[numKept++] = unit;
+            }
+        }
+        subSamples.resize(numKept);
+        batch.clear();
+        for (int kSpike = 0; kSpike < numKept; ++kSpike)
+        {
+            subSamples[kSpike] = pickSubSample(rng);
+            batch.add(positions[kSpike], units[kSpike], subSamples[kSpike]);
+        }
+        batch.prepare(blockSize);
+
+        estimatorWatch.start();
+        int numReadouts = estimator.processBlockReadout(blockSize, batch, phase, readoutInterval, estimatorReadouts.data());
+        estimatorWatch.stop();
+
+        // spikes at a readout's sample are included in it
+        int kSpike = 0;
+        for (int kRead = 0; kRead <= numReadouts; ++kRead)
+        {
+            int readoutPos = kRead < numReadouts ? phase + kRead * readoutInterval : blockSize;
+            spikeWatch.start();
+            for (; kSpike < numKept && positions[kSpike] <= readoutPos; ++kSpike)
+            {
+                int unit = units[kSpike];
+                int electrode = unit / (2 * UNITS_PER_ELECTRODE);
+                int sortedId = unit % (2 * UNITS_PER_ELECTRODE) + 1;
+                unitSlots[unit] = table.addSpike(UnitRateTable::makeKey(electrode, sortedId),
+                    blockStart + positions[kSpike], subSamples[kSpike]);
+            }
+            spikeWatch.stop();
+            if (kRead == numReadouts)
+            {
+                break;
+            }
+
+            readoutWatch.start();
+            table.readout(blockStart + readoutPos, tableReadout.data());
+            readoutWatch.stop();
+            result.maxUnits = std::max(result.maxUnits, table.getNumUnits());
+
+            // units that have been removed should have decayed to nothing
+            const float* expected = estimatorReadouts.data() + static_cast<size_t>(kRead) * numStates;
+            for (int unit = 0; unit < numUnits; ++unit)
+            {
+                int slot = unitSlots[unit];
+                bool inTable = slot != -1 && table.getSlotKey(slot) == UnitRateTable::makeKey(
+                    unit / (2 * UNITS_PER_ELECTRODE), unit % (2 * UNITS_PER_ELECTRODE) + 1);
+                for (int kTau = 0; kTau < numTimeConsts; ++kTau)
+                {
+                    double value = inTable ? tableReadout[slot * numTimeConsts + kTau] : 0.0;
+                    double reference = expected[kTau * numUnits + unit];
+                    result.maxError = std::max(result.maxError, std::abs(value - reference) / std::max(reference, 1.0));
+                }
+            }
+        }
+        result.numSpikes += numKept;
+        result.numReadouts += numReadouts;
+        phase = (phase + numReadouts * readoutInterval) - blockSize;
+    }
+
+    result.tableSpikeNs = spikeWatch.getNanoseconds();
+    result.tableReadoutNs = readoutWatch.getNanoseconds();
+    result.estimatorNs = estimatorWatch.getNanoseconds();
+    result.numDropped = table.getAndResetNumDropped();
+    return result;
+}
+
+/* Rates of sorted units (UNITS_PER_ELECTRODE per electrode at --rate, re-sorted every 30 s so
+ * that units come and go) tracked in a UnitRateTable, which decays each unit only when it
+ * spikes or is read out, vs. an estimator with one state per unit decayed on every sample.
+ * Both are read out once per buffer, and the readouts are compared.
+ */
+static void benchUnits(const BenchOptions& opts)
+{
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    long long epochSamples = static_cast<long long>(30 * opts.sampleRate);
+    std::printf("units: %lld blocks x %d samples, %d electrodes x %d units, re-sorted every 30 s, readout once per buffer\n",
+        numBlocks, opts.bufferSize, opts.numChannels, UNITS_PER_ELECTRODE);
+
+    UnitRunResult result = runUnits(opts.numChannels, opts.spikeRateHz, opts.sampleRate,
+        std::vector<double>(1, opts.timeConstMs), opts.bufferSize, numBlocks, opts.bufferSize, epochSamples, opts.seed);
+
+    std::printf("  unit table:  %.1f ns/block (%.1f ns/spike, %.1f ns/readout), up to %d units at once\n",
+        (result.tableSpikeNs + result.tableReadoutNs) / numBlocks, result.tableSpikeNs / std::max(result.numSpikes, 1LL),
+        result.tableReadoutNs / std::max(result.numReadouts, 1LL), result.maxUnits);
+    std::printf("  estimator:   %.1f ns/block (one state per unit, %d states)\n",
+        result.estimatorNs / numBlocks, opts.numChannels * 2 * UNITS_PER_ELECTRODE);
+    std::printf("  max readout difference %.2e (relative above 1 Hz), %lld spikes dropped\n",
+        result.maxError, result.numDropped);
+}
+
+/* Compares the cost of finding a spike's channel index and enabled state.
+ *
+ * "deserialize" models the original path: a SpikeEvent (with a copy of the waveform and
+ * thresholds) is allocated for each spike and its channel is found by searching the
+ * spike channel array for a matching source. "lookup" uses the precomputed
+ * ChannelLookup table on the channel's address, with no allocation.
+ */
+static void benchSpikeDispatch(const BenchOptions& opts)
+{
+    const int NUM_WAVEFORM_CHANS = 4;   // tetrodes
+    const int NUM_WAVEFORM_SAMPLES = 40;
+    const int WAVEFORM_SIZE = NUM_WAVEFORM_CHANS * NUM_WAVEFORM_SAMPLES;
+
+    struct ChannelInfo
+    {
+        int sourceIndex;
+        int sourceNodeID;
+        int subProcessorIdx;
+    };
+
+    struct DeserializedSpike
+    {
+        ChannelInfo source;
+        std::vector<float> thresholds;
+        std::vector<float> waveform;
+    };
+
+    std::vector<ChannelInfo> channelInfo(opts.numChannels);
+    std::vector<uint64_t> keys(opts.numChannels);
+    for (int chan = 0; chan < opts.numChannels; ++chan)
+    {
+        channelInfo[chan] = { chan, 100, 0 };
+        keys[chan] = ChannelLookup::keyFor(&channelInfo[chan]);
+    }
+
+    ChannelLookup lookup;
+    lookup.build(keys.data(), opts.numChannels);
+
+    ChannelSelection selection;
+    selection.resize(opts.numChannels);
+    for (int chan = 1; chan < opts.numChannels; chan += 2)
+    {
+        selection.setEnabled(chan, false);
+    }
+
+    std::vector<float> message(NUM_WAVEFORM_CHANS + WAVEFORM_SIZE, 1.0f);
+
+    SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    long long numSpikes = 0;
+    long long numActiveOld = 0;
+    long long numActiveNew = 0;
+    Stopwatch oldWatch;
+    Stopwatch newWatch;
+
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        generator.nextBlock(opts.bufferSize, positions, channels);
+        numSpikes += channels.size();
+
+        oldWatch.start();
+        for (int chan : channels)
+        {
+            std::unique_ptr<DeserializedSpike> spike(new DeserializedSpike);
+            spike->source = channelInfo[chan];
+            spike->thresholds.assign(message.begin(), message.begin() + NUM_WAVEFORM_CHANS);
+            spike->waveform.assign(message.begin() + NUM_WAVEFORM_CHANS, message.end());
+
+            int index = -1;
+            for (int k = 0; k < opts.numChannels; ++k)
+            {
+                const ChannelInfo& info = channelInfo[k];
+                if (info.sourceIndex == spike->source.sourceIndex
+                    && info.sourceNodeID == spike->source.sourceNodeID
+                    && info.subProcessorIdx == spike->source.subProcessorIdx)
+                {
+                    index = k;
+                    break;
+                }
+            }
+            numActiveOld += selection.isEnabled(index);
+        }
+        oldWatch.stop();
+
+        newWatch.start();
+        for (int chan : channels)
+        {
+            int index = lookup.find(ChannelLookup::keyFor(&channelInfo[chan]));
+            numActiveNew += selection.isEnabled(index);
+        }
+        newWatch.stop();
+    }
+
+    std::printf("dispatch: %lld spikes (%lld / %lld active)\n", numSpikes, numActiveOld, numActiveNew);
+    std::printf("  deserialize: %.3e spikes/sec\n", numSpikes / (oldWatch.getNanoseconds() * 1e-9));
+    std::printf("  lookup:      %.3e spikes/sec\n", numSpikes / (newWatch.getNanoseconds() * 1e-9));
+}
+
+/* Waveform gating of tetrode spikes (a mix of units, low-amplitude noise and large, narrow
+ * artifacts), with the features computed after deserializing each spike (copying its
+ * thresholds and waveform into a new event, as SpikeEvent::deserializeFromMessage does)
+ * vs. directly on the serialized waveform, on each supported instruction set. Reports the
+ * throughput of gated spikes and the fraction that pass.
+ */
+static void benchGating(const BenchOptions& opts)
+{
+    const int NUM_WAVEFORM_CHANS = 4;   // tetrodes
+    const int NUM_WAVEFORM_SAMPLES = 40;
+    const int WAVEFORM_SIZE = NUM_WAVEFORM_CHANS * NUM_WAVEFORM_SAMPLES;
+    const int HEADER_SIZE = 18;         // before the thresholds (so the waveform isn't 4-byte aligned)
+    const int WAVEFORM_OFFSET = HEADER_SIZE + NUM_WAVEFORM_CHANS * static_cast<int>(sizeof(float));
+    const int MESSAGE_SIZE = WAVEFORM_OFFSET + WAVEFORM_SIZE * static_cast<int>(sizeof(float));
+    const int NUM_MESSAGES = 1024;      // replayed in turn
+
+    struct DeserializedSpike
+    {
+        std::vector<float> thresholds;
+        std::vector<float> waveform;
+    };
+
+    // serialized spikes: 70% units (trough of 60-150 uV, then a peak 6-12 samples later),
+    // 20% noise (20-40 uV), 10% artifacts (500-1000 uV on all channels, 1-2 samples wide)
+    std::mt19937 rng(opts.seed);
+    std::normal_distribution<float> noise(0.0f, 5.0f);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<unsigned char> messages(static_cast<size_t>(NUM_MESSAGES) * MESSAGE_SIZE, 0);
+    std::vector<float> waveform(WAVEFORM_SIZE);
+    for (int kMessage = 0; kMessage < NUM_MESSAGES; ++kMessage)
+    {
+        float kind = uniform(rng);
+        bool artifact = kind >= 0.9f;
+        float amplitude = kind < 0.7f ? 60 + 90 * uniform(rng) : artifact ? 500 + 500 * uniform(rng) : 20 + 20 * uniform(rng);
+        int width = artifact ? 1 + static_cast<int>(2 * uniform(rng)) : 6 + static_cast<int>(7 * uniform(rng));
+        for (int chan = 0; chan < NUM_WAVEFORM_CHANS; ++chan)
+        {
+            float chanAmplitude = artifact ? amplitude : amplitude / (1 + chan);
+            for (int k = 0; k < NUM_WAVEFORM_SAMPLES; ++k)
+            {
+                float value = noise(rng);
+                value -= k == 12 ? chanAmplitude : 0;
+                value += k == 12 + width ? 0.4f * chanAmplitude : 0;
+                waveform[chan * NUM_WAVEFORM_SAMPLES + k] = value;
+            }
+        }
+        std::memcpy(messages.data() + static_cast<size_t>(kMessage) * MESSAGE_SIZE + WAVEFORM_OFFSET,
+            waveform.data(), WAVEFORM_SIZE * sizeof(float));
+    }
+
+    WaveformGate gate;
+    gate.minPeak = 50;
+    gate.maxPeak = 400;
+    gate.minWidth = 4;
+
+    SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+    std::printf("gating: tetrode spikes of %d samples, peak 50-400 uV, width >= 4 samples\n", NUM_WAVEFORM_SAMPLES);
+
+    const DecayKernel::Path paths[] = { DecayKernel::SCALAR, DecayKernel::SCALAR, DecayKernel::SSE, DecayKernel::AVX2 };
+    for (int kPath = 0; kPath < 4; ++kPath)
+    {
+        bool deserialize = kPath == 0;
+        DecayKernel::Path path = paths[kPath];
+        if (!DecayKernel::isPathSupported(path))
+        {
+            continue;
+        }
+
+        SpikeTrainGenerator pathGenerator = generator; // same spikes for each path
+        long long numSpikes = 0;
+        long long numPassed = 0;
+        int nextMessage = 0;
+        Stopwatch watch;
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            pathGenerator.nextBlock(opts.bufferSize, positions, channels);
+            numSpikes += channels.size();
+
+            watch.start();
+            for (size_t kSpike = 0; kSpike < channels.size(); ++kSpike)
+            {
+                const unsigned char* message = messages.data() + static_cast<size_t>(nextMessage) * MESSAGE_SIZE;
+                nextMessage = (nextMessage + 1) % NUM_MESSAGES;
+
+                WaveformFeatures features;
+                if (deserialize)
+                {
+                    std::unique_ptr<DeserializedSpike> spike(new DeserializedSpike);
+                    spike->thresholds.resize(NUM_WAVEFORM_CHANS);
+                    spike->waveform.resize(WAVEFORM_SIZE);
+                    std::memcpy(spike->thresholds.data(), message + HEADER_SIZE, NUM_WAVEFORM_CHANS * sizeof(float));
+                    std::memcpy(spike->waveform.data(), message + WAVEFORM_OFFSET, WAVEFORM_SIZE * sizeof(float));
+                    features = WaveformFeatures::compute(spike->waveform.data(), NUM_WAVEFORM_CHANS, NUM_WAVEFORM_SAMPLES, path);
+                }
+                else
+                {
+                    features = WaveformFeatures::compute(message + WAVEFORM_OFFSET, NUM_WAVEFORM_CHANS, NUM_WAVEFORM_SAMPLES, path);
+                }
+                numPassed += gate.passes(features);
+            }
+            watch.stop();
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "%s:", deserialize ? "deserialize" : DecayKernel::getPathName(path));
+        std::printf("  %-13s %.1f ns/spike, %.3e gated spikes/sec (%.1f%% passed)\n", name,
+            watch.getNanoseconds() / std::max(numSpikes, 1LL), numSpikes / (watch.getNanoseconds() * 1e-9),
+            100.0 * numPassed / std::max(numSpikes, 1LL));
+    }
+}
+
+/* Compares the serial per-sample decay loop with DecayPowerTable::fill on each
+ * supported instruction set, for runs of one buffer. Also reports the largest
+ * relative deviation of each from the exact value start * decay^k.
+ */
+static void benchDecayFill(const BenchOptions& opts)
+{
+    double decay = std::exp(-1 / (opts.timeConstMs / 1000.0 * opts.sampleRate));
+    int n = opts.bufferSize;
+    long long numRuns = static_cast<long long>(opts.seconds * opts.sampleRate / n);
+
+    std::vector<double> exact(n);
+    double start = 123.456;
+    for (int k = 0; k < n; ++k)
+    {
+        exact[k] = start * std::pow(decay, k);
+    }
+
+    std::vector<float> output(n);
+    auto maxRelError = [&]()
+    {
+        double maxErr = 0;
+        for (int k = 0; k < n; ++k)
+        {
+            maxErr = std::max(maxErr, std::abs(output[k] - exact[k]) / exact[k]);
+        }
+        return maxErr;
+    };
+
+    std::printf("decay fill: %lld runs x %d samples\n", numRuns, n);
+
+    // serial recurrence (original implementation)
+    {
+        Stopwatch watch;
+        watch.start();
+        for (long long run = 0; run < numRuns; ++run)
+        {
+            float currMean = static_cast<float>(start);
+            for (int samp = 0; samp < n; ++samp)
+            {
+                output[samp] = currMean;
+                currMean *= decay;
+            }
+        }
+        watch.stop();
+        std::printf("  %-7s %.3f ns/sample, max rel error %.2e\n", "serial",
+            watch.getNanoseconds() / (static_cast<double>(numRuns) * n), maxRelError());
+    }
+
+    DecayPowerTable table;
+    table.setDecay(decay);
+    std::vector<float> powers(n);
+    for (int k = 0; k < n; ++k)
+    {
+        powers[k] = static_cast<float>(table.getPower(k));
+    }
+
+    const DecayKernel::Path paths[] = { DecayKernel::SCALAR, DecayKernel::SSE, DecayKernel::AVX2 };
+    for (DecayKernel::Path path : paths)
+    {
+        if (!DecayKernel::isPathSupported(path))
+        {
+            continue;
+        }
+
+        Stopwatch watch;
+        watch.start();
+        for (long long run = 0; run < numRuns; ++run)
+        {
+            DecayKernel::scale(output.data(), powers.data(), static_cast<float>(start), n, path);
+        }
+        watch.stop();
+        std::printf("  %-7s %.3f ns/sample, max rel error %.2e\n", DecayKernel::getPathName(path),
+            watch.getNanoseconds() / (static_cast<double>(numRuns) * n), maxRelError());
+    }
+}
+
+/* Long-run accuracy: a perfectly regular spike train (one spike every P samples at the
+ * given rate) over 10^9 samples. At steady state, the time average of the output is
+ * A / (P * (1 - d)) and its value just after each spike is A / (1 - d^P), where A is the
+ * spike amplitude and d the decay per sample; both are compared to the estimator, and to
+ * a serial single-precision recurrence (the original implementation) for reference.
+ */
+static void benchLongRunAccuracy(const BenchOptions& opts)
+{
+    const long long NUM_SAMPLES = 1000000000LL;
+    int period = std::max(1, static_cast<int>(std::lround(opts.sampleRate / opts.spikeRateHz)));
+    int n = opts.bufferSize;
+    long long numBlocks = NUM_SAMPLES / n;
+
+    double timeConstSec = opts.timeConstMs / 1000.0;
+    double amp = 1.0 / timeConstSec;
+    double decay = std::exp(-1 / (timeConstSec * opts.sampleRate));
+    double expectedAverage = amp / (period * (1 - decay));
+    double expectedPeak = amp / (1 - std::pow(decay, period));
+
+    // only average over the last half, by which point the start-up transient is negligible
+    // unless the time constant is on the order of the run length
+    long long averageFrom = numBlocks / 2;
+
+    RateEstimator estimator;
+    estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+
+    std::vector<float> output(n);
+    std::vector<int> positions;
+    long long nextSpike = 0;
+    double sum = 0;
+    long long numSummed = 0;
+    double lastPeak = 0;
+
+    float serialMean = 0;
+    float serialDecay = static_cast<float>(decay);
+    float serialAmp = static_cast<float>(amp);
+    double serialSum = 0;
+    double serialLastPeak = 0;
+
+    Stopwatch watch;
+    for (long long block = 0; block < numBlocks; ++block)
+    {
+        long long blockStart = block * n;
+        positions.clear();
+        for (; nextSpike < blockStart + n; nextSpike += period)
+        {
+            positions.push_back(static_cast<int>(nextSpike - blockStart));
+        }
+
+        watch.start();
+        estimator.processBlock(output.data(), n, positions.data(), static_cast<int>(positions.size()));
+        watch.stop();
+
+        // serial recurrence, spikes added at the sample they occur
+        size_t kSpike = 0;
+        double blockSum = 0;
+        for (int samp = 0; samp < n; ++samp)
+        {
+            if (kSpike < positions.size() && positions[kSpike] == samp)
+            {
+                serialMean += serialAmp;
+                serialLastPeak = serialMean;
+                ++kSpike;
+            }
+            blockSum += serialMean;
+            serialMean *= serialDecay;
+        }
+
+        if (!positions.empty())
+        {
+            lastPeak = output[positions.back()];
+        }
+
+        if (block >= averageFrom)
+        {
+            for (int samp = 0; samp < n; ++samp)
+            {
+                sum += output[samp];
+            }
+            serialSum += blockSum;
+            numSummed += n;
+        }
+    }
+
+    std::printf("long-run accuracy: %lld samples, 1 spike every %d samples\n", numBlocks * n, period);
+    std::printf("  expected average %.9g Hz, peak %.9g Hz\n", expectedAverage, expectedPeak);
+    std::printf("  %-9s average rel error %.2e, final peak rel error %.2e, %.3f ns/sample\n", "estimator",
+        std::abs(sum / numSummed - expectedAverage) / expectedAverage,
+        std::abs(lastPeak - expectedPeak) / expectedPeak, watch.getNanoseconds() / (numBlocks * n));
+    std::printf("  %-9s average rel error %.2e, final peak rel error %.2e\n", "serial",
+        std::abs(serialSum / numSummed - expectedAverage) / expectedAverage,
+        std::abs(serialLastPeak - expectedPeak) / expectedPeak);
+}
+
+/*** Checks (--check) ***/
+
+static bool reportCheck(bool passed, const char* name, const std::string& detail)
+{
+    std::printf("  %s %s: %s\n", passed ? "PASS" : "FAIL", name, detail.c_str());
+    return passed;
+}
+
+static std::string formatDetail(const char* format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return buffer;
+}
+
+/* Feeds spikes at absolute sample positions (sorted) to a per-channel estimator in blocks
+ * of blockSize samples, writing the whole output of each state. */
+static void runInBlocks(RateEstimator& estimator, const std::vector<int>& positions, const std::vector<int>& channels,
+    int numSamples, int blockSize, std::vector<std::vector<float>>& outputs)
+{
+    int numStates = estimator.getNumStates();
+    outputs.assign(numStates, std::vector<float>(numSamples));
+    std::vector<float*> blockOutputs(numStates);
+    std::vector<int> blockPositions;
+    std::vector<int> blockChannels;
+
+    size_t kSpike = 0;
+    for (int blockStart = 0; blockStart < numSamples; blockStart += blockSize)
+    {
+        int n = std::min(blockSize, numSamples - blockStart);
+        blockPositions.clear();
+        blockChannels.clear();
+        for (; kSpike < positions.size() && positions[kSpike] < blockStart + n; ++kSpike)
+        {
+            blockPositions.push_back(positions[kSpike] - blockStart);
+            blockChannels.push_back(channels[kSpike]);
+        }
+
+        for (int state = 0; state < numStates; ++state)
+        {
+            blockOutputs[state] = outputs[state].data() + blockStart;
+        }
+        estimator.processBlock(blockOutputs.data(), n, blockPositions.data(), blockChannels.data(),
+            static_cast<int>(blockPositions.size()));
+    }
+}
+
+/* Single spike through the exponential kernel vs. the closed form gain / tau * e^(-k / tau),
+ * across block boundaries and for a spike a fraction of a sample before its output sample. */
+static bool checkGoldenImpulse()
+{
+    const double sampleRate = 30000.0;
+    const double timeConstMs = 100.0;
+    const double gain = 0.25;
+    const int blockSize = 1000;
+    const int numBlocks = 4;
+    double tauSamples = timeConstMs / 1000.0 * sampleRate;
+    double amp = gain * 1000.0 / timeConstMs;
+
+    bool passed = true;
+    for (int subSample = 0; subSample < SpikeTimeMapping::SUB_SAMPLE_STEPS; subSample += 128)
+    {
+        RateEstimator estimator;
+        estimator.setTimeConstant(timeConstMs, sampleRate);
+        estimator.setSourceGain(0, gain);
+
+        SpikeBatch batch(1);
+        std::vector<float> output(blockSize);
+        double maxError = 0;
+        const int spikePosition = 10;
+
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            batch.clear();
+            if (block == 0)
+            {
+                batch.add(spikePosition, 0, subSample);
+            }
+            batch.prepare(blockSize);
+            float* outputs[] = { output.data() };
+            estimator.processBlock(outputs, blockSize, batch);
+
+            for (int k = 0; k < blockSize; ++k)
+            {
+                double age = block * blockSize + k - spikePosition + static_cast<double>(subSample) / SpikeTimeMapping::SUB_SAMPLE_STEPS;
+                double expected = age < 0 ? 0.0 : amp * std::exp(-age / tauSamples);
+                maxError = std::max(maxError, std::abs(output[k] - expected) / amp);
+            }
+        }
+
+        passed &= reportCheck(maxError < 1e-6, "golden impulse",
+            formatDetail("sub-sample offset %d/256: max error %.2e of the spike amplitude", subSample, maxError));
+    }
+    return passed;
+}
+
+/* A regular spike train at a known rate: the time average of the output must equal the
+ * sum of the kernel's response to each spike over one period. Each spike adds gain / tau,
+ * and each of the kernel's stages integrates it over tau / stages, so this is the rate times
+ * the gain for every time constant, apart from the difference between sampling the decay
+ * and integrating it (at most about stages / (2 * tau in samples); none for the boxcar). */
+static bool checkSteadyState()
+{
+    const double sampleRate = 30000.0;
+    const double rateHz = 20.0;
+    const double gain = 0.5;
+    const int period = static_cast<int>(sampleRate / rateHz);
+    const double timeConstsMs[] = { 10.0, 100.0, 1000.0 };
+    const int numStages[NUM_KERNEL_TYPES] = { 1, 2, 4, 8, 0 };
+
+    bool passed = true;
+    for (int type = 0; type < NUM_KERNEL_TYPES; ++type)
+    {
+        double maxError = 0;
+        double maxBias = 0;
+        for (double timeConstMs : timeConstsMs)
+        {
+            RateEstimator estimator;
+            estimator.setKernel(static_cast<RateKernelType>(type));
+            estimator.setTimeConstant(timeConstMs, sampleRate);
+            estimator.setSourceGain(0, gain);
+
+            // settle for 20 time constants, then average over whole periods
+            int settlePeriods = static_cast<int>(20 * timeConstMs / 1000.0 * rateHz) + 1;
+            int averagePeriods = 200;
+            std::vector<float> output(period);
+            double sum = 0;
+            for (int kPeriod = 0; kPeriod < settlePeriods + averagePeriods; ++kPeriod)
+            {
+                int spikePosition = period / 2;
+                estimator.processBlock(output.data(), period, &spikePosition, 1);
+                if (kPeriod >= settlePeriods)
+                {
+                    for (float value : output)
+                    {
+                        sum += value;
+                    }
+                }
+            }
+
+            double average = sum / (static_cast<double>(averagePeriods) * period);
+            double expected = gain * rateHz;
+            if (numStages[type] > 0)
+            {
+                double stages = numStages[type];
+                double tauSamples = timeConstMs / 1000.0 * sampleRate;
+                expected = gain * 1000.0 / timeConstMs * stages / (1 - std::exp(-stages / tauSamples)) / period;
+            }
+            maxError = std::max(maxError, std::abs(average - expected) / expected);
+            maxBias = std::max(maxBias, std::abs(expected - gain * rateHz) / (gain * rateHz));
+        }
+
+        passed &= reportCheck(maxError < 1e-6, "steady state",
+            formatDetail("%s kernel: average within %.2e of expected at 10, 100 and 1000 ms (sampling bias %.2e)",
+                getKernelName(static_cast<RateKernelType>(type)), maxError, maxBias));
+    }
+    return passed;
+}
+
+/* The same spikes processed in blocks of 64 and 4096 samples (and an odd size) must give
+ * the same output. The exponential kernel carries its state across blocks in double
+ * precision but writes the output in float, so it may differ by float rounding; the
+ * others are computed sample by sample and must match exactly. */
+static bool checkBlockInvariance()
+{
+    const double sampleRate = 30000.0;
+    const int numChannels = 8;
+    const int numSamples = 4096 * 32;
+    const int blockSizes[] = { 64, 4096, 1000 };
+
+    SpikeTrainGenerator generator(numChannels, 50.0 / sampleRate, 7);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    generator.nextBlock(numSamples, positions, channels);
+
+    bool passed = true;
+    for (int type = 0; type < NUM_KERNEL_TYPES; ++type)
+    {
+        std::vector<std::vector<float>> reference;
+        double maxError = 0;
+        for (int blockSize : blockSizes)
+        {
+            RateEstimator estimator;
+            estimator.setKernel(static_cast<RateKernelType>(type));
+            estimator.setNumStates(numChannels, 2);
+            estimator.setTimeConstant(0, 20.0, sampleRate);
+            estimator.setTimeConstant(1, 500.0, sampleRate);
+
+            std::vector<std::vector<float>> outputs;
+            runInBlocks(estimator, positions, channels, numSamples, blockSize, outputs);
+            if (reference.empty())
+            {
+                reference.swap(outputs);
+                continue;
+            }
+
+            for (size_t state = 0; state < outputs.size(); ++state)
+            {
+                for (int k = 0; k < numSamples; ++k)
+                {
+                    double scale = std::max(std::abs(reference[state][k]), 1e-3f);
+                    maxError = std::max(maxError, std::abs(outputs[state][k] - reference[state][k]) / scale);
+                }
+            }
+        }
+
+        double tolerance = type == KERNEL_EXPONENTIAL ? 1e-6 : 0.0;
+        passed &= reportCheck(maxError <= tolerance, "block invariance",
+            formatDetail("%s kernel: max relative difference %.2e between 64, 1000 and 4096 sample blocks",
+                getKernelName(static_cast<RateKernelType>(type)), maxError));
+    }
+    return passed;
+}
+
+/* Time constants ramped with approximately updated decay tables must give the same output
+ * as the same steps set exactly (up to float rounding), for every kernel, and each step must
+ * cost less than an exact update. */
+static bool checkTimeConstRamp()
+{
+    const double sampleRate = 30000.0;
+    const int numChannels = 8;
+    const int blockSize = 1000;
+    const int numBlocks = 60;
+    const int numSamples = blockSize * numBlocks;
+
+    SpikeTrainGenerator generator(numChannels, 50.0 / sampleRate, 11);
+    std::vector<int> positions;
+    std::vector<int> channels;
+
+    bool passed = true;
+    for (int type = 0; type < NUM_KERNEL_TYPES; ++type)
+    {
+        RateEstimator ramped;
+        RateEstimator exact;
+        for (RateEstimator* estimator : { &ramped, &exact })
+        {
+            estimator->setKernel(static_cast<RateKernelType>(type));
+            estimator->setNumStates(numChannels, 1);
+        }
+
+        // 20 to 500 ms over the first half
+        TimeConstRamp ramp;
+        ramp.setTarget(20.0);
+        ramp.setRampLength(numSamples / 2);
+        std::vector<float> rampedData(static_cast<size_t>(numChannels) * blockSize);
+        std::vector<float> exactData(rampedData.size());
+        std::vector<float*> rampedOutputs(numChannels);
+        std::vector<float*> exactOutputs(numChannels);
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            rampedOutputs[chan] = rampedData.data() + static_cast<size_t>(chan) * blockSize;
+            exactOutputs[chan] = exactData.data() + static_cast<size_t>(chan) * blockSize;
+        }
+
+        double maxError = 0;
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            if (block == 1)
+            {
+                ramp.setTarget(500.0);
+            }
+            bool ramping = ramp.isRamping();
+            double timeConstMs = ramp.nextBlock(blockSize);
+            ramped.setTimeConstant(0, timeConstMs, sampleRate, ramping);
+            exact.setTimeConstant(0, timeConstMs, sampleRate);
+
+            generator.nextBlock(blockSize, positions, channels);
+            int numSpikes = static_cast<int>(positions.size());
+            ramped.processBlock(rampedOutputs.data(), blockSize, positions.data(), channels.data(), numSpikes);
+            exact.processBlock(exactOutputs.data(), blockSize, positions.data(), channels.data(), numSpikes);
+            for (size_t k = 0; k < exactData.size(); ++k)
+            {
+                double scale = std::max(std::abs(exactData[k]), 1e-3f);
+                maxError = std::max(maxError, std::abs(rampedData[k] - exactData[k]) / scale);
+            }
+        }
+
+        passed &= reportCheck(maxError <= 1e-6, "time constant ramp",
+            formatDetail("%s kernel: max relative difference %.2e from exactly set steps",
+                getKernelName(static_cast<RateKernelType>(type)), maxError));
+    }
+
+    // cost of a step of 8 time constants (best of a few, so that a descheduled run doesn't fail the check)
+    const int NUM_TIME_CONSTS = 8;
+    const int NUM_STEPS = 200;
+    double bestNs[2] = { 1e18, 1e18 };
+    for (int repeat = 0; repeat < 5; ++repeat)
+    {
+        for (int exactSteps = 0; exactSteps < 2; ++exactSteps)
+        {
+            RateEstimator estimator;
+            estimator.setNumStates(1, NUM_TIME_CONSTS);
+            Stopwatch watch;
+            watch.start();
+            for (int step = 0; step < NUM_STEPS; ++step)
+            {
+                for (int timeConst = 0; timeConst < NUM_TIME_CONSTS; ++timeConst)
+                {
+                    estimator.setTimeConstant(timeConst, 10.0 * (timeConst + 1) + 0.01 * step, sampleRate,
+                        exactSteps == 0);
+                }
+            }
+            watch.stop();
+            bestNs[exactSteps] = std::min(bestNs[exactSteps], watch.getNanoseconds() / NUM_STEPS);
+        }
+    }
+    passed &= reportCheck(bestNs[0] < bestNs[1], "time constant ramp cost",
+        formatDetail("%.1f us per ramp step of %d exponential time constants (%.1f us if set exactly)",
+            bestNs[0] / 1000, NUM_TIME_CONSTS, bestNs[1] / 1000));
+    return passed;
+}
+
+/* The boxcar kernel's windows are sized for the maximum rate: spikes beyond it must be
+ * dropped and counted (without allocating), and none when the rate is raised. */
+static bool checkBoxcarCapacity()
+{
+    const double sampleRate = 30000.0;
+    const int numSpikes = 200;
+    std::vector<int> positions(numSpikes);
+    for (int kSpike = 0; kSpike < numSpikes; ++kSpike)
+    {
+        positions[kSpike] = kSpike;
+    }
+
+    // 200 spikes within a 100 ms window are 2000 Hz
+    int dropped[2];
+    double values[2];
+    for (int raised = 0; raised < 2; ++raised)
+    {
+        RateEstimator estimator;
+        estimator.setKernel(KERNEL_BOXCAR);
+        estimator.setMaxRate(raised ? 2000.0 : 100.0);
+        estimator.setTimeConstant(100.0, sampleRate);
+
+        std::vector<float> output(1000);
+        estimator.processBlock(output.data(), static_cast<int>(output.size()), positions.data(), numSpikes);
+        dropped[raised] = estimator.getAndResetNumDropped();
+        values[raised] = output.back();
+    }
+
+    int capacity = BoxcarKernel::MIN_CAPACITY;
+    return reportCheck(dropped[0] == numSpikes - capacity && dropped[1] == 0
+        && values[1] == static_cast<float>(numSpikes * 10.0), "boxcar capacity",
+        formatDetail("2000 Hz in a window sized for 100 Hz: %d of %d spikes dropped (expected %d); "
+            "sized for 2000 Hz: %d dropped, %.0f Hz", dropped[0], numSpikes, numSpikes - capacity, dropped[1],
+            values[1]));
+}
+
+/* A weighted mean over electrodes, computed in one pass with each spike weighted by its
+ * electrode's weight (in a SpikeBatch), must equal the weighted average of the
+ * per-electrode outputs (up to float rounding of the outputs). */
+static bool checkWeightedMean()
+{
+    const double sampleRate = 30000.0;
+    const int numChannels = 8;
+    const int blockSize = 1024;
+    const int numBlocks = 200;
+    const float weights[numChannels] = { 1.0f, 0.5f, 2.0f, 0.0f, 1.0f, 0.25f, 3.0f, 1.0f };
+    double totalWeight = 0;
+    for (float weight : weights)
+    {
+        totalWeight += weight;
+    }
+
+    RateEstimator perElectrode;
+    perElectrode.setNumStates(numChannels);
+    perElectrode.setTimeConstant(100.0, sampleRate);
+
+    RateEstimator weighted;
+    weighted.setTimeConstant(100.0, sampleRate);
+    weighted.setSourceGain(0, 1.0 / totalWeight);
+
+    SpikeTrainGenerator generator(numChannels, 50.0 / sampleRate, 11);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    SpikeBatch electrodeBatch(4096);
+    SpikeBatch weightedBatch(4096);
+    std::vector<float> electrodeData(static_cast<size_t>(numChannels) * blockSize);
+    std::vector<float*> electrodeOutputs(numChannels);
+    for (int chan = 0; chan < numChannels; ++chan)
+    {
+        electrodeOutputs[chan] = electrodeData.data() + static_cast<size_t>(chan) * blockSize;
+    }
+    std::vector<float> weightedOutput(blockSize);
+    float* weightedOutputs[] = { weightedOutput.data() };
+
+    double maxError = 0;
+    for (int block = 0; block < numBlocks; ++block)
+    {
+        generator.nextBlock(blockSize, positions, channels);
+        electrodeBatch.clear();
+        weightedBatch.clear();
+        for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+        {
+            electrodeBatch.add(positions[kSpike], channels[kSpike]);
+            weightedBatch.add(positions[kSpike], 0, 0, weights[channels[kSpike]]);
+        }
+        electrodeBatch.prepare(blockSize);
+        weightedBatch.prepare(blockSize);
+        perElectrode.processBlock(electrodeOutputs.data(), blockSize, electrodeBatch);
+        weighted.processBlock(weightedOutputs, blockSize, weightedBatch);
+
+        for (int k = 0; k < blockSize; ++k)
+        {
+            double expected = 0;
+            for (int chan = 0; chan < numChannels; ++chan)
+            {
+                expected += weights[chan] * electrodeOutputs[chan][k];
+            }
+            expected /= totalWeight;
+            maxError = std::max(maxError, std::abs(weightedOutput[k] - expected) / std::max(expected, 1.0));
+        }
+    }
+
+    return reportCheck(maxError < 1e-5, "weighted mean",
+        formatDetail("max relative difference %.2e from the weighted average of per-electrode outputs", maxError));
+}
+
+/* Unit rates decayed lazily in a UnitRateTable, with units coming and going and spikes a
+ * fraction of a sample before their output sample, must match an estimator with one state
+ * per unit at every readout (up to float rounding), and units must be removed once their
+ * rates have decayed. */
+static bool checkUnitRates()
+{
+    const double sampleRate = 30000.0;
+    const int numElectrodes = 4;
+    std::vector<double> timeConstsMs;
+    timeConstsMs.push_back(10.0);
+    timeConstsMs.push_back(100.0);
+
+    // re-sorted every 0.5 s, for 7 s
+    UnitRunResult result = runUnits(numElectrodes, 50.0, sampleRate, timeConstsMs, 1024, 200, 100, 15000, 13);
+    bool passed = reportCheck(result.maxError < 1e-5 && result.numDropped == 0, "unit rates",
+        formatDetail("max relative difference %.2e from per-unit estimates (%lld readouts, %lld spikes)", result.maxError,
+            result.numReadouts, result.numSpikes));
+
+    UnitRateTable table;
+    table.setCapacity(2, 1);
+    table.setTimeConstant(0, 100.0, sampleRate);
+    table.addSpike(UnitRateTable::makeKey(0, 1), 0);
+    table.addSpike(UnitRateTable::makeKey(0, 2), 10);
+    int full = table.addSpike(UnitRateTable::makeKey(1, 1), 20);
+
+    float values[2];
+    table.readout(sampleRate * 10, values); // 100 time constants later
+    int reused = table.addSpike(UnitRateTable::makeKey(1, 1), static_cast<int64_t>(sampleRate * 10));
+    passed &= reportCheck(full == -1 && table.getAndResetNumDropped() == 1 && reused != -1 && table.getNumUnits() == 1,
+        "unit removal", formatDetail("%d unit(s) in the full table after both decayed and a new one spiked (expected 1)",
+            table.getNumUnits()));
+    return passed;
+}
+
+/* The parallel estimator must produce exactly the same outputs, readouts and threshold crossings
+ * as a single estimator when its partitions are processed on several threads, and small blocks
+ * must fall back to the calling thread; without sources, the mean is 0. */
+static bool checkParallelEngine()
+{
+    BenchOptions opts;
+    opts.spikeRateHz = 50.0;
+    std::vector<double> timeConstsMs;
+    timeConstsMs.push_back(10.0);
+    timeConstsMs.push_back(200.0);
+
+    bool passed = true;
+    for (int readout = 0; readout < 2; ++readout)
+    {
+        // every block split over all threads
+        ParallelRunResult result = runParallelBank(203, timeConstsMs, 4, 1, readout ? 30 : 0, 60.0, 60, opts);
+        passed &= reportCheck(result.identical && result.maxThreadsUsed == 4 && result.numCrossings > 0, "parallel engine",
+            formatDetail("%s, 203 electrodes x 2 time constants on 4 threads: %s a single estimator (%lld crossings)",
+                readout ? "readouts" : "outputs", result.identical ? "same as" : "DIFFERENT from", result.numCrossings));
+    }
+
+    opts.bufferSize = 64;
+    ParallelRunResult small = runParallelBank(16, timeConstsMs, 4, ParallelRateEstimator::DEFAULT_MIN_WORK_PER_THREAD,
+        0, 0, 20, opts);
+    passed &= reportCheck(small.identical && small.maxThreadsUsed == 1, "parallel fallback",
+        formatDetail("16 electrodes x 2 time constants x 64 samples processed on %d thread(s) (expected 1)",
+            small.maxThreadsUsed));
+
+    // (e.g. no spike channels)
+    ParallelRateEstimator empty;
+    empty.setNumThreads(4);
+    empty.setNumStates(0, 2);
+    passed &= reportCheck(empty.getMean(0) == 0, "parallel without sources",
+        formatDetail("mean of 0 sources: %g (expected 0)", empty.getMean(0)));
+    return passed;
+}
+
+/* A block with more readouts than the readout capacity must only write that many (the rest of
+ * a fixed buffer stays untouched) and still advance the states over the whole block, on one
+ * thread and split over several. */
+static bool checkReadoutCapacity()
+{
+    const int NUM_SOURCES = 40;
+    const int NUM_TIME_CONSTS = 2;
+    const int NUM_STATES = NUM_SOURCES * NUM_TIME_CONSTS;
+    const int BLOCK_SIZE = 1000;
+    const int INTERVAL = 100;
+    const int CAPACITY = 3;
+    const float GUARD = -1.0f;
+
+    BenchOptions opts;
+    SpikeTrainGenerator generator(NUM_SOURCES, 100.0 / opts.sampleRate, opts.seed);
+    std::vector<int> positions;
+    std::vector<int> channels;
+    generator.nextBlock(BLOCK_SIZE, positions, channels);
+    SpikeBatch batch(1 << 12);
+    for (size_t kSpike = 0; kSpike < positions.size(); ++kSpike)
+    {
+        batch.add(positions[kSpike], channels[kSpike]);
+    }
+    batch.prepare(BLOCK_SIZE);
+
+    RateEstimator reference;
+    reference.setNumStates(NUM_SOURCES, NUM_TIME_CONSTS);
+    reference.setTimeConstant(0, 10.0, opts.sampleRate);
+    reference.setTimeConstant(1, 200.0, opts.sampleRate);
+    std::vector<float> referenceReadouts(static_cast<size_t>(BLOCK_SIZE / INTERVAL) * NUM_STATES);
+    reference.processBlockReadout(BLOCK_SIZE, batch, 0, INTERVAL, referenceReadouts.data());
+
+    bool passed = true;
+    for (int numThreads = 1; numThreads <= 4; numThreads += 3)
+    {
+        ParallelRateEstimator estimator;
+        estimator.setNumThreads(numThreads);
+        estimator.setMinWorkPerThread(1);
+        estimator.setNumStates(NUM_SOURCES, NUM_TIME_CONSTS);
+        estimator.setReadoutCapacity(CAPACITY);
+        estimator.setTimeConstant(0, 10.0, opts.sampleRate);
+        estimator.setTimeConstant(1, 200.0, opts.sampleRate);
+        estimator.startWorkers();
+
+        // (with a guard readout after the capacity)
+        std::vector<float> readouts(static_cast<size_t>(CAPACITY + 1) * NUM_STATES, GUARD);
+        int numReadouts = estimator.processBlockReadout(nullptr, BLOCK_SIZE, batch, 0, INTERVAL, readouts.data());
+        estimator.stopWorkers();
+
+        bool written = std::equal(readouts.begin(), readouts.begin() + CAPACITY * NUM_STATES, referenceReadouts.begin());
+        bool guarded = std::all_of(readouts.begin() + CAPACITY * NUM_STATES, readouts.end(),
+            [=](float value) { return value == GUARD; });
+        // (up to rounding, as the decay is applied in fewer steps without the skipped readouts)
+        double maxError = 0;
+        for (int state = 0; state < NUM_STATES; ++state)
+        {
+            double expected = reference.getMean(state);
+            maxError = std::max(maxError, std::abs(estimator.getMean(state) - expected) / std::max(expected, 1.0));
+        }
+        bool advanced = maxError < 1e-9;
+
+        passed &= reportCheck(numReadouts == CAPACITY && written && guarded && advanced, "readout capacity",
+            formatDetail("%d of %d readouts on %d thread(s) (expected %d): %s, %s, states %s", numReadouts,
+                BLOCK_SIZE / INTERVAL, estimator.getNumThreadsUsed(), CAPACITY, written ? "values match" : "VALUES DIFFER",
+                guarded ? "buffer not overrun" : "BUFFER OVERRUN", advanced ? "at the end of the block" : "NOT ADVANCED"));
+    }
+    return passed;
+}
+
+// counts the runs of each part
+class CountingJob : public WorkerPool::Job
+{
+public:
+    explicit CountingJob(int numParts)
+        : counts(numParts)
+    {}
+
+    void runPart(int part) override
+    {
+        ++counts[part];
+    }
+
+    // whether each of the first numParts parts has run the given number of times
+    bool hasRun(int numParts, int times) const
+    {
+        for (int part = 0; part < numParts; ++part)
+        {
+            if (counts[part] != times)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<std::atomic<int>> counts;
+};
+
+/* A run published right after the workers are started (possibly before they are first
+ * scheduled) must still be picked up by every worker, also with the largest number of
+ * workers; this hangs if a worker takes it for one it has already seen. */
+static bool checkWorkerPool()
+{
+    const int NUM_STARTS = 200;
+    const int NUM_RUNS = 3;
+
+    WorkerPool pool;
+    bool passed = true;
+    int numStarted = 0;
+    for (; numStarted < NUM_STARTS && passed; ++numStarted)
+    {
+        CountingJob job(4);
+        pool.start(3);
+        for (int run = 0; run < NUM_RUNS; ++run)
+        {
+            pool.run(job, 4);
+        }
+        passed = job.hasRun(4, NUM_RUNS);
+    }
+
+    CountingJob maxJob(WorkerPool::MAX_WORKERS + 1);
+    pool.start(WorkerPool::MAX_WORKERS);
+    pool.run(maxJob, WorkerPool::MAX_WORKERS + 1);
+    pool.stop();
+    bool maxPassed = maxJob.hasRun(WorkerPool::MAX_WORKERS + 1, 1);
+
+    return reportCheck(passed && maxPassed, "worker pool",
+        formatDetail("%d starts followed at once by %d runs on 3 workers, 1 run on %d workers: %s", numStarted,
+            NUM_RUNS, WorkerPool::MAX_WORKERS, passed && maxPassed ? "all parts ran" : "PARTS MISSED"));
+}
+
+// runs the job with numParts parts (if any) every millisecond until at least the given number of the pool's
+// workers are parked (or a timeout), returning the number of runs
+static int runUntilParked(WorkerPool& pool, CountingJob& job, int numParts, int numParked)
+{
+    const int TIMEOUT_MS = 20 * WorkerPool::PARK_AFTER_MS;
+
+    int numRuns = 0;
+    for (int ms = 0; ms < TIMEOUT_MS; ++ms)
+    {
+        if (numParts > 0)
+        {
+            pool.run(job, numParts);
+            ++numRuns;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (pool.getNumParked() >= numParked)
+        {
+            break;
+        }
+    }
+    return numRuns;
+}
+
+/* Workers must stop spinning once they have had no part to run for a while - when the pool
+ * isn't run, and when its runs fall back to fewer parts than there are workers - and still
+ * pick up every run after they have parked. */
+static bool checkWorkerParking()
+{
+    const int NUM_WORKERS = 3;
+
+    const int NUM_FULL_RUNS = 10;
+
+    WorkerPool pool;
+    CountingJob job(NUM_WORKERS + 1);
+    pool.start(NUM_WORKERS);
+    pool.run(job, NUM_WORKERS + 1);
+    runUntilParked(pool, job, 0, NUM_WORKERS);
+    bool idleParked = pool.getNumParked() == NUM_WORKERS;
+
+    // wakes them all and keeps them busy, then the ones that sit out the 2-part runs have to park again
+    for (int run = 0; run < NUM_FULL_RUNS; ++run)
+    {
+        pool.run(job, NUM_WORKERS + 1);
+    }
+    int numSatOut = runUntilParked(pool, job, 2, NUM_WORKERS - 1);
+    bool sitOutParked = pool.getNumParked() >= NUM_WORKERS - 1;
+
+    pool.run(job, NUM_WORKERS + 1);
+    pool.stop();
+    int numFull = NUM_FULL_RUNS + 2;
+    bool allRan = job.hasRun(2, numFull + numSatOut) && job.counts[2] == numFull && job.counts[3] == numFull;
+
+    return reportCheck(idleParked && sitOutParked && allRan, "worker parking",
+        formatDetail("%d workers parked %s idle, %s sitting out %d runs (after %d ms); %s", NUM_WORKERS,
+            idleParked ? "when" : "NOT when", sitOutParked ? "when" : "NOT when", numSatOut,
+            WorkerPool::PARK_AFTER_MS, allRan ? "all parts ran after parking" : "PARTS MISSED after parking"));
+}
+
+/* Carrying the selection over a signal chain update with 2000 electrodes must give each
+ * channel the settings of the same one as a search by name, and take well under a frame at 60 Hz. */
+static bool checkChannelSync()
+{
+    const int NUM_CHANNELS = 2000;
+    const double MAX_MS = 2.0;
+
+    std::vector<std::string> oldNames;
+    std::vector<std::string> newNames;
+    makeChannelNames(NUM_CHANNELS, oldNames, newNames);
+    ChannelSelection selection;
+    std::vector<uint64_t> keys;
+    std::vector<WaveformGate> gates;
+    std::vector<int> searchIndices;
+    std::vector<int> lookupIndices;
+    matchChannelsBySearch(oldNames, newNames, searchIndices);
+
+    // best of a few, so that a descheduled run doesn't fail the check
+    double bestMs = 1e9;
+    bool carriedOver = true;
+    for (int repeat = 0; repeat < 5; ++repeat)
+    {
+        makeChannelSettings(oldNames, selection, keys, gates);
+        Stopwatch watch;
+        watch.start();
+        carryOverChannels(newNames, selection, keys, gates, lookupIndices);
+        watch.stop();
+        bestMs = std::min(bestMs, watch.getNanoseconds() / 1e6);
+        carriedOver = carriedOver && lookupIndices == searchIndices && checkCarriedOver(lookupIndices, selection, gates);
+    }
+
+    int numMatched = static_cast<int>(std::count_if(lookupIndices.begin(), lookupIndices.end(),
+        [](int index) { return index != -1; }));
+    return reportCheck(carriedOver && bestMs <= MAX_MS, "channel sync",
+        formatDetail("%d channels (%d carried over) in %.3f ms (limit %.1f), settings %s", NUM_CHANNELS,
+            numMatched, bestMs, MAX_MS, carriedOver ? "match a search by name" : "DIFFERENT from a search by name"));
+}
+
+/* Waveform features must be the same on every vectorized path as on the scalar one, and
+ * match a straightforward computation, for all channel counts and lengths and for waveforms
+ * that are not 4-byte aligned (as in serialized spike events). */
+static bool checkWaveformFeatures()
+{
+    const int MAX_CHANNELS = 4;
+    const int MAX_SAMPLES = 67;
+    const int OFFSET = 2;
+
+    std::mt19937 rng(17);
+    std::normal_distribution<float> sample(0.0f, 50.0f);
+    std::vector<float> waveform(MAX_CHANNELS * MAX_SAMPLES);
+    std::vector<unsigned char> bytes(OFFSET + waveform.size() * sizeof(float));
+
+    int numCases = 0;
+    int numWrong = 0;
+    for (int numChannels = 1; numChannels <= MAX_CHANNELS; ++numChannels)
+    {
+        for (int numSamples = 1; numSamples <= MAX_SAMPLES; ++numSamples)
+        {
+            int size = numChannels * numSamples;
+            for (int k = 0; k < size; ++k)
+            {
+                waveform[k] = sample(rng);
+            }
+            std::memcpy(bytes.data() + OFFSET, waveform.data(), size * sizeof(float));
+
+            WaveformFeatures expected = { 0.0f, -1.0f, 0 };
+            for (int chan = 0; chan < numChannels; ++chan)
+            {
+                const float* values = waveform.data() + chan * numSamples;
+                int minPos = static_cast<int>(std::min_element(values, values + numSamples) - values);
+                int maxPos = static_cast<int>(std::max_element(values, values + numSamples) - values);
+                expected.peak = std::max(expected.peak, std::max(values[maxPos], -values[minPos]));
+                if (values[maxPos] - values[minPos] > expected.peakToTrough)
+                {
+                    expected.peakToTrough = values[maxPos] - values[minPos];
+                    expected.width = std::abs(maxPos - minPos);
+                }
+            }
+
+            for (int path = DecayKernel::SCALAR; path <= DecayKernel::AVX2; ++path)
+            {
+                if (!DecayKernel::isPathSupported(static_cast<DecayKernel::Path>(path)))
+                {
+                    continue;
+                }
+
+                WaveformFeatures features = WaveformFeatures::compute(bytes.data() + OFFSET, numChannels, numSamples,
+                    static_cast<DecayKernel::Path>(path));
+                ++numCases;
+                numWrong += features.peak != expected.peak || features.peakToTrough != expected.peakToTrough
+                    || features.width != expected.width;
+            }
+        }
+    }
+
+    return reportCheck(numWrong == 0, "waveform features",
+        formatDetail("%d of %d waveforms (all paths) differ from the reference", numWrong, numCases));
+}
+
+/* Every vectorized decay fill path must give exactly the scalar result (each sample is a
+ * single float multiply), for all run lengths and alignments. */
+static bool checkVectorPaths()
+{
+    const int maxLength = 300;
+    std::vector<float> powers(maxLength + 16);
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (float& power : powers)
+    {
+        power = dist(rng);
+    }
+
+    std::vector<float> expected(maxLength + 16);
+    std::vector<float> actual(maxLength + 16);
+    bool passed = true;
+    for (int path = DecayKernel::SSE; path <= DecayKernel::AVX2; ++path)
+    {
+        DecayKernel::Path vectorPath = static_cast<DecayKernel::Path>(path);
+        if (!DecayKernel::isPathSupported(vectorPath))
+        {
+            std::printf("  SKIP vector paths: %s not supported by this CPU\n", DecayKernel::getPathName(vectorPath));
+            continue;
+        }
+
+        long long numMismatched = 0;
+        for (int offset = 0; offset < 8; ++offset)
+        {
+            for (int n = 0; n <= maxLength; ++n)
+            {
+                float start = 1.0f + n * 0.37f;
+                DecayKernel::scale(expected.data() + offset, powers.data() + offset, start, n, DecayKernel::SCALAR);
+                DecayKernel::scale(actual.data() + offset, powers.data() + offset, start, n, vectorPath);
+                numMismatched += std::memcmp(expected.data() + offset, actual.data() + offset, n * sizeof(float)) != 0;
+            }
+        }
+
+        passed &= reportCheck(numMismatched == 0, "vector paths",
+            formatDetail("%s: %lld of %d runs differ from scalar", DecayKernel::getPathName(vectorPath),
+                numMismatched, 8 * (maxLength + 1)));
+    }
+    return passed;
+}
+
+/* Processing cost must stay below maxNsPerSample (--max-ns) for a single output fed by 16
+ * channels and for per-electrode outputs, at the default settings. Guards against
+ * performance regressions; the limit should be set well above the normal cost on the
+ * machine the checks run on. */
+static bool checkThroughput(double maxNsPerSample)
+{
+    BenchOptions opts;
+    opts.seconds = 60.0;
+    long long numBlocks = static_cast<long long>(opts.seconds * opts.sampleRate / opts.bufferSize);
+
+    bool passed = true;
+    for (int perElectrode = 0; perElectrode < 2; ++perElectrode)
+    {
+        int numStates = perElectrode ? opts.numChannels : 1;
+        RateEstimator estimator;
+        estimator.setNumStates(numStates);
+        estimator.setTimeConstant(opts.timeConstMs, opts.sampleRate);
+        if (!perElectrode)
+        {
+            estimator.setSourceGain(0, 1.0 / opts.numChannels);
+        }
+
+        std::vector<float> outputData(static_cast<size_t>(opts.bufferSize) * numStates);
+        std::vector<float*> outputs(numStates);
+        for (int state = 0; state < numStates; ++state)
+        {
+            outputs[state] = outputData.data() + static_cast<size_t>(state) * opts.bufferSize;
+        }
+
+        SpikeTrainGenerator generator(opts.numChannels, opts.spikeRateHz / opts.sampleRate, opts.seed);
+        std::vector<int> positions;
+        std::vector<int> channels;
+        Stopwatch watch;
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            generator.nextBlock(opts.bufferSize, positions, channels);
+            if (!perElectrode)
+            {
+                std::fill(channels.begin(), channels.end(), 0);
+            }
+
+            watch.start();
+            estimator.processBlock(outputs.data(), opts.bufferSize, positions.data(), channels.data(),
+                static_cast<int>(positions.size()));
+            watch.stop();
+        }
+
+        double nsPerSample = watch.getNanoseconds() / (static_cast<double>(numBlocks) * opts.bufferSize * numStates);
+        passed &= reportCheck(nsPerSample <= maxNsPerSample, "throughput",
+            formatDetail("%s: %.3f ns/output sample (limit %.3f)", perElectrode ? "per electrode" : "mean",
+                nsPerSample, maxNsPerSample));
+    }
+    return passed;
+}
+
+static bool runChecks(const BenchOptions& opts)
+{
+    std::printf("checks:\n");
+    bool passed = true;
+    passed &= checkGoldenImpulse();
+    passed &= checkSteadyState();
+    passed &= checkBlockInvariance();
+    passed &= checkTimeConstRamp();
+    passed &= checkBoxcarCapacity();
+    passed &= checkWeightedMean();
+    passed &= checkUnitRates();
+    passed &= checkVectorPaths();
+    passed &= checkWaveformFeatures();
+    passed &= checkChannelSync();
+    passed &= checkWorkerPool();
+    passed &= checkWorkerParking();
+    passed &= checkParallelEngine();
+    passed &= checkReadoutCapacity();
+    passed &= checkThroughput(opts.maxNsPerSample);
+    std::printf("%s\n", passed ? "all checks passed" : "SOME CHECKS FAILED");
+    return passed;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opts;
+    if (!parseBenchOptions(argc, argv, opts))
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (opts.check)
+    {
+        return runChecks(opts) ? 0 : 1;
+    }
+
+    std::printf("%d channels at %g Hz, %g Hz sample rate, tau = %g ms\n",
+        opts.numChannels, opts.spikeRateHz, opts.sampleRate, opts.timeConstMs);
+
+    bool all = opts.scenario == "all";
+    bool ran = false;
+    if (all || opts.scenario == "estimator")
+    {
+        benchEstimator(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "electrodes")
+    {
+        benchElectrodeOutputs(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "timeconsts")
+    {
+        benchTimeConstBank(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "batch")
+    {
+        benchSpikeBatch(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "dispatch")
+    {
+        benchSpikeDispatch(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "gating")
+    {
+        benchGating(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "selection")
+    {
+        benchSelection(opts);
+        ran = true;
+    }
+
+    if (all || opts.scenario == "fill")
+    {
+        benchDecayFill(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "kernels")
+    {
+        benchKernels(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "decimation")
+    {
+        benchDecimation(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "threshold")
+    {
+        benchThreshold(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "export")
+    {
+        benchExport(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "stats")
+    {
+        benchStats(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "units")
+    {
+        benchUnits(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "channelsync")
+    {
+        benchChannelSync(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "parallel")
+    {
+        benchParallel(opts);
+        ran = true;
+    }
+    if (all || opts.scenario == "accuracy")
+    {
+        benchLongRunAccuracy(opts);
+        ran = true;
+    }
+
+    if (!ran)
+    {
+        printUsage();
+        return 1;
+    }
+    return 0;
+}
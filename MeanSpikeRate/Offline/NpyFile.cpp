@@ -0,0 +1,274 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "NpyFile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char MAGIC[] = "\x93NUMPY";
+    const size_t MAGIC_LENGTH = 6;
+    const size_t HEADER_ALIGNMENT = 64;
+
+    // value of a key in the header dict, e.g. "'<i8'" for 'descr' (empty if not found)
+    std::string getHeaderValue(const std::string& header, const std::string& key)
+    {
+        size_t keyPos = header.find("'" + key + "'");
+        if (keyPos == std::string::npos)
+        {
+            return "";
+        }
+
+        size_t start = header.find(':', keyPos);
+        if (start == std::string::npos)
+        {
+            return "";
+        }
+        ++start;
+        while (start < header.size() && header[start] == ' ')
+        {
+            ++start;
+        }
+
+        // tuples contain commas, so end at the matching parenthesis
+        size_t end = header[start] == '(' ? header.find(')', start) + 1 : header.find_first_of(",}", start);
+        return header.substr(start, end - start);
+    }
+}
+
+/*** NpyInput ***/
+
+NpyInput::NpyInput()
+    : region        (nullptr)
+    , regionBytes   (0)
+    , data          (nullptr)
+    , length        (0)
+{}
+
+NpyInput::~NpyInput()
+{
+    close();
+}
+
+bool NpyInput::open(const std::string& path)
+{
+    close();
+
+#ifdef _WIN32
+    error = "memory-mapped input is not supported on Windows";
+    return false;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        error = "could not open " + path;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        regionBytes = static_cast<size_t>(info.st_size);
+        region = mmap(nullptr, regionBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+
+    if (region == nullptr || region == MAP_FAILED)
+    {
+        region = nullptr;
+        error = "could not map " + path;
+        return false;
+    }
+
+    // version 1 has a 2-byte header length, later versions a 4-byte one
+    const unsigned char* bytes = static_cast<const unsigned char*>(region);
+    size_t headerStart = MAGIC_LENGTH + 2 + (regionBytes > MAGIC_LENGTH && bytes[MAGIC_LENGTH] >= 2 ? 4 : 2);
+    if (regionBytes < headerStart || std::memcmp(bytes, MAGIC, MAGIC_LENGTH) != 0)
+    {
+        close();
+        error = path + " is not a .npy file";
+        return false;
+    }
+
+    size_t headerLength = bytes[MAGIC_LENGTH + 2] | (bytes[MAGIC_LENGTH + 3] << 8);
+    if (headerStart == MAGIC_LENGTH + 6)
+    {
+        headerLength |= (static_cast<size_t>(bytes[MAGIC_LENGTH + 4]) << 16) | (static_cast<size_t>(bytes[MAGIC_LENGTH + 5]) << 24);
+    }
+    size_t dataStart = headerStart + headerLength;
+    std::string header(reinterpret_cast<const char*>(bytes) + headerStart,
+        std::min(headerLength, regionBytes - headerStart));
+
+    // spike times are int64 (unsigned is accepted, since timestamps are never negative)
+    std::string descr = getHeaderValue(header, "descr");
+    std::string shape = getHeaderValue(header, "shape");
+    bool is64Bit = descr == "'<i8'" || descr == "'<u8'";
+    int64_t numElements = shape.size() > 1 ? std::atoll(shape.c_str() + 1) : -1;
+    bool isVector = shape.find(',') == std::string::npos || shape.find(", 1)") != std::string::npos
+        || shape.find(",)") != std::string::npos;
+
+    if (!is64Bit || !isVector || numElements < 0 || dataStart + numElements * sizeof(int64_t) > regionBytes)
+    {
+        close();
+        error = path + " is not a vector of 64-bit integers (descr " + descr + ", shape " + shape + ")";
+        return false;
+    }
+
+    data = reinterpret_cast<const int64_t*>(bytes + dataStart);
+    length = numElements;
+
+    // read from start to end, once
+    madvise(region, regionBytes, MADV_SEQUENTIAL);
+    return true;
+#endif
+}
+
+void NpyInput::close()
+{
+#ifndef _WIN32
+    if (region != nullptr)
+    {
+        munmap(region, regionBytes);
+    }
+#endif
+    region = nullptr;
+    regionBytes = 0;
+    data = nullptr;
+    length = 0;
+}
+
+const int64_t* NpyInput::getData() const
+{
+    return data;
+}
+
+int64_t NpyInput::getLength() const
+{
+    return length;
+}
+
+const std::string& NpyInput::getError() const
+{
+    return error;
+}
+
+/*** NpyOutput ***/
+
+NpyOutput::NpyOutput()
+    : region        (nullptr)
+    , regionBytes   (0)
+    , data          (nullptr)
+    , numRows       (0)
+{}
+
+NpyOutput::~NpyOutput()
+{
+    close();
+}
+
+bool NpyOutput::open(const std::string& path, int64_t newNumRows, int numCols)
+{
+    close();
+
+#ifdef _WIN32
+    error = "memory-mapped output is not supported on Windows";
+    return false;
+#else
+    // version 1.0 header, padded so that the data starts on an aligned offset
+    std::string header = "{'descr': '<f4', 'fortran_order': True, 'shape': ("
+        + std::to_string(newNumRows) + ", " + std::to_string(numCols) + "), }";
+    size_t prefixLength = MAGIC_LENGTH + 4;
+    size_t dataStart = (prefixLength + header.size() + 1 + HEADER_ALIGNMENT - 1) / HEADER_ALIGNMENT * HEADER_ALIGNMENT;
+    header.append(dataStart - prefixLength - header.size() - 1, ' ');
+    header += '\n';
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        error = "could not create " + path;
+        return false;
+    }
+
+    regionBytes = dataStart + static_cast<size_t>(newNumRows) * numCols * sizeof(float);
+    if (ftruncate(fd, static_cast<off_t>(regionBytes)) == 0)
+    {
+        region = mmap(nullptr, regionBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (region == nullptr || region == MAP_FAILED)
+    {
+        region = nullptr;
+        error = "could not map " + path + " (" + std::to_string(regionBytes) + " bytes)";
+        return false;
+    }
+
+    char* bytes = static_cast<char*>(region);
+    std::memcpy(bytes, MAGIC, MAGIC_LENGTH);
+    bytes[MAGIC_LENGTH] = 1;
+    bytes[MAGIC_LENGTH + 1] = 0;
+    size_t headerLength = header.size();
+    bytes[MAGIC_LENGTH + 2] = static_cast<char>(headerLength & 0xff);
+    bytes[MAGIC_LENGTH + 3] = static_cast<char>(headerLength >> 8);
+    std::memcpy(bytes + prefixLength, header.data(), headerLength);
+
+    data = reinterpret_cast<float*>(bytes + dataStart);
+    numRows = newNumRows;
+    return true;
+#endif
+}
+
+void NpyOutput::close()
+{
+#ifndef _WIN32
+    if (region != nullptr)
+    {
+        msync(region, regionBytes, MS_SYNC);
+        munmap(region, regionBytes);
+    }
+#endif
+    region = nullptr;
+    regionBytes = 0;
+    data = nullptr;
+    numRows = 0;
+}
+
+float* NpyOutput::getColumn(int col)
+{
+    return data + static_cast<size_t>(col) * numRows;
+}
+
+const std::string& NpyOutput::getError() const
+{
+    return error;
+}
@@ -0,0 +1,94 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef NPY_FILE_H_INCLUDED
+#define NPY_FILE_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+/* Memory-mapped NumPy (.npy) arrays, as used by the Open Ephys binary format (e.g.
+ * spikes/<processor>/<electrode>/spike_times.npy).
+ *
+ * NpyInput maps a 1-dimensional (or N x 1) array of 64-bit integers read-only, so that
+ * long recordings are paged in as they are read rather than loaded up front.
+ *
+ * NpyOutput creates a 2-dimensional float32 array of a fixed size in column-major
+ * ("Fortran") order, so that each column is contiguous and different threads can fill
+ * different columns. It is written through a shared mapping and flushed on close.
+ *
+ * Not available on Windows, where open always fails.
+ */
+class NpyInput
+{
+public:
+    NpyInput();
+    ~NpyInput();
+
+    // returns false, with a message in getError(), if the file can't be mapped or isn't an int64 vector
+    bool open(const std::string& path);
+    void close();
+
+    const int64_t* getData() const;
+    int64_t getLength() const;
+
+    const std::string& getError() const;
+
+private:
+    void* region;
+    size_t regionBytes;
+    const int64_t* data;
+    int64_t length;
+    std::string error;
+
+    NpyInput(const NpyInput&) = delete;
+    NpyInput& operator=(const NpyInput&) = delete;
+};
+
+class NpyOutput
+{
+public:
+    NpyOutput();
+    ~NpyOutput();
+
+    // creates (or replaces) the file with numRows x numCols zeros
+    bool open(const std::string& path, int64_t numRows, int numCols);
+    void close();
+
+    // contiguous column of numRows values
+    float* getColumn(int col);
+
+    const std::string& getError() const;
+
+private:
+    void* region;
+    size_t regionBytes;
+    float* data;
+    int64_t numRows;
+    std::string error;
+
+    NpyOutput(const NpyOutput&) = delete;
+    NpyOutput& operator=(const NpyOutput&) = delete;
+};
+
+#endif // NPY_FILE_H_INCLUDED
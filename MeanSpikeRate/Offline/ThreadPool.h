@@ -0,0 +1,62 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* Runs numJobs independent jobs on up to numThreads threads, each thread taking the next
+ * job that hasn't been started until there are none left, and waits for all of them.
+ * Job(int job) is called once for each job index in [0, numJobs).
+ */
+template <typename Job>
+void runJobs(int numJobs, int numThreads, const Job& job)
+{
+    std::atomic<int> nextJob(0);
+    auto worker = [&]()
+    {
+        for (int kJob = nextJob++; kJob < numJobs; kJob = nextJob++)
+        {
+            job(kJob);
+        }
+    };
+
+    numThreads = std::max(1, std::min(numThreads, numJobs));
+    std::vector<std::thread> threads;
+    for (int kThread = 1; kThread < numThreads; ++kThread)
+    {
+        threads.emplace_back(worker);
+    }
+    worker(); // (the calling thread is one of them)
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+#endif // THREAD_POOL_H_INCLUDED
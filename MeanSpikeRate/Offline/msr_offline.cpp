@@ -0,0 +1,531 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Computes spike rate traces offline from recorded spike times, with the same rate
+ * estimator as the plugin, as fast as the disk and CPUs allow.
+ *
+ * Each input is a spike_times.npy file of one electrode from an Open Ephys binary format
+ * recording (int64 sample numbers at --samplerate). Spikes are read from the memory-mapped
+ * files block by block, mapped to the output sample rate and processed in sorted batches,
+ * exactly as the plugin does with "Batch spikes" on, so with the same --buffer size (and
+ * sample rates) the output matches the plugin's sample for sample. Each output (source)
+ * is independent, so the outputs are computed in parallel by a pool of threads.
+ *
+ * The output is a float32 .npy array of shape (samples, outputs), with the outputs in the
+ * same order as the plugin's output channels (source-major, one per time constant).
+ *
+ * Usage: msr_offline [options] --out rates.npy spike_times.npy...
+ *   --samplerate Hz      sample rate of the spike times (default 30000)
+ *   --outrate Hz         sample rate of the output (default: same as the spike times)
+ *   --tau ms[,ms...]     time constants (default 1000)
+ *   --mode mean|electrodes|groups   (default mean)
+ *   --groups spec        electrode groups for groups mode, e.g. "1-4; 5, 7" (inputs numbered from 1)
+ *   --select spec        electrodes to include, e.g. "1-8, 10" (default all)
+ *   --kernel name        exponential|alpha|gamma|gaussian|boxcar (default exponential)
+ *   --buffer samples     output samples per block (default 1024)
+ *   --start sample       spike time of the first output sample (default 0)
+ *   --samples N          number of output samples (default: up to the block of the last spike)
+ *   --threads N          (default: number of CPUs)
+ *   --check              also compute all outputs in a single estimator and compare
+ */
+
+#include "NpyFile.h"
+#include "ThreadPool.h"
+#include "../Source/RateCore/RateEstimator.h"
+#include "../Source/RateCore/ElectrodeGroups.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct OfflineOptions
+{
+    double spikeSampleRate = 30000.0;
+    double outputSampleRate = 0;    // 0 = same as spikeSampleRate
+    std::vector<double> timeConstsMs;
+    std::string mode = "mean";
+    std::string groups;
+    std::string select;
+    RateKernelType kernel = KERNEL_EXPONENTIAL;
+    int bufferSize = 1024;
+    int64_t start = 0;
+    int64_t numSamples = -1;        // -1 = through the block of the last spike
+    int numThreads = 0;             // 0 = number of CPUs
+    bool check = false;
+    std::string outPath;
+    std::vector<std::string> inPaths;
+};
+
+static void printUsage()
+{
+    std::printf("Usage: msr_offline [--samplerate Hz] [--outrate Hz] [--tau ms[,ms...]]\n"
+                "                   [--mode mean|electrodes|groups] [--groups spec] [--select spec]\n"
+                "                   [--kernel exponential|alpha|gamma|gaussian|boxcar] [--buffer samples]\n"
+                "                   [--start sample] [--samples N] [--threads N] [--check]\n"
+                "                   --out rates.npy spike_times.npy...\n");
+}
+
+static bool parseTimeConsts(const char* spec, std::vector<double>& out)
+{
+    out.clear();
+    for (const char* pos = spec; *pos != '\0'; )
+    {
+        char* end;
+        double value = std::strtod(pos, &end);
+        if (end == pos || value <= 0)
+        {
+            return false;
+        }
+        out.push_back(value);
+        pos = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+        {
+            return false;
+        }
+    }
+    return !out.empty() && out.size() <= 8;
+}
+
+static bool parseKernel(const std::string& name, RateKernelType* out)
+{
+    for (int type = 0; type < NUM_KERNEL_TYPES; ++type)
+    {
+        std::string kernelName = getKernelName(static_cast<RateKernelType>(type));
+        std::transform(kernelName.begin(), kernelName.end(), kernelName.begin(), ::tolower);
+        if (kernelName == name)
+        {
+            *out = static_cast<RateKernelType>(type);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseOfflineOptions(int argc, char* argv[], OfflineOptions& opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--check")
+        {
+            opts.check = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0)
+        {
+            opts.inPaths.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        const char* val = argv[++i];
+
+        if (arg == "--samplerate")      opts.spikeSampleRate = std::atof(val);
+        else if (arg == "--outrate")    opts.outputSampleRate = std::atof(val);
+        else if (arg == "--tau")        { if (!parseTimeConsts(val, opts.timeConstsMs)) return false; }
+        else if (arg == "--mode")       opts.mode = val;
+        else if (arg == "--groups")     opts.groups = val;
+        else if (arg == "--select")     opts.select = val;
+        else if (arg == "--kernel")     { if (!parseKernel(val, &opts.kernel)) return false; }
+        else if (arg == "--buffer")     opts.bufferSize = std::atoi(val);
+        else if (arg == "--start")      opts.start = std::atoll(val);
+        else if (arg == "--samples")    opts.numSamples = std::atoll(val);
+        else if (arg == "--threads")    opts.numThreads = std::atoi(val);
+        else if (arg == "--out")        opts.outPath = val;
+        else
+        {
+            return false;
+        }
+    }
+
+    if (opts.timeConstsMs.empty())
+    {
+        opts.timeConstsMs.push_back(1000.0);
+    }
+    if (opts.outputSampleRate <= 0)
+    {
+        opts.outputSampleRate = opts.spikeSampleRate;
+    }
+    if (opts.numThreads <= 0)
+    {
+        opts.numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    return opts.spikeSampleRate > 0 && opts.bufferSize > 0 && !opts.outPath.empty() && !opts.inPaths.empty()
+        && (opts.mode == "mean" || opts.mode == "electrodes" || opts.mode == "groups");
+}
+
+/* Which inputs feed into each output source, following the plugin's output modes. */
+struct SourceAssignment
+{
+    std::vector<std::vector<int>> sourceInputs; // input indices per source
+    std::vector<std::string> sourceNames;
+
+    bool assign(const OfflineOptions& opts, int numInputs, std::string& error)
+    {
+        // selected inputs (all by default); ';' may be used in the spec too
+        std::vector<bool> selected(numInputs, opts.select.empty());
+        if (!opts.select.empty())
+        {
+            ElectrodeGroups selection;
+            if (!selection.parse(opts.select))
+            {
+                error = "invalid --select spec";
+                return false;
+            }
+            for (int group = 0; group < selection.getNumGroups(); ++group)
+            {
+                for (int input : selection.getGroup(group))
+                {
+                    if (input < numInputs)
+                    {
+                        selected[input] = true;
+                    }
+                }
+            }
+        }
+
+        if (opts.mode == "electrodes")
+        {
+            for (int input = 0; input < numInputs; ++input)
+            {
+                if (selected[input])
+                {
+                    sourceInputs.push_back(std::vector<int>(1, input));
+                    sourceNames.push_back("electrode " + std::to_string(input + 1));
+                }
+            }
+        }
+        else if (opts.mode == "groups")
+        {
+            ElectrodeGroups groups;
+            if (!groups.parse(opts.groups) || groups.getNumGroups() == 0)
+            {
+                error = "groups mode needs a valid --groups spec";
+                return false;
+            }
+
+            // an electrode listed in several groups only counts towards the first (as in the plugin)
+            std::vector<bool> assigned(numInputs, false);
+            for (int group = 0; group < groups.getNumGroups(); ++group)
+            {
+                std::vector<int> inputs;
+                for (int input : groups.getGroup(group))
+                {
+                    if (input < numInputs && selected[input] && !assigned[input])
+                    {
+                        inputs.push_back(input);
+                        assigned[input] = true;
+                    }
+                }
+                sourceInputs.push_back(inputs);
+                sourceNames.push_back("group " + std::to_string(group + 1));
+            }
+        }
+        else
+        {
+            std::vector<int> inputs;
+            for (int input = 0; input < numInputs; ++input)
+            {
+                if (selected[input])
+                {
+                    inputs.push_back(input);
+                }
+            }
+            sourceInputs.push_back(inputs);
+            sourceNames.push_back("mean");
+        }
+
+        if (sourceInputs.empty())
+        {
+            error = "no electrodes selected";
+            return false;
+        }
+        return true;
+    }
+};
+
+/* Feeds the spikes of a set of inputs into the estimator block by block, in the same way
+ * as the plugin: spike times within each block are mapped to the output sample rate and
+ * collected in a SpikeBatch, which is sorted and then processed in one pass.
+ */
+class BlockSpikeReader
+{
+public:
+    static const int SPIKE_BATCH_CAPACITY = 1 << 16;
+
+    BlockSpikeReader(const OfflineOptions& opts, const std::vector<NpyInput*>& inputs, const std::vector<int>& inputSources)
+        : opts          (opts)
+        , inputs        (inputs)
+        , inputSources  (inputSources)
+        , cursors       (inputs.size(), 0)
+        , batch         (SPIKE_BATCH_CAPACITY)
+        , numSpikes     (0)
+        , numDropped    (0)
+    {
+        mapping.setSampleRates(opts.spikeSampleRate, opts.outputSampleRate);
+
+        // skip spikes before the start
+        for (size_t k = 0; k < inputs.size(); ++k)
+        {
+            const int64_t* times = inputs[k]->getData();
+            cursors[k] = std::lower_bound(times, times + inputs[k]->getLength(), opts.start) - times;
+        }
+    }
+
+    // collects the spikes of the given block (of numSamples output samples)
+    const SpikeBatch& readBlock(int64_t block, int numSamples)
+    {
+        int64_t blockStart = opts.start + getSpikeOffset(block);
+        int64_t blockEnd = opts.start + getSpikeOffset(block + 1);
+
+        batch.clear();
+        for (size_t k = 0; k < inputs.size(); ++k)
+        {
+            const int64_t* times = inputs[k]->getData();
+            int64_t length = inputs[k]->getLength();
+            int64_t& cursor = cursors[k];
+            for (; cursor < length && times[cursor] < blockEnd; ++cursor)
+            {
+                int outputPosition, subSample;
+                mapping.map(static_cast<int>(times[cursor] - blockStart), &outputPosition, &subSample);
+                batch.add(outputPosition, inputSources[k], subSample);
+                ++numSpikes;
+            }
+        }
+        batch.prepare(numSamples);
+        numDropped += batch.getAndResetNumDropped();
+        return batch;
+    }
+
+    int64_t getNumSpikes() const { return numSpikes; }
+    int64_t getNumDropped() const { return numDropped; }
+
+private:
+    // first spike sample of a block, relative to the start
+    int64_t getSpikeOffset(int64_t block) const
+    {
+        if (mapping.isIdentity())
+        {
+            return block * opts.bufferSize;
+        }
+        return static_cast<int64_t>(std::llround(block * opts.bufferSize * opts.spikeSampleRate / opts.outputSampleRate));
+    }
+
+    const OfflineOptions& opts;
+    std::vector<NpyInput*> inputs;
+    std::vector<int> inputSources;
+    std::vector<int64_t> cursors;
+    SpikeTimeMapping mapping;
+    SpikeBatch batch;
+    int64_t numSpikes;
+    int64_t numDropped;
+};
+
+static void setUpEstimator(RateEstimator& estimator, const OfflineOptions& opts, int numSources)
+{
+    estimator.setKernel(opts.kernel);
+    estimator.setNumStates(numSources, static_cast<int>(opts.timeConstsMs.size()));
+    for (size_t kTau = 0; kTau < opts.timeConstsMs.size(); ++kTau)
+    {
+        estimator.setTimeConstant(static_cast<int>(kTau), opts.timeConstsMs[kTau], opts.outputSampleRate);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    OfflineOptions opts;
+    if (!parseOfflineOptions(argc, argv, opts))
+    {
+        printUsage();
+        return 1;
+    }
+
+    // map the inputs
+    int numInputs = static_cast<int>(opts.inPaths.size());
+    std::vector<std::unique_ptr<NpyInput>> inputs;
+    int64_t lastSpike = opts.start;
+    for (const std::string& path : opts.inPaths)
+    {
+        inputs.emplace_back(new NpyInput());
+        if (!inputs.back()->open(path))
+        {
+            std::fprintf(stderr, "msr_offline: %s\n", inputs.back()->getError().c_str());
+            return 1;
+        }
+        if (inputs.back()->getLength() > 0)
+        {
+            lastSpike = std::max(lastSpike, inputs.back()->getData()[inputs.back()->getLength() - 1]);
+        }
+    }
+
+    SourceAssignment sources;
+    std::string error;
+    if (!sources.assign(opts, numInputs, error))
+    {
+        std::fprintf(stderr, "msr_offline: %s\n", error.c_str());
+        return 1;
+    }
+
+    int numSources = static_cast<int>(sources.sourceInputs.size());
+    int numTimeConsts = static_cast<int>(opts.timeConstsMs.size());
+    int numOutputs = numSources * numTimeConsts;
+    if (opts.numSamples < 0)
+    {
+        int64_t lastOutputSample = static_cast<int64_t>(std::ceil((lastSpike - opts.start) * opts.outputSampleRate / opts.spikeSampleRate));
+        opts.numSamples = (lastOutputSample / opts.bufferSize + 1) * opts.bufferSize;
+    }
+    int64_t numBlocks = (opts.numSamples + opts.bufferSize - 1) / opts.bufferSize;
+
+    NpyOutput output;
+    if (!output.open(opts.outPath, opts.numSamples, numOutputs))
+    {
+        std::fprintf(stderr, "msr_offline: %s\n", output.getError().c_str());
+        return 1;
+    }
+
+    for (int source = 0; source < numSources; ++source)
+    {
+        for (int kTau = 0; kTau < numTimeConsts; ++kTau)
+        {
+            std::printf("column %d: %s, time constant %g ms\n", source * numTimeConsts + kTau,
+                sources.sourceNames[source].c_str(), opts.timeConstsMs[kTau]);
+        }
+    }
+
+    // each source is computed by its own estimator, one source per job
+    std::vector<int64_t> sourceSpikes(numSources, 0);
+    std::vector<int64_t> sourceDropped(numSources, 0);
+    auto start = std::chrono::steady_clock::now();
+
+    runJobs(numSources, opts.numThreads, [&](int source)
+    {
+        const std::vector<int>& inputIndices = sources.sourceInputs[source];
+        std::vector<NpyInput*> sourceInputs;
+        for (int input : inputIndices)
+        {
+            sourceInputs.push_back(inputs[input].get());
+        }
+        BlockSpikeReader reader(opts, sourceInputs, std::vector<int>(inputIndices.size(), 0));
+
+        RateEstimator estimator;
+        setUpEstimator(estimator, opts, 1);
+        estimator.setSourceGain(0, inputIndices.empty() ? 0.0 : 1.0 / inputIndices.size());
+
+        std::vector<float*> outputs(numTimeConsts);
+        for (int64_t block = 0; block < numBlocks; ++block)
+        {
+            int64_t blockStart = block * opts.bufferSize;
+            int numSamples = static_cast<int>(std::min<int64_t>(opts.bufferSize, opts.numSamples - blockStart));
+            for (int kTau = 0; kTau < numTimeConsts; ++kTau)
+            {
+                outputs[kTau] = output.getColumn(source * numTimeConsts + kTau) + blockStart;
+            }
+            estimator.processBlock(outputs.data(), numSamples, reader.readBlock(block, numSamples));
+        }
+
+        sourceSpikes[source] = reader.getNumSpikes();
+        sourceDropped[source] = reader.getNumDropped();
+    });
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int64_t numSpikes = 0;
+    int64_t numDropped = 0;
+    for (int source = 0; source < numSources; ++source)
+    {
+        numSpikes += sourceSpikes[source];
+        numDropped += sourceDropped[source];
+    }
+
+    std::printf("%lld samples x %d outputs from %lld spikes in %.2f s (%.1fx real time, %d threads)\n",
+        static_cast<long long>(opts.numSamples), numOutputs, static_cast<long long>(numSpikes), seconds,
+        opts.numSamples / opts.outputSampleRate / seconds, std::min(opts.numThreads, numSources));
+    if (numDropped > 0)
+    {
+        std::printf("%lld spikes were dropped because more than %d fell in a single block\n",
+            static_cast<long long>(numDropped), BlockSpikeReader::SPIKE_BATCH_CAPACITY);
+    }
+
+    // the plugin computes all sources in one estimator; check that splitting them up changes nothing
+    int result = 0;
+    if (opts.check)
+    {
+        std::vector<NpyInput*> allInputs;
+        std::vector<int> inputSources;
+        for (int source = 0; source < numSources; ++source)
+        {
+            for (int input : sources.sourceInputs[source])
+            {
+                allInputs.push_back(inputs[input].get());
+                inputSources.push_back(source);
+            }
+        }
+        BlockSpikeReader reader(opts, allInputs, inputSources);
+
+        RateEstimator estimator;
+        setUpEstimator(estimator, opts, numSources);
+        for (int source = 0; source < numSources; ++source)
+        {
+            size_t numElectrodes = sources.sourceInputs[source].size();
+            estimator.setSourceGain(source, numElectrodes > 0 ? 1.0 / numElectrodes : 0.0);
+        }
+
+        std::vector<float> blockData(static_cast<size_t>(opts.bufferSize) * numOutputs);
+        std::vector<float*> outputs(numOutputs);
+        for (int state = 0; state < numOutputs; ++state)
+        {
+            outputs[state] = blockData.data() + static_cast<size_t>(state) * opts.bufferSize;
+        }
+
+        int64_t numMismatched = 0;
+        for (int64_t block = 0; block < numBlocks; ++block)
+        {
+            int64_t blockStart = block * opts.bufferSize;
+            int numSamples = static_cast<int>(std::min<int64_t>(opts.bufferSize, opts.numSamples - blockStart));
+            estimator.processBlock(outputs.data(), numSamples, reader.readBlock(block, numSamples));
+
+            // states are time constant-major, columns source-major
+            for (int state = 0; state < numOutputs; ++state)
+            {
+                int col = (state % numSources) * numTimeConsts + state / numSources;
+                numMismatched += std::memcmp(outputs[state], output.getColumn(col) + blockStart,
+                    numSamples * sizeof(float)) != 0;
+            }
+        }
+
+        std::printf("check: %lld of %lld output blocks differ from a single estimator\n",
+            static_cast<long long>(numMismatched), static_cast<long long>(numBlocks * numOutputs));
+        result = numMismatched > 0 ? 2 : 0;
+    }
+
+    output.close();
+    return result;
+}
@@ -0,0 +1,243 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "RateFrameReader.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace RateFrameRing;
+
+RateFrameReader::RateFrameReader()
+    : header        (nullptr)
+    , channelWords  (nullptr)
+    , frames        (nullptr)
+    , mappedBytes   (0)
+    , nextFrame     (0)
+    , numLost       (0)
+{}
+
+RateFrameReader::~RateFrameReader()
+{
+    close();
+}
+
+bool RateFrameReader::open(const std::string& name)
+{
+    close();
+
+#ifdef _WIN32
+    (void)name;
+    return false;
+#else
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat info;
+    void* region = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(RateFrameRingHeader))
+    {
+        mappedBytes = static_cast<uint64_t>(info.st_size);
+        region = mmap(nullptr, mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (region == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(region);
+    header = reinterpret_cast<const RateFrameRingHeader*>(base);
+
+    // check that the writer has finished setting up and the layout is the one we expect
+    RateFrameRingHeader expected;
+    bool valid = header->magic.load(std::memory_order_acquire) == MAGIC && header->version == VERSION;
+    if (valid)
+    {
+        computeLayout(&expected, header->numSources, header->numTimeConsts, header->numChannels, header->capacity);
+        valid = expected.numValues == header->numValues && expected.frameBytes == header->frameBytes
+            && expected.framesOffset == header->framesOffset && expected.totalBytes == header->totalBytes
+            && expected.totalBytes <= mappedBytes;
+    }
+
+    if (!valid)
+    {
+        munmap(region, mappedBytes);
+        header = nullptr;
+        return false;
+    }
+
+    channelWords = reinterpret_cast<const std::atomic<uint32_t>*>(base + header->channelsOffset);
+    frames = base + header->framesOffset;
+    nextFrame = header->writeCount.load(std::memory_order_acquire);
+    numLost = 0;
+    return true;
+#endif
+}
+
+void RateFrameReader::close()
+{
+#ifndef _WIN32
+    if (header != nullptr)
+    {
+        munmap(const_cast<RateFrameRingHeader*>(header), mappedBytes);
+    }
+#endif
+    header = nullptr;
+    channelWords = nullptr;
+    frames = nullptr;
+    mappedBytes = 0;
+}
+
+bool RateFrameReader::isOpen() const
+{
+    return header != nullptr;
+}
+
+int RateFrameReader::getNumValues() const
+{
+    return header != nullptr ? static_cast<int>(header->numValues) : 0;
+}
+
+int RateFrameReader::getNumSources() const
+{
+    return header != nullptr ? static_cast<int>(header->numSources) : 0;
+}
+
+int RateFrameReader::getNumTimeConsts() const
+{
+    return header != nullptr ? static_cast<int>(header->numTimeConsts) : 0;
+}
+
+int RateFrameReader::getNumChannels() const
+{
+    return header != nullptr ? static_cast<int>(header->numChannels) : 0;
+}
+
+double RateFrameReader::getSampleRate() const
+{
+    return header != nullptr ? header->sampleRate : 0.0;
+}
+
+bool RateFrameReader::isChannelEnabled(int channel) const
+{
+    if (header == nullptr || channel < 0 || channel >= static_cast<int>(header->numChannels))
+    {
+        return false;
+    }
+    return (channelWords[channel / 32].load(std::memory_order_relaxed) >> (channel % 32)) & 1;
+}
+
+bool RateFrameReader::readNext(int64_t* timestamp, float* values)
+{
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        uint64_t writeCount = header->writeCount.load(std::memory_order_acquire);
+        if (nextFrame >= writeCount)
+        {
+            return false;
+        }
+
+        // frames older than the capacity have been overwritten
+        uint64_t oldest = writeCount > header->capacity ? writeCount - header->capacity : 0;
+        if (nextFrame < oldest)
+        {
+            numLost += oldest - nextFrame;
+            nextFrame = oldest;
+        }
+
+        if (tryRead(nextFrame, timestamp, values))
+        {
+            ++nextFrame;
+            return true;
+        }
+
+        // overwritten while copying; the next pass skips ahead
+    }
+}
+
+bool RateFrameReader::readLatest(int64_t* timestamp, float* values)
+{
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        uint64_t writeCount = header->writeCount.load(std::memory_order_acquire);
+        if (nextFrame >= writeCount)
+        {
+            return false;
+        }
+
+        // skipping frames on purpose doesn't count as losing them
+        nextFrame = writeCount - 1;
+        if (tryRead(nextFrame, timestamp, values))
+        {
+            ++nextFrame;
+            return true;
+        }
+    }
+}
+
+uint64_t RateFrameReader::getNumLost() const
+{
+    return numLost;
+}
+
+// private
+
+bool RateFrameReader::tryRead(uint64_t frame, int64_t* timestamp, float* values) const
+{
+    const RateFrameHeader* frameHeader = reinterpret_cast<const RateFrameHeader*>(
+        frames + static_cast<size_t>(frame % header->capacity) * header->frameBytes);
+
+    uint64_t complete = 2 * frame + 2;
+    if (frameHeader->sequence.load(std::memory_order_acquire) != complete)
+    {
+        return false;
+    }
+
+    *timestamp = frameHeader->timestamp;
+    std::memcpy(values, getFrameValues(frameHeader), header->numValues * sizeof(float));
+
+    // if the writer started on this slot again while we were copying, the copy may be torn
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frameHeader->sequence.load(std::memory_order_relaxed) == complete;
+}
@@ -0,0 +1,100 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RATE_FRAME_READER_H_INCLUDED
+#define RATE_FRAME_READER_H_INCLUDED
+
+#include "../Source/RateCore/RateFrameRing.h"
+#include <string>
+
+/* Reads the rate frames that the Mean Spike Rate plugin exports to shared memory (see
+ * RateFrameRing.h), for use in other processes such as real-time decoders. Attaching
+ * allocates nothing; reading only copies the frame and never blocks the plugin.
+ *
+ * Typical use:
+ *
+ *   RateFrameReader reader;
+ *   if (reader.open("/msr-105"))
+ *   {
+ *       std::vector<float> rates(reader.getNumValues());
+ *       int64_t timestamp;
+ *       while (running)
+ *       {
+ *           if (reader.readNext(&timestamp, rates.data()))
+ *           {
+ *               // rates[source * numTimeConsts + timeConst], in Hz
+ *           }
+ *       }
+ *   }
+ *
+ * Not available on Windows, where open always fails.
+ */
+class RateFrameReader
+{
+public:
+    RateFrameReader();
+    ~RateFrameReader();
+
+    // returns false if the region doesn't exist (yet) or has an incompatible layout.
+    // reading starts at the next frame written after opening.
+    bool open(const std::string& name);
+    void close();
+    bool isOpen() const;
+
+    int getNumValues() const;
+    int getNumSources() const;
+    int getNumTimeConsts() const;
+    int getNumChannels() const;
+    double getSampleRate() const;
+
+    // enabled state of a spike channel as of the last frame read
+    bool isChannelEnabled(int channel) const;
+
+    // copies the oldest frame not read yet into values (getNumValues() floats) and returns
+    // true, or returns false if there is none. If the reader falls so far behind that frames
+    // are overwritten before it reads them, it skips to the oldest one still available.
+    bool readNext(int64_t* timestamp, float* values);
+
+    // skips to the newest frame and reads it (returns false if there is no new frame)
+    bool readLatest(int64_t* timestamp, float* values);
+
+    // frames written since opening that were overwritten before they could be read
+    uint64_t getNumLost() const;
+
+private:
+    // copies frame n if it is still intact
+    bool tryRead(uint64_t frame, int64_t* timestamp, float* values) const;
+
+    const RateFrameRing::RateFrameRingHeader* header;
+    const std::atomic<uint32_t>* channelWords;
+    const char* frames;
+    uint64_t mappedBytes;
+    uint64_t nextFrame;
+    uint64_t numLost;
+
+    // not copyable
+    RateFrameReader(const RateFrameReader&) = delete;
+    RateFrameReader& operator=(const RateFrameReader&) = delete;
+};
+
+#endif // RATE_FRAME_READER_H_INCLUDED
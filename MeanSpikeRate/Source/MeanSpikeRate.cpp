@@ -23,16 +23,62 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "MeanSpikeRate.h"
 #include "MeanSpikeRateEditor.h"
+#include <algorithm> // sort
+#include <cstring> // memcpy
 
 MeanSpikeRate::MeanSpikeRate()
     : GenericProcessor          ("Mean Spike Rate")
     , outputChan                (0)
-    , timeConstMs               (1000.0)
-    , currSample                (0)
-    , currMean                  (0.0f)
-    , wpBuffer                  (nullptr)
+    , addOutputChannels         (true)
+    , smoothingMs               (0)
+    , numTimeConsts             (1)
+    , outputMode                (OUTPUT_MEAN)
+    , kernelType                (KERNEL_EXPONENTIAL)
+    , readoutInterval           (1)
+    , batchSpikes               (true)
+    , thresholdOnHz             (0)
+    , thresholdOffHz            (0)
+    , exportInterval            (0)
+    , normalizeOnOutput         (false)
+    , maxUnits                  (256)
+    , numThreads                (1)
+    , numInputChans             (0)
+    , firstAddedChan            (-1)
+    , activeOutputMode          (OUTPUT_MEAN)
+    , activeNumTimeConsts       (1)
+    , activeNormalizeOnOutput   (false)
+    , blockOutputChan           (0)
+    , appliedSelectionVersion   (0)
+    , mappedOutputChan          (-1)
+    , activeReadoutInterval     (1)
+    , nextReadout               (0)
+    , numDroppedReadouts        (0)
+    , rateEventChannel          (nullptr)
+    , unitBlockStart            (0)
+    , unitEventChannel          (nullptr)
+    , sentUnitsVersion          (0)
+    , numDroppedUnitSpikes      (0)
+    , crossingEventChannel      (nullptr)
+    , spikeBatch                (SPIKE_BATCH_CAPACITY)
+    , batchingThisBlock         (true)
+    , numDroppedSpikes          (0)
+#if MSR_INSTRUMENTATION
+    , blockSpikes               (0)
+    , blockRejected             (0)
+    , blockMaxFill              (0)
+    , lastSpikePosition         (0)
+#endif
 {
     setProcessorType(PROCESSOR_TYPE_FILTER);
+
+    sortedCrossings.reserve(RateEngine<ExponentialKernel>::MAX_CROSSINGS);
+    estimator.setSpikeCapacity(SPIKE_BATCH_CAPACITY);
+
+    for (int kTau = 0; kTau < MAX_TIME_CONSTS; ++kTau)
+    {
+        timeConstsMs[kTau] = 1000.0;
+    }
+    publishLiveParams();
 }
 
 MeanSpikeRate::~MeanSpikeRate() {}
@@ -45,64 +91,203 @@ AudioProcessorEditor* MeanSpikeRate::createEditor()
 
 void MeanSpikeRate::process(AudioSampleBuffer& continuousBuffer)
 {
+    MSR_STATS(int64_t blockStartNs = getStatsTimeNs();)
+    MSR_STATS(blockSpikes = 0; blockRejected = 0; blockMaxFill = 0; lastSpikePosition = 0;)
+
+    // pick up parameter changes only at buffer boundaries
+    liveParams.update();
+    liveGates.update();
+    const LiveParams& params = liveParams.get();
+
+    blockOutputChan = params.outputChan;
     int numSamples;
-    if (getNumInputs() == 0 || (numSamples = getNumSamples(outputChan)) == 0)
+    if (blockOutputChan < 0 || blockOutputChan >= numInputChans || (numSamples = getNumSamples(blockOutputChan)) == 0)
     {
         return;
     }
 
-    // update algorithm parameters
-    // we assume each spike channel has the same sample rate as the selected channel.
-    // if not, this would get a lot more complicated.
+    // with no electrodes selected, an overwritten channel is left as it is. added channels are still
+    // written (they would otherwise pass on whatever the buffer held), and their rates decay.
     int numActiveElectrodes = getNumActiveElectrodes();
-    if (numActiveElectrodes == 0)
+    if (numActiveElectrodes == 0 && firstAddedChan == -1)
     {
         return;
     }
-    double timeConstSec = timeConstMs / 1000.0;
-    double timeConstSamp = timeConstSec * getDataChannel(outputChan)->getSampleRate();
-    decayPerSample = exp(-1 / timeConstSamp);
-    
-    // the initial amplitude of each spike such that if there is a steady rate of
-    // spiking, the average over time of the exponentially weighted mean
-    // (at the limit where the process has been continuing forever)
-    // equals the actual spike rate in Hz. This is just 1 / (time const in sec).
-    spikeAmp = 1 / (timeConstSec * numActiveElectrodes);
 
-    // initialize first sample
-    currSample = 0;
-    wpBuffer = continuousBuffer.getWritePointer(outputChan);
+    // update algorithm parameters
+    double sampleRate = getDataChannel(blockOutputChan)->getSampleRate();
+    if (blockOutputChan != mappedOutputChan)
+    {
+        updateSpikeTimeMappings(blockOutputChan);
+    }
+
+    bool unitMode = activeOutputMode == OUTPUT_PER_UNIT;
+    int smoothingSamples = static_cast<int>(params.smoothingMs / 1000.0 * sampleRate);
+    for (int kTau = 0; kTau < activeNumTimeConsts; ++kTau)
+    {
+        TimeConstRamp& ramp = timeConstRamps[kTau];
+        ramp.setRampLength(smoothingSamples);
+        ramp.setTarget(params.timeConstsMs[kTau]);
+
+        // steps before the target are only held for a block, so their decay tables are updated cheaply
+        bool ramping = ramp.isRamping();
+        double timeConstMs = ramp.nextBlock(numSamples);
+        if (unitMode)
+        {
+            unitRates.setTimeConstant(kTau, timeConstMs, sampleRate, ramping);
+        }
+        else
+        {
+            estimator.setTimeConstant(kTau, timeConstMs, sampleRate, ramping);
+        }
+    }
+
+    if (crossingEventChannel != nullptr)
+    {
+        estimator.setThreshold(params.thresholdOnHz, params.thresholdOffHz);
+    }
+
+    // source gains and outputs only change when electrodes are toggled
+    unsigned selectionVersion = spikeChannelSelection.getVersion();
+    if (selectionVersion != appliedSelectionVersion)
+    {
+        updateSourceOutputs();
+        appliedSelectionVersion = selectionVersion;
+    }
+
+    // decimated readouts (if the event channel could be created) and exported frames need all of the block's spikes at once.
+    // units are only ever read out.
+    bool decimated = unitMode || (activeReadoutInterval != 1 && rateEventChannel != nullptr);
+    bool exporting = frameWriter.isOpen();
+    if (!decimated)
+    {
+        // each source's rates at the different time constants go on consecutive channels,
+        // starting at the first added channel or the selected one
+        int firstChan = firstAddedChan != -1 ? firstAddedChan : blockOutputChan;
+        int numChans = continuousBuffer.getNumChannels();
+        int numSources = estimator.getNumSources();
+        for (int source = 0; source < numSources; ++source)
+        {
+            int offset = sourceOutputOffset[source];
+            for (int kTau = 0; kTau < activeNumTimeConsts; ++kTau)
+            {
+                int chan = firstChan + offset * activeNumTimeConsts + kTau;
+                // (added channels have no upstream source, and follow the timing of the selected channel)
+                bool hasOutput = offset != -1 && chan < numChans
+                    && (firstAddedChan != -1 || getNumSamples(chan) == numSamples);
+                stateOutputs.set(kTau * numSources + source, hasOutput ? continuousBuffer.getWritePointer(chan) : nullptr);
+            }
+        }
+    }
+
+    batchingThisBlock = params.batchSpikes || decimated || exporting;
+    if (batchingThisBlock)
+    {
+        // collect this block's spikes, then process them in sample order in one pass.
+        // this also handles spikes that arrive out of order (e.g. from merged streams).
+        spikeBatch.clear();
+        checkForEvents(true);
+        spikeBatch.prepare(numSamples);
+        numDroppedSpikes += spikeBatch.getAndResetNumDropped();
 
-    // handle each spike, calculating the mean spike rate of samples in between.
-    checkForEvents(true);
+        MSR_STATS(
+            for (int kSpike = 0; kSpike < spikeBatch.size(); ++kSpike)
+            {
+                blockMaxFill = jmax(blockMaxFill, spikeBatch[kSpike].samplePosition - lastSpikePosition);
+                lastSpikePosition = spikeBatch[kSpike].samplePosition;
+            }
+        )
 
-    // after all spikes are handled, finish writing samples
-    for (int samp = currSample; samp < numSamples; ++samp)
+        if (unitMode)
+        {
+            processUnitReadouts(numSamples);
+        }
+        else if (decimated || exporting)
+        {
+            processReadouts(decimated ? nullptr : stateOutputs.getRawDataPointer(), numSamples);
+        }
+        else
+        {
+            estimator.processBlock(stateOutputs.getRawDataPointer(), numSamples, spikeBatch);
+        }
+    }
+    else
     {
-        wpBuffer[samp] = currMean;
-        currMean *= decayPerSample;
+        estimator.startBlock(stateOutputs.getRawDataPointer(), numSamples);
+
+        // handle each spike, calculating the mean spike rate of samples in between.
+        checkForEvents(true);
+
+        // after all spikes are handled, finish writing samples
+        estimator.finishBlock();
     }
+    numDroppedSpikes += estimator.getAndResetNumDropped();
+
+    if (crossingEventChannel != nullptr)
+    {
+        addCrossingEvents();
+    }
+
+    MSR_STATS(blockMaxFill = jmax(blockMaxFill, numSamples - lastSpikePosition);)
+    MSR_STATS(blockStats.addBlock(getStatsTimeNs() - blockStartNs, blockSpikes, blockRejected, blockMaxFill);)
 }
 
 void MeanSpikeRate::handleSpike(const SpikeChannel* spikeInfo, const MidiMessage& event, int samplePosition)
 {
-    if (!channelIsActive(spikeInfo, event))
+    int channelIndex = getActiveSpikeChannel(spikeInfo);
+    if (channelIndex == -1)
+    {
+        MSR_STATS(++blockRejected;)
+        return;
+    }
+
+    // drop noise and artifacts before they count towards any rate
+    const Array<WaveformGate>& gates = liveGates.get();
+    if (channelIndex < gates.size() && gates.getReference(channelIndex).isActive()
+        && !passesWaveformGate(spikeInfo, event, gates.getReference(channelIndex)))
+    {
+        MSR_STATS(++blockRejected;)
+        return;
+    }
+
+    int source = spikeChannelSource[channelIndex];
+    if (activeOutputMode == OUTPUT_PER_UNIT)
+    {
+        // spikes are keyed by unit instead; unsorted spikes don't belong to any unit
+        int sortedId = getSortedId(event);
+        source = sortedId > 0 ? static_cast<int>(UnitRateTable::makeKey(channelIndex, sortedId)) : -1;
+    }
+
+    if (source == -1)
     {
         return;
     }
 
-    jassert(samplePosition >= currSample); // spike sample must not have already been finished
+    // convert to the output channel's sample rate
+    int outputPosition, subSample;
+    spikeChannelTiming.getReference(channelIndex).map(samplePosition, &outputPosition, &subSample);
+
+    MSR_STATS(++blockSpikes;)
 
-    // write samples up to the spike position
-    for (int samp = currSample; samp < samplePosition; ++samp)
+    float weight = spikeChannelSelection.getWeight(channelIndex);
+    if (batchingThisBlock)
     {
-        wpBuffer[samp] = currMean;
-        currMean *= decayPerSample;
+        spikeBatch.add(outputPosition, source, subSample, weight);
     }
-    currSample = samplePosition;
+    else
+    {
+        // a spike mapped past the end of the block is counted on the last sample
+        int lastSample = getNumSamples(blockOutputChan) - 1;
+        if (outputPosition > lastSample)
+        {
+            outputPosition = jmax(lastSample, 0);
+            subSample = 0;
+        }
+        estimator.addSpike(source, outputPosition, subSample, weight);
 
-    // add spike contribution
-    currMean += spikeAmp;
+        MSR_STATS(blockMaxFill = jmax(blockMaxFill, outputPosition - lastSpikePosition);)
+        MSR_STATS(lastSpikePosition = jmax(lastSpikePosition, outputPosition);)
+    }
 }
 
 void MeanSpikeRate::setParameter(int parameterIndex, float newValue)
@@ -113,56 +298,807 @@ void MeanSpikeRate::setParameter(int parameterIndex, float newValue)
         outputChan = static_cast<int>(newValue);
         break;
 
-    case TIME_CONST:
-        timeConstMs = newValue;
+    case TIME_CONST: // sets the first time constant
+        timeConstsMs[0] = newValue;
+        break;
+
+    case OUTPUT_MODE:
+        outputMode = static_cast<int>(newValue);
+        break;
+
+    case BATCH_SPIKES:
+        batchSpikes = newValue != 0;
+        break;
+
+    case KERNEL:
+        kernelType = static_cast<int>(newValue);
+        break;
+
+    case ADD_CHANNELS:
+        addOutputChannels = newValue != 0;
+        break;
+
+    case READOUT_INTERVAL:
+        readoutInterval = jmax(0, static_cast<int>(newValue));
+        break;
+
+    case TIME_CONST_SMOOTHING:
+        smoothingMs = jmax(0.0f, newValue);
+        break;
+
+    case THRESHOLD_ON:
+        thresholdOnHz = jmax(0.0f, newValue);
+        break;
+
+    case THRESHOLD_OFF:
+        thresholdOffHz = jmax(0.0f, newValue);
+        break;
+
+    case EXPORT_INTERVAL:
+        exportInterval = jmax(0, static_cast<int>(newValue));
+        break;
+
+    case NORMALIZE_ON_OUTPUT:
+        normalizeOnOutput = newValue != 0;
+        break;
+
+    case MAX_UNITS:
+        maxUnits = jlimit(1, static_cast<int>(MAX_UNITS_LIMIT), static_cast<int>(newValue));
+        break;
+
+    case NUM_THREADS:
+        numThreads = jlimit(1, static_cast<int>(MAX_THREADS), static_cast<int>(newValue));
         break;
 
     default:
         jassertfalse;
+        return;
+    }
+
+    publishLiveParams();
+}
+
+bool MeanSpikeRate::enable()
+{
+    nextReadout = 0;
+    MSR_STATS(blockStats.reset();)
+
+    // (the first readout also sends the unit keys, so that readers know all slots are empty)
+    unitRates.reset();
+    unitBlockStart = 0;
+    sentUnitsVersion = unitRates.getVersion() - 1;
+
+    // the workers busy-wait for blocks, so they only run during acquisition (and not for units, which have no states)
+    if (activeOutputMode != OUTPUT_PER_UNIT)
+    {
+        estimator.startWorkers();
+    }
+
+    // (the export interval can change without a signal chain update)
+    updateReadoutCapacity();
+
+    if (exportInterval > 0 && outputChan >= 0 && outputChan < numInputChans)
+    {
+        // frames have one value per output, like the readout events; readers get the electrode selection separately
+        int numSpikeChans = spikeChannelSelection.size();
+        if (frameWriter.open(getExportName().toStdString(), estimator.getNumSources(), activeNumTimeConsts,
+            numSpikeChans, EXPORT_CAPACITY, getDataChannel(outputChan)->getSampleRate()))
+        {
+            for (int kChan = 0; kChan < numSpikeChans; ++kChan)
+            {
+                frameWriter.setChannelEnabled(kChan, spikeChannelSelection.isEnabled(kChan));
+            }
+            std::cout << "Mean Spike Rate: exporting rates to shared memory " << getExportName() << std::endl;
+        }
+        else
+        {
+            std::cout << "Mean Spike Rate: could not create shared memory " << getExportName() << std::endl;
+        }
+    }
+    return true;
+}
+
+bool MeanSpikeRate::disable()
+{
+    estimator.stopWorkers();
+    frameWriter.close();
+    MSR_STATS(std::cout << "Mean Spike Rate processing statistics:\n" << blockStats.toString() << std::flush;)
+
+    if (numDroppedSpikes > 0)
+    {
+        std::cout << "Mean Spike Rate: " << numDroppedSpikes << " spikes were dropped because more than "
+            << SPIKE_BATCH_CAPACITY << " arrived in a single buffer, or more than "
+            << RateEstimator::DEFAULT_MAX_RATE << " Hz per electrode within a boxcar window" << std::endl;
+        numDroppedSpikes = 0;
+    }
+
+    if (numDroppedReadouts > 0)
+    {
+        std::cout << "Mean Spike Rate: " << numDroppedReadouts << " readouts were dropped because a buffer had more than "
+            << MAX_BLOCK_SIZE << " samples" << std::endl;
+        numDroppedReadouts = 0;
+    }
+
+    if (numDroppedUnitSpikes > 0)
+    {
+        std::cout << "Mean Spike Rate: " << numDroppedUnitSpikes << " spikes were dropped because more than "
+            << unitRates.getCapacity() << " units were active at once" << std::endl;
+        numDroppedUnitSpikes = 0;
+    }
+    return true;
+}
+
+void MeanSpikeRate::createEventChannels()
+{
+    rateEventChannel = nullptr;
+    crossingEventChannel = nullptr;
+    unitEventChannel = nullptr;
+
+    const DataChannel* outChan = outputChan < getNumInputs() ? getDataChannel(outputChan) : nullptr; // before any are added
+
+    // one value (or TTL line) per output, in the same order as the continuous outputs would be
+    // (including electrodes that are deselected, whose rate is 0)
+    int numValues = getNumSourcesForMode() * numTimeConsts;
+    if (outChan == nullptr || numValues == 0)
+    {
+        return;
+    }
+
+    // only the exponential kernel's crossings can be found without checking every sample.
+    // the channel is there whether or not a threshold is set, so that it can be set during acquisition.
+    // (units aren't decayed per block, so theirs aren't found at all.)
+    bool unitMode = outputMode == OUTPUT_PER_UNIT;
+    if (kernelType == KERNEL_EXPONENTIAL && !unitMode)
+    {
+        EventChannel* chan = new EventChannel(EventChannel::TTL, numValues, 1, outChan->getSampleRate(), this);
+        chan->setName("Mean spike rate threshold");
+        chan->setDescription("On while the spike rate of each output is above the threshold");
+        chan->setIdentifier("meanspikerate.threshold");
+        crossingEventChannel = eventChannelArray.add(chan);
+
+        ttlLineStates.clearQuick();
+        ttlLineStates.insertMultiple(0, 0, (numValues + 7) / 8);
+    }
+
+    int interval = getReadoutIntervalForMode();
+    if (interval != 1)
+    {
+        EventChannel* chan = new EventChannel(EventChannel::FLOAT_ARRAY, 1, numValues, outChan->getSampleRate(), this);
+        chan->setName("Mean spike rate");
+        chan->setDescription("Spike rate (Hz) of each " + String(unitMode ? "unit slot" : "output") + ", read out "
+            + (interval == 0 ? String("once per buffer") : "every " + String(interval) + " samples"));
+        chan->setIdentifier("meanspikerate.rate");
+        rateEventChannel = eventChannelArray.add(chan);
+    }
+
+    if (unitMode)
+    {
+        EventChannel* chan = new EventChannel(EventChannel::UINT32_ARRAY, 1, maxUnits, outChan->getSampleRate(), this);
+        chan->setName("Mean spike rate units");
+        chan->setDescription("Unit in each slot of the rate events, as (electrode index << 16) | sorted ID "
+            "(0 = empty), sent with the first readout after it changes");
+        chan->setIdentifier("meanspikerate.units");
+        unitEventChannel = eventChannelArray.add(chan);
+    }
+}
+
+void MeanSpikeRate::updateSettings()
+{
+    numInputChans = dataChannelArray.size();
+
+    // carry over the enabled state, weight and gate of spike channels that still exist, matched by name
+    // (new channels are enabled, with weight 1 and no gate). see ChannelSelection::remap.
+    int numSpikeChans = spikeChannelArray.size();
+    Array<uint64_t> newIds;
+    for (auto chan : spikeChannelArray)
+    {
+        newIds.add(getSpikeChannelId(chan->getName()));
+    }
+
+    std::vector<int> oldIndices;
+    spikeChannelSelection.remap(spikeChannelIds.begin(), newIds.begin(), numSpikeChans, oldIndices);
+
+    Array<WaveformGate> newGates;
+    for (int oldIndex : oldIndices)
+    {
+        newGates.add(oldIndex == -1 ? WaveformGate() : spikeChannelGates[oldIndex]);
+    }
+    spikeChannelIds = newIds;
+    spikeChannelGates = newGates;
+
+    // settings loaded since the last update override the carried-over ones. (an update before the
+    // input spike channels exist, e.g. while a configuration is loading, keeps them for later.)
+    if (numSpikeChans > 0)
+    {
+        applyLoadedSpikeChannels();
+        loadedSpikeChannels.clearQuick();
+    }
+    liveGates.publish(spikeChannelGates);
+
+    // handleSpike receives the entries of spikeChannelArray, so their addresses identify the channels
+    Array<uint64_t> keys;
+    for (auto chan : spikeChannelArray)
+    {
+        keys.add(ChannelLookup::keyFor(chan));
+    }
+    spikeChannelLookup.build(keys.begin(), keys.size());
+
+    spikeChannelTiming.resize(numSpikeChans);
+    updateSpikeTimeMappings(outputChan);
+
+    // assign spike channels to estimator sources
+    activeOutputMode = outputMode;
+    activeNumTimeConsts = numTimeConsts;
+    activeNormalizeOnOutput = normalizeOnOutput;
+    int numSources = getNumSourcesForMode();
+    spikeChannelSource.clearQuick();
+    switch (activeOutputMode)
+    {
+    case OUTPUT_PER_ELECTRODE:
+        for (int kChan = 0; kChan < numSpikeChans; ++kChan)
+        {
+            spikeChannelSource.add(kChan);
+        }
+        break;
+
+    case OUTPUT_PER_GROUP:
+        spikeChannelSource.insertMultiple(0, -1, numSpikeChans);
+        for (int group = numSources - 1; group >= 0; --group) // so that the first group containing a channel wins
+        {
+            for (int kChan : electrodeGroups.getGroup(group))
+            {
+                if (kChan < numSpikeChans)
+                {
+                    spikeChannelSource.set(kChan, group);
+                }
+            }
+        }
         break;
+
+    default:
+        spikeChannelSource.insertMultiple(0, 0, numSpikeChans);
+        break;
+    }
+
+    if (estimator.getKernel() != kernelType)
+    {
+        estimator.setKernel(static_cast<RateKernelType>(kernelType));
+    }
+    if (estimator.getNumThreads() != numThreads)
+    {
+        // (each thread's share of the states has its own crossings)
+        estimator.setNumThreads(numThreads);
+        sortedCrossings.reserve(numThreads * RateEngine<ExponentialKernel>::MAX_CROSSINGS);
     }
+    estimator.setNumStates(numSources, activeNumTimeConsts);
+
+    // each source's boxcar windows hold the spikes of all of its electrodes (units don't use the states)
+    Array<int> sourceElectrodes;
+    sourceElectrodes.insertMultiple(0, 0, numSources);
+    int maxSourceElectrodes = 1;
+    for (int source : spikeChannelSource)
+    {
+        if (source >= 0 && source < numSources && activeOutputMode != OUTPUT_PER_UNIT)
+        {
+            sourceElectrodes.set(source, sourceElectrodes[source] + 1);
+            maxSourceElectrodes = jmax(maxSourceElectrodes, sourceElectrodes[source]);
+        }
+    }
+    estimator.setMaxRate(RateEstimator::DEFAULT_MAX_RATE * maxSourceElectrodes);
+
+    spikeChannelSelection.setGroups(spikeChannelSource.getRawDataPointer(), numSources);
+    sourceOutputOffset.clearQuick();
+    sourceOutputOffset.insertMultiple(0, -1, numSources);
+    stateOutputs.clearQuick();
+    stateOutputs.insertMultiple(0, nullptr, estimator.getNumStates());
+
+    // readouts replace the continuous output, so no channels are added for them
+    activeReadoutInterval = getReadoutIntervalForMode();
+    firstAddedChan = -1;
+    if (addOutputChannels && activeReadoutInterval == 1)
+    {
+        createOutputChannels();
+    }
+
+    updateSourceOutputs();
+    appliedSelectionVersion = spikeChannelSelection.getVersion();
+
+    // (the estimator's states are left unused in unit mode, but give the readouts their layout)
+    bool unitMode = activeOutputMode == OUTPUT_PER_UNIT;
+    unitRates.setCapacity(unitMode ? numSources : 0, activeNumTimeConsts);
+    unitEventKeys.resize(unitMode ? numSources : 0);
+
+    nextReadout = 0;
+    readoutEventValues.resize(estimator.getNumStates());
+    updateReadoutCapacity();
 }
 
-void MeanSpikeRate::saveCustomChannelParametersToXml(XmlElement* channelElement, int channelNumber, InfoObjectCommon::InfoObjectType channelType)
+int MeanSpikeRate::getNumSourcesForMode() const
 {
-    if (channelType == InfoObjectCommon::SPIKE_CHANNEL)
+    switch (outputMode)
+    {
+    case OUTPUT_PER_ELECTRODE:
+        return spikeChannelArray.size();
+
+    case OUTPUT_PER_GROUP:
+        return electrodeGroups.getNumGroups();
+
+    case OUTPUT_PER_UNIT:
+        return maxUnits;
+
+    default:
+        return 1;
+    }
+}
+
+int MeanSpikeRate::getReadoutIntervalForMode() const
+{
+    return outputMode == OUTPUT_PER_UNIT && readoutInterval == 1 ? 0 : readoutInterval;
+}
+
+void MeanSpikeRate::updateReadoutCapacity()
+{
+    // as in processReadouts (units are read out without the estimator)
+    bool sendEvents = activeReadoutInterval != 1 && rateEventChannel != nullptr;
+    int interval = sendEvents ? activeReadoutInterval : exportInterval;
+    int maxReadouts = activeOutputMode == OUTPUT_PER_UNIT ? 0
+        : interval > 0 ? (MAX_BLOCK_SIZE - 1) / interval + 1 : 1;
+
+    readouts.resize(maxReadouts * estimator.getNumStates());
+    estimator.setReadoutCapacity(maxReadouts);
+}
+
+void MeanSpikeRate::createOutputChannels()
+{
+    if (outputChan < 0 || outputChan >= numInputChans)
+    {
+        return;
+    }
+
+    // the added channels have the sample rate and subprocessor of the selected channel
+    const DataChannel* refChan = getDataChannel(outputChan);
+    int numSources = estimator.getNumSources();
+    firstAddedChan = dataChannelArray.size();
+    for (int source = 0; source < numSources; ++source)
+    {
+        String sourceName = activeOutputMode == OUTPUT_PER_ELECTRODE ? spikeChannelArray[source]->getName()
+            : activeOutputMode == OUTPUT_PER_GROUP ? "group " + String(source + 1)
+            : String("mean");
+
+        for (int kTau = 0; kTau < activeNumTimeConsts; ++kTau)
+        {
+            String tauName = String(timeConstsMs[kTau]) + " ms";
+
+            DataChannel* chan = new DataChannel(DataChannel::AUX_CHANNEL, refChan->getSampleRate(), this,
+                refChan->getSubProcessorIdx());
+            chan->setName("MSR " + sourceName + (activeNumTimeConsts > 1 ? " " + tauName : String()));
+            chan->setDescription("Spike rate of " + getSourceDescription(source) + ", time constant " + tauName
+                + " (" + getKernelName(estimator.getKernel()) + " kernel)");
+            chan->setIdentifier("meanspikerate.rate");
+            chan->setDataUnits("Hz");
+            chan->setBitVolts(1.0f);
+            dataChannelArray.add(chan);
+        }
+    }
+}
+
+String MeanSpikeRate::getSourceDescription(int source) const
+{
+    StringArray names;
+    int numSpikeChans = spikeChannelSource.size();
+    for (int kChan = 0; kChan < numSpikeChans; ++kChan)
+    {
+        if (spikeChannelSource[kChan] == source)
+        {
+            names.add(spikeChannelArray[kChan]->getName());
+        }
+    }
+
+    String description = names.joinIntoString(", ");
+    return names.size() > 1 ? "the mean of " + description : description;
+}
+
+void MeanSpikeRate::processReadouts(float* const* outputs, int numSamples)
+{
+    // exported frames go with the readout events if there are any, else have their own interval
+    bool sendEvents = activeReadoutInterval != 1 && rateEventChannel != nullptr;
+    int readoutInterval = sendEvents ? activeReadoutInterval : exportInterval;
+    int interval = readoutInterval > 0 ? readoutInterval : numSamples;
+    int firstReadout = readoutInterval > 0 ? nextReadout : numSamples - 1;
+
+    // (the estimator only writes as many readouts as updateReadoutCapacity sized them for, so
+    // a buffer longer than MAX_BLOCK_SIZE loses its last ones rather than allocating here)
+    int numStates = estimator.getNumStates();
+    int maxReadouts = firstReadout < numSamples ? (numSamples - 1 - firstReadout) / interval + 1 : 0;
+    int numReadouts = estimator.processBlockReadout(outputs, numSamples, spikeBatch, firstReadout, interval,
+        readouts.getRawDataPointer());
+    numDroppedReadouts += maxReadouts - numReadouts;
+
+    // reorder from states (time constant-major) to outputs (source-major)
+    int numSources = estimator.getNumSources();
+    for (int kRead = 0; kRead < numReadouts; ++kRead)
+    {
+        const float* values = readouts.getRawDataPointer() + kRead * numStates;
+        for (int source = 0; source < numSources; ++source)
+        {
+            for (int kTau = 0; kTau < activeNumTimeConsts; ++kTau)
+            {
+                readoutEventValues.set(source * activeNumTimeConsts + kTau, values[kTau * numSources + source]);
+            }
+        }
+
+        sendReadout(firstReadout + kRead * interval, sendEvents);
+    }
+
+    if (readoutInterval > 0)
+    {
+        nextReadout = firstReadout + maxReadouts * interval - numSamples;
+    }
+}
+
+void MeanSpikeRate::processUnitReadouts(int numSamples)
+{
+    // as in processReadouts, with the estimator's processing replaced by the unit table's
+    bool sendEvents = rateEventChannel != nullptr;
+    int readoutInterval = sendEvents ? activeReadoutInterval : exportInterval;
+    int interval = readoutInterval > 0 ? readoutInterval : numSamples;
+    int firstReadout = readoutInterval > 0 ? nextReadout : numSamples - 1;
+
+    // each readout includes the spikes at its sample, as the continuous output does. units are
+    // only decayed as they spike and are read out, so the cost doesn't depend on the block length.
+    int numSpikes = spikeBatch.size();
+    int kSpike = 0;
+    auto addSpikesUpTo = [&](int lastSample)
+    {
+        for (; kSpike < numSpikes && spikeBatch[kSpike].samplePosition <= lastSample; ++kSpike)
+        {
+            const SpikeBatch::Spike& spike = spikeBatch[kSpike];
+            unitRates.addSpike(static_cast<uint32>(spike.source), unitBlockStart + spike.samplePosition, spike.subSample);
+        }
+    };
+
+    int numReadouts = 0;
+    int64 blockTimestamp = getTimestamp(blockOutputChan);
+    for (int sample = firstReadout; sample < numSamples; sample += interval, ++numReadouts)
+    {
+        addSpikesUpTo(sample);
+        unitRates.readout(unitBlockStart + sample, readoutEventValues.getRawDataPointer());
+
+        // units in each slot, if they have changed since they were last sent (this readout may have removed some)
+        if (sendEvents && unitRates.getVersion() != sentUnitsVersion)
+        {
+            int numSlots = unitEventKeys.size();
+            for (int slot = 0; slot < numSlots; ++slot)
+            {
+                unitEventKeys.set(slot, unitRates.getSlotKey(slot));
+            }
+
+            BinaryEventPtr event = BinaryEvent::createBinaryEvent(unitEventChannel, blockTimestamp + sample,
+                unitEventKeys.getRawDataPointer(), numSlots * static_cast<int>(sizeof(uint32)));
+            addEvent(unitEventChannel, event, sample);
+            sentUnitsVersion = unitRates.getVersion();
+        }
+
+        sendReadout(sample, sendEvents);
+    }
+    addSpikesUpTo(numSamples);
+
+    numDroppedUnitSpikes += unitRates.getAndResetNumDropped();
+    unitBlockStart += numSamples;
+    if (readoutInterval > 0)
+    {
+        nextReadout = firstReadout + numReadouts * interval - numSamples;
+    }
+}
+
+void MeanSpikeRate::sendReadout(int sample, bool sendEvent)
+{
+    int64 timestamp = getTimestamp(blockOutputChan) + sample;
+    if (sendEvent)
+    {
+        BinaryEventPtr event = BinaryEvent::createBinaryEvent(rateEventChannel, timestamp,
+            readoutEventValues.getRawDataPointer(), readoutEventValues.size() * static_cast<int>(sizeof(float)));
+        addEvent(rateEventChannel, event, sample);
+    }
+
+    if (frameWriter.isOpen())
+    {
+        frameWriter.write(timestamp, readoutEventValues.getRawDataPointer());
+    }
+}
+
+int MeanSpikeRate::getSortedId(const MidiMessage& event)
+{
+    if (event.getRawDataSize() < SPIKE_SORTED_ID_OFFSET + static_cast<int>(sizeof(uint16)))
+    {
+        return 0;
+    }
+
+    uint16 sortedId;
+    std::memcpy(&sortedId, event.getRawData() + SPIKE_SORTED_ID_OFFSET, sizeof(sortedId));
+    return sortedId;
+}
+
+bool MeanSpikeRate::passesWaveformGate(const SpikeChannel* spikeInfo, const MidiMessage& event, const WaveformGate& gate)
+{
+    int numChannels = static_cast<int>(spikeInfo->getNumChannels());
+    int numSamples = static_cast<int>(spikeInfo->getTotalSamples());
+    int waveformOffset = SPIKE_HEADER_SIZE + numChannels * static_cast<int>(sizeof(float));
+    if (event.getRawDataSize() < waveformOffset + numChannels * numSamples * static_cast<int>(sizeof(float)))
+    {
+        jassertfalse;
+        return true; // (can't be checked)
+    }
+
+    return gate.passes(WaveformFeatures::compute(event.getRawData() + waveformOffset, numChannels, numSamples));
+}
+
+void MeanSpikeRate::addCrossingEvents()
+{
+    const std::vector<ThresholdCrossing>& crossings = estimator.getCrossings();
+    if (crossings.empty())
     {
-        auto msrEditor = static_cast<MeanSpikeRateEditor*>(getEditor());
-        channelElement->setAttribute("enabled", msrEditor->getSpikeChannelEnabled(channelNumber));
+        return;
+    }
+
+    // crossings are found per state, but each event carries the state of all lines at its time.
+    // (a line can go off and on again at sample 0 when the threshold has changed)
+    sortedCrossings.assign(crossings.begin(), crossings.end());
+    std::sort(sortedCrossings.begin(), sortedCrossings.end(), [](const ThresholdCrossing& a, const ThresholdCrossing& b)
+    {
+        return a.samplePosition < b.samplePosition || (a.samplePosition == b.samplePosition && !a.rising && b.rising);
+    });
+
+    int numSources = estimator.getNumSources();
+    int64 blockTimestamp = getTimestamp(blockOutputChan);
+    for (const ThresholdCrossing& crossing : sortedCrossings)
+    {
+        // lines are in output order (source-major), states are time constant-major
+        int source = crossing.state % numSources;
+        int kTau = crossing.state / numSources;
+        int line = source * activeNumTimeConsts + kTau;
+
+        uint8 mask = static_cast<uint8>(1 << (line % 8));
+        uint8& lineByte = ttlLineStates.getReference(line / 8);
+        lineByte = crossing.rising ? (lineByte | mask) : (lineByte & ~mask);
+
+        TTLEventPtr event = TTLEvent::createTTLEvent(crossingEventChannel, blockTimestamp + crossing.samplePosition,
+            ttlLineStates.getRawDataPointer(), ttlLineStates.size(), static_cast<uint16>(line));
+        addEvent(crossingEventChannel, event, crossing.samplePosition);
     }
 }
 
-void MeanSpikeRate::loadCustomParametersFromXml()
+String MeanSpikeRate::getExportName() const
 {
-    // semi-hack: update signal chain to make sure input spike channels have been created.
-    CoreServices::updateSignalChain(nullptr);
+    return "/msr-" + String(getNodeId());
+}
+
+void MeanSpikeRate::updateSpikeTimeMappings(int chan)
+{
+    mappedOutputChan = chan;
+    if (chan < 0 || chan >= numInputChans)
+    {
+        return;
+    }
+
+    double outputRate = getDataChannel(chan)->getSampleRate();
+    int numSpikeChans = spikeChannelTiming.size();
+    for (int kChan = 0; kChan < numSpikeChans; ++kChan)
+    {
+        spikeChannelTiming.getReference(kChan).setSampleRates(
+            spikeChannelArray[kChan]->getSampleRate(), outputRate);
+    }
+}
+
+void MeanSpikeRate::publishLiveParams()
+{
+    LiveParams params;
+    params.outputChan = outputChan;
+    for (int kTau = 0; kTau < MAX_TIME_CONSTS; ++kTau)
+    {
+        params.timeConstsMs[kTau] = timeConstsMs[kTau];
+    }
+    params.smoothingMs = smoothingMs;
+    params.batchSpikes = batchSpikes;
+    params.thresholdOnHz = thresholdOnHz;
+    params.thresholdOffHz = thresholdOffHz;
+    liveParams.publish(params);
+}
+
+bool MeanSpikeRate::getSpikeChannelEnabled(int index) const
+{
+    return spikeChannelSelection.isEnabled(index);
+}
+
+void MeanSpikeRate::setSpikeChannelEnabled(int index, bool enabled)
+{
+    jassert(index >= 0 && index < spikeChannelSelection.size());
+    spikeChannelSelection.setEnabled(index, enabled);
+
+    // (the writer's channel states are atomic, so this doesn't interfere with the audio thread writing frames)
+    frameWriter.setChannelEnabled(index, enabled);
+}
+
+int MeanSpikeRate::getNumActiveElectrodes() const
+{
+    return spikeChannelSelection.getNumEnabled();
+}
+
+float MeanSpikeRate::getSpikeChannelWeight(int index) const
+{
+    return spikeChannelSelection.getWeight(index);
+}
+
+void MeanSpikeRate::setSpikeChannelWeight(int index, float weight)
+{
+    jassert(index >= 0 && index < spikeChannelSelection.size());
+    spikeChannelSelection.setWeight(index, jmax(0.0f, weight));
+}
+
+WaveformGate MeanSpikeRate::getSpikeChannelGate(int index) const
+{
+    return spikeChannelGates[index];
+}
+
+void MeanSpikeRate::setSpikeChannelGate(int index, const WaveformGate& gate)
+{
+    jassert(index >= 0 && index < spikeChannelGates.size());
+    if (gate != spikeChannelGates[index])
+    {
+        spikeChannelGates.set(index, gate);
+        liveGates.publish(spikeChannelGates);
+    }
+}
+
+bool MeanSpikeRate::setElectrodeGroups(const String& spec)
+{
+    return electrodeGroups.parse(spec.toStdString());
+}
+
+String MeanSpikeRate::getElectrodeGroups() const
+{
+    return String(electrodeGroups.toString());
+}
+
+void MeanSpikeRate::setTimeConstants(const Array<double>& newTimeConstsMs)
+{
+    int newNumTimeConsts = jmin(newTimeConstsMs.size(), static_cast<int>(MAX_TIME_CONSTS));
+    jassert(newNumTimeConsts > 0);
+
+    for (int kTau = 0; kTau < newNumTimeConsts; ++kTau)
+    {
+        timeConstsMs[kTau] = newTimeConstsMs[kTau];
+    }
+    numTimeConsts = newNumTimeConsts;
+    publishLiveParams();
+}
+
+Array<double> MeanSpikeRate::getTimeConstants() const
+{
+    return Array<double>(timeConstsMs, numTimeConsts);
+}
+
+void MeanSpikeRate::saveCustomChannelParametersToXml(XmlElement* channelElement, int channelNumber, InfoObjectCommon::InfoObjectType channelType)
+{
+    if (channelType == InfoObjectCommon::SPIKE_CHANNEL)
+    {
+        // the name identifies the channel when loading (see getSpikeChannelId)
+        channelElement->setAttribute("name", spikeChannelArray[channelNumber]->getName());
+        channelElement->setAttribute("enabled", getSpikeChannelEnabled(channelNumber));
+        channelElement->setAttribute("weight", getSpikeChannelWeight(channelNumber));
+
+        WaveformGate gate = getSpikeChannelGate(channelNumber);
+        channelElement->setAttribute("minPeak", gate.minPeak);
+        channelElement->setAttribute("maxPeak", gate.maxPeak);
+        channelElement->setAttribute("minPeakToTrough", gate.minPeakToTrough);
+        channelElement->setAttribute("minWidth", gate.minWidth);
+        channelElement->setAttribute("maxWidth", gate.maxWidth);
+    }
 }
 
 void MeanSpikeRate::loadCustomChannelParametersFromXml(XmlElement* channelElement, InfoObjectCommon::InfoObjectType channelType)
 {
     if (channelType == InfoObjectCommon::SPIKE_CHANNEL)
     {
-        int channelNumber = channelElement->getIntAttribute("number", -1);
-        bool shouldEnable = channelElement->getBoolAttribute("enabled");
-        auto msrEditor = static_cast<MeanSpikeRateEditor*>(getEditor());
-        msrEditor->setSpikeChannelEnabled(channelNumber, shouldEnable);
+        // (the spike channels may not have been created yet, so they are matched up later)
+        LoadedSpikeChannel loaded;
+        String name = channelElement->getStringAttribute("name");
+        loaded.id = name.isEmpty() ? 0 : getSpikeChannelId(name);
+        loaded.number = channelElement->getIntAttribute("number", -1);
+        loaded.enabled = channelElement->getBoolAttribute("enabled");
+        loaded.weight = static_cast<float>(channelElement->getDoubleAttribute("weight", 1.0));
+        loaded.gate.minPeak = static_cast<float>(channelElement->getDoubleAttribute("minPeak", 0.0));
+        loaded.gate.maxPeak = static_cast<float>(channelElement->getDoubleAttribute("maxPeak", 0.0));
+        loaded.gate.minPeakToTrough = static_cast<float>(channelElement->getDoubleAttribute("minPeakToTrough", 0.0));
+        loaded.gate.minWidth = channelElement->getIntAttribute("minWidth", 0);
+        loaded.gate.maxWidth = channelElement->getIntAttribute("maxWidth", 0);
+        loadedSpikeChannels.add(loaded);
+    }
+}
+
+void MeanSpikeRate::applyLoadedChannelSettings()
+{
+    if (!applyLoadedSpikeChannels())
+    {
+        return;
+    }
+
+    liveGates.publish(spikeChannelGates);
+
+    auto msrEditor = static_cast<MeanSpikeRateEditor*>(getEditor());
+    if (msrEditor != nullptr)
+    {
+        msrEditor->updateChannelButtonStates();
     }
 }
 
 // private
 
-int MeanSpikeRate::getNumActiveElectrodes()
+uint64_t MeanSpikeRate::getSpikeChannelId(const String& name)
 {
-    auto editor = static_cast<MeanSpikeRateEditor*>(getEditor());
-    return editor->getNumActiveElectrodes();
+    return ChannelLookup::keyForName(name.toRawUTF8(), name.getNumBytesAsUTF8());
 }
 
-bool MeanSpikeRate::channelIsActive(const SpikeChannel* info, const MidiMessage& event)
+bool MeanSpikeRate::applyLoadedSpikeChannels()
 {
-    SpikeEventPtr deserializedEvent = SpikeEvent::deserializeFromMessage(event, info);
-    int channelIndex = getSpikeChannelIndex(deserializedEvent);
-    
-    jassert(getEditor());
-    auto msrEditor = static_cast<MeanSpikeRateEditor*>(getEditor());
-    return  msrEditor->getSpikeChannelEnabled(channelIndex);
-}
\ No newline at end of file
+    int numLoaded = loadedSpikeChannels.size();
+    int numSpikeChans = spikeChannelIds.size();
+    if (numLoaded == 0 || numSpikeChans == 0)
+    {
+        return false;
+    }
+
+    ChannelLookup idLookup;
+    idLookup.build(spikeChannelIds.begin(), numSpikeChans);
+
+    Array<LoadedSpikeChannel> unmatched;
+    for (const LoadedSpikeChannel& loaded : loadedSpikeChannels)
+    {
+        int index = loaded.id != 0 ? idLookup.find(loaded.id) : loaded.number;
+        if (index < 0 || index >= numSpikeChans)
+        {
+            unmatched.add(loaded);
+            continue;
+        }
+
+        setSpikeChannelEnabled(index, loaded.enabled);
+        setSpikeChannelWeight(index, loaded.weight);
+        spikeChannelGates.set(index, loaded.gate);
+    }
+
+    bool appliedAny = unmatched.size() < numLoaded;
+    loadedSpikeChannels.swapWith(unmatched);
+    return appliedAny;
+}
+
+int MeanSpikeRate::getActiveSpikeChannel(const SpikeChannel* info) const
+{
+    // no need to deserialize the event (and copy its waveform) just to find its channel
+    int channelIndex = spikeChannelLookup.find(ChannelLookup::keyFor(info));
+    return spikeChannelSelection.isEnabled(channelIndex) ? channelIndex : -1;
+}
+
+void MeanSpikeRate::updateSourceOutputs()
+{
+    int numSources = estimator.getNumSources();
+
+    // each source's output is the weighted mean rate over its selected electrodes (spikes are multiplied
+    // by their electrode's weight as they are added). either each spike is also divided by the total
+    // weight selected when it arrives, so that a change to the selection changes the output gradually,
+    // or the state is the weighted sum over electrodes, which is divided by the total weight currently
+    // selected from the start of the next buffer on.
+    // per-electrode outputs are packed onto consecutive channels, skipping deselected electrodes.
+    int nextOffset = 0;
+    for (int source = 0; source < numSources; ++source)
+    {
+        int numElectrodes = spikeChannelSelection.getNumEnabled(source);
+        double totalWeight = spikeChannelSelection.getTotalWeight(source);
+        double scale = totalWeight > 0 ? 1.0 / totalWeight : 0.0;
+        estimator.setSourceGain(source, activeNormalizeOnOutput ? 1.0 : scale);
+        estimator.setSourceOutputScale(source, activeNormalizeOnOutput ? scale : 1.0);
+
+        // (added channels are fixed, so they keep an output for every electrode)
+        bool hasOutput = firstAddedChan != -1 || activeOutputMode != OUTPUT_PER_ELECTRODE || numElectrodes > 0;
+        sourceOutputOffset.set(source, hasOutput ? nextOffset++ : -1);
+    }
+}
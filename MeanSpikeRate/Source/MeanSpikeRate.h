@@ -25,11 +25,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define MEAN_SPIKE_RATE_H_INCLUDED
 
 #include <ProcessorHeaders.h>
+#include "RateCore/ParallelRateEstimator.h"
+#include "RateCore/ChannelSelection.h"
+#include "RateCore/ChannelLookup.h"
+#include "RateCore/UnitRateTable.h"
+#include "RateCore/WaveformFeatures.h"
+#include "RateCore/ElectrodeGroups.h"
+#include "RateCore/TimeConstRamp.h"
+#include "RateCore/TripleBuffer.h"
+#include "RateCore/RateFrameWriter.h"
+#include "RateCore/BlockStats.h"
 
 /* Estimates the mean spike rate over time and channels. Uses an exponentially
  * weighted moving average to estimate a temporal mean (with adjustable time
  * constant), and averages the rate across selected spike channels (electrodes).
- * Outputs the resulting rate onto a selected continuous channel (overwriting its contents).
+ * Outputs the resulting rate onto new continuous channels added after the input
+ * channels, or onto a selected continuous channel (overwriting its contents).
+ * Alternatively, the rate of each electrode or user-defined group of electrodes can be
+ * output on consecutive continuous channels, starting at the selected one. Each rate can
+ * also be estimated with several time constants at once, each on its own channel.
+ * Other smoothing kernels (exponential cascades or a sliding window) can be chosen
+ * instead of the exponential. With the exponential kernel, each output can also drive
+ * a TTL line that is on while its rate is above a threshold. The rates can also be
+ * exported to other processes through a shared memory ring buffer (see RateFrameRing.h).
+ * Downstream of a spike sorter, the rate of each sorted unit can be tracked instead (see
+ * UnitRateTable), and read out as events. Spikes can be gated on waveform features per
+ * electrode, to keep noise and artifacts out of the rates.
  *
  * @see GenericProcessor
  */
@@ -38,7 +59,28 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 enum Param
 {
     OUTPUT_CHAN,
-    TIME_CONST
+    TIME_CONST,
+    OUTPUT_MODE,
+    BATCH_SPIKES,
+    TIME_CONST_SMOOTHING,
+    KERNEL,             // a RateKernelType (changing the kernel requires a signal chain update)
+    READOUT_INTERVAL,   // see readoutInterval (changing it requires a signal chain update)
+    ADD_CHANNELS,       // see addOutputChannels (changing it requires a signal chain update)
+    THRESHOLD_ON,       // rate (Hz) at or above which an output's TTL line turns on (0 = no TTL output)
+    THRESHOLD_OFF,      // rate (Hz) below which it turns off again (clamped to at most THRESHOLD_ON)
+    EXPORT_INTERVAL,    // see exportInterval (takes effect when acquisition starts)
+    NORMALIZE_ON_OUTPUT, // see normalizeOnOutput (changing it requires a signal chain update)
+    MAX_UNITS,           // see maxUnits (changing it requires a signal chain update)
+    NUM_THREADS          // see numThreads (changing it requires a signal chain update)
+};
+
+// what to output (changing the mode requires a signal chain update)
+enum OutputMode
+{
+    OUTPUT_MEAN,            // mean over all selected electrodes
+    OUTPUT_PER_ELECTRODE,   // one channel per selected electrode
+    OUTPUT_PER_GROUP,       // one channel per electrode group (mean over its selected electrodes)
+    OUTPUT_PER_UNIT         // one output per sorted unit of the selected electrodes, only read out (exponential kernel)
 };
 
 class MeanSpikeRate : public GenericProcessor
@@ -57,26 +99,240 @@ public:
 
     void setParameter(int parameterIndex, float newValue) override;
 
-    // save and load spike channel selection state
+    bool enable() override;
+    bool disable() override;
+
+    void createEventChannels() override;
+
+    void updateSettings() override;
+
+    // spike channel selection - safe to call from the message thread during acquisition
+    bool getSpikeChannelEnabled(int index) const;
+    void setSpikeChannelEnabled(int index, bool enabled);
+    int getNumActiveElectrodes() const;
+
+    // weight of each spike channel in the mean over electrodes (>= 0, default 1), also safe to
+    // change during acquisition. Means are weighted averages: sum(weight * rate) / sum(weight).
+    float getSpikeChannelWeight(int index) const;
+    void setSpikeChannelWeight(int index, float weight);
+
+    // limits on the waveform features of each spike channel's spikes (see WaveformGate), also safe to
+    // change during acquisition. spikes outside them are ignored.
+    WaveformGate getSpikeChannelGate(int index) const;
+    void setSpikeChannelGate(int index, const WaveformGate& gate);
+
+    // returns false if the spec is invalid (see ElectrodeGroups). Takes effect on the next signal chain update.
+    bool setElectrodeGroups(const String& spec);
+    String getElectrodeGroups() const;
+
+    // changing the time constants' values takes effect at the start of the next buffer (ramped
+    // over the smoothing time, if any), but changing how many there are only takes effect on
+    // the next signal chain update.
+    static const int MAX_TIME_CONSTS = 8;
+    void setTimeConstants(const Array<double>& newTimeConstsMs);
+    Array<double> getTimeConstants() const;
+
+    // limit on the number of units tracked at once in unit mode
+    static const int MAX_UNITS_LIMIT = 4096;
+
+    // limit on the number of threads the rates are computed on
+    static const int MAX_THREADS = 16;
+
+    // save and load spike channel selection state, weights and gates. loaded settings are kept by channel
+    // name and applied to the channels that exist in the next updateSettings (or applyLoadedChannelSettings),
+    // so that loading doesn't have to wait for or force a signal chain update.
     void saveCustomChannelParametersToXml(XmlElement* channelElement, int channelNumber, InfoObjectCommon::InfoObjectType channelType) override;
-    void loadCustomParametersFromXml() override;
     void loadCustomChannelParametersFromXml(XmlElement* channelElement, InfoObjectCommon::InfoObjectType channelType);
 
+    // applies the loaded settings of the spike channels that exist now (called by the editor once the whole
+    // configuration is loaded); the others are kept until the next updateSettings
+    void applyLoadedChannelSettings();
+
 private:
     // functions
-    int getNumActiveElectrodes();
-    bool channelIsActive(const SpikeChannel* info, const MidiMessage& event);
+    // key that identifies a spike channel across signal chain updates and saved configurations (a hash of its name)
+    static uint64_t getSpikeChannelId(const String& name);
+
+    // applies entries of loadedSpikeChannels to the current spike channels and removes them, without
+    // publishing the gates. returns whether any were applied.
+    bool applyLoadedSpikeChannels();
+
+    // index of the spike channel in spikeChannelArray if it is enabled, else -1
+    int getActiveSpikeChannel(const SpikeChannel* info) const;
+
+    // update source gains and output channel assignment for the current spike channel selection
+    // (from the selection's per-source counts, without a scan over the spike channels)
+    void updateSourceOutputs();
+
+    // map each spike channel's sample positions to those of the given output channel
+    void updateSpikeTimeMappings(int chan);
+
+    // hand the current parameters to the audio thread (message thread only)
+    void publishLiveParams();
+
+    // number of estimator sources for the current output mode and spike channels
+    int getNumSourcesForMode() const;
+
+    // readout interval for the current output mode (units are always read out, at least once per buffer)
+    int getReadoutIntervalForMode() const;
+
+    // sizes the readouts (and the estimator's) for the readout and export intervals in buffers of up to
+    // MAX_BLOCK_SIZE samples (processReadouts never allocates; readouts beyond them are dropped)
+    void updateReadoutCapacity();
 
-    // parameters
-    int outputChan;
-    double timeConstMs;
+    // add a continuous channel for each output, after the input channels
+    void createOutputChannels();
+
+    // names of the electrodes feeding into each source, for channel descriptions
+    String getSourceDescription(int source) const;
+
+    // decimated or exported output: read out the rate of this block's spikes (in spikeBatch) at intervals
+    // and send it as events and/or write it to shared memory. outputs (per state) may be null.
+    void processReadouts(float* const* outputs, int numSamples);
+
+    // unit mode: add this block's spikes (in spikeBatch, keyed by unit) to the unit table, reading out
+    // the rate of each unit at intervals in between
+    void processUnitReadouts(int numSamples);
+
+    // send readoutEventValues as an event and/or write them to shared memory, for the given sample of this block
+    void sendReadout(int sample, bool sendEvent);
+
+    // sorted ID of a spike event (0 = unsorted), read from its header without deserializing the event
+    static int getSortedId(const MidiMessage& event);
+
+    // whether a spike event's waveform features are within the gate's limits, computed from the
+    // waveform in the event without deserializing it
+    static bool passesWaveformGate(const SpikeChannel* spikeInfo, const MidiMessage& event, const WaveformGate& gate);
+
+    // layout of serialized spike events (see SpikeEvent::serialize): a header with the type, channel
+    // indices, timestamp and sorted ID, then a threshold per channel, then the waveform of each channel
+    static const int SPIKE_SORTED_ID_OFFSET = 16;
+    static const int SPIKE_HEADER_SIZE = 18;
+
+    // name of the shared memory region that rates are exported to
+    String getExportName() const;
+
+    // send a TTL event for each threshold crossing found by the estimator in this block
+    void addCrossingEvents();
+
+    // parameters (message thread)
+    int outputChan;         // channel to overwrite, or whose sample rate to use for added channels
+    bool addOutputChannels; // whether to output on new channels instead of overwriting existing ones
+    double timeConstsMs[MAX_TIME_CONSTS];
+    double smoothingMs;     // time over which to ramp to new time constants
+    int numTimeConsts;
+    int outputMode;
+    int kernelType;
+    int readoutInterval;    // 1 = write the rate to the continuous channels; > 1 = send it as an event
+                            // every readoutInterval samples instead; 0 = send it once per buffer
+    ElectrodeGroups electrodeGroups;
+    bool batchSpikes;       // collect and sort each block's spikes before processing them
+    double thresholdOnHz;   // 0 = no threshold detection
+    double thresholdOffHz;
+    int exportInterval;     // 0 = no export; otherwise write a frame to shared memory every exportInterval samples
+                            // (or with each readout event, if the rate is sent as events)
+    bool normalizeOnOutput; // false = weight each spike by 1 / (number of selected electrodes of its source) when it
+                            // is added; true = sum the rates of the selected electrodes and divide the sum on output
+    int maxUnits;           // number of units that can be tracked at once in unit mode (the number of outputs)
+    int numThreads;         // threads the electrodes' states are split over during acquisition (the audio thread and
+                            // numThreads - 1 pinned workers; see ParallelRateEstimator). 1 = only the audio thread
+
+    // the parameters that can change during acquisition, as seen by the audio thread.
+    // setParameter and setTimeConstants publish a complete copy, which process picks up
+    // at the start of a buffer, so a buffer is never processed with a mix of old and new values.
+    struct LiveParams
+    {
+        int outputChan;
+        double timeConstsMs[MAX_TIME_CONSTS];
+        double smoothingMs;
+        bool batchSpikes;
+        double thresholdOnHz;
+        double thresholdOffHz;
+    };
+    TripleBuffer<LiveParams> liveParams;
 
     // internals
-    int currSample;          // per-buffer - allows processing samples while handling events
-    double spikeAmp;         // updated once per buffer
-    double decayPerSample;   // updated once per buffer
-    float currMean;
-    float* wpBuffer;
+    ParallelRateEstimator estimator;
+    TimeConstRamp timeConstRamps[MAX_TIME_CONSTS];
+    int blockOutputChan;    // output channel of the current buffer
+
+    // set up in updateSettings
+    int numInputChans;      // excluding added output channels
+    int firstAddedChan;     // first added output channel, or -1 if none
+    int activeOutputMode;
+    int activeNumTimeConsts;
+    bool activeNormalizeOnOutput;
+    Array<int> spikeChannelSource;  // estimator source that each spike channel contributes to (or -1)
+    Array<int> sourceOutputOffset;  // first output channel of each source, relative to outputChan (or -1)
+    Array<float*> stateOutputs;     // per buffer
+    unsigned appliedSelectionVersion;
+    Array<SpikeTimeMapping> spikeChannelTiming; // per spike channel, for the output channel's sample rate
+    int mappedOutputChan;
+
+    // decimated output
+    int activeReadoutInterval;
+    int nextReadout;                 // sample of the next readout, relative to the start of the current buffer
+    static const int MAX_BLOCK_SIZE = 8192; // samples per buffer that the readouts are sized for
+    Array<float> readouts;           // per readout and state
+    int64 numDroppedReadouts;        // since acquisition started
+    Array<float> readoutEventValues; // per output (source and time constant)
+    const EventChannel* rateEventChannel;
+
+    // unit mode (rates are always read out, at least once per buffer)
+    UnitRateTable unitRates;
+    int64 unitBlockStart;           // samples since acquisition started, at the start of the current buffer
+    const EventChannel* unitEventChannel;
+    Array<uint32> unitEventKeys;    // key of the unit in each slot (see UnitRateTable), sent when they change
+    unsigned sentUnitsVersion;
+    int64 numDroppedUnitSpikes;     // since acquisition started
+
+    // threshold crossing output (one TTL line per output, if the kernel supports it)
+    const EventChannel* crossingEventChannel;
+
+    // export to shared memory (open while acquiring, if enabled)
+    static const int EXPORT_CAPACITY = 4096; // frames
+    RateFrameWriter frameWriter;
+    std::vector<ThresholdCrossing> sortedCrossings;
+    Array<uint8> ttlLineStates; // bit per line
+
+    // spike batching
+    static const int SPIKE_BATCH_CAPACITY = 16384;
+    SpikeBatch spikeBatch;
+    bool batchingThisBlock;
+    int64 numDroppedSpikes; // since acquisition started
+
+#if MSR_INSTRUMENTATION
+    // processing statistics since acquisition started (logged when it stops)
+    BlockStats blockStats;
+    int blockSpikes;        // per block
+    int blockRejected;
+    int blockMaxFill;
+    int lastSpikePosition;
+#endif
+
+    // owned by the processor so that the audio thread never has to query the editor. its groups are
+    // the estimator sources, so it also counts and sums the weights of the selected electrodes of each source.
+    ChannelSelection spikeChannelSelection;
+    Array<uint64_t> spikeChannelIds; // to carry over selection when the spike channels change (see getSpikeChannelId)
+
+    // spike channel settings loaded from a configuration, waiting for their channel to exist
+    struct LoadedSpikeChannel
+    {
+        uint64_t id;        // 0 = saved without a name, so matched by number
+        int number;
+        bool enabled;
+        float weight;
+        WaveformGate gate;
+    };
+    Array<LoadedSpikeChannel> loadedSpikeChannels;
+
+    // waveform gate of each spike channel, set on the message thread and published to the audio thread
+    // (which picks them up at the start of a buffer, like the live parameters)
+    Array<WaveformGate> spikeChannelGates;
+    TripleBuffer<Array<WaveformGate>> liveGates;
+
+    // SpikeChannel* -> index in spikeChannelArray, built in updateSettings
+    ChannelLookup spikeChannelLookup;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MeanSpikeRate);
 };
@@ -26,9 +26,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <cfloat> // FLT_MAX
 
 MeanSpikeRateEditor::MeanSpikeRateEditor(MeanSpikeRate* parentNode)
-    : GenericEditor(parentNode, false)
+    : GenericEditor     (parentNode, false)
 {
-    desiredWidth = WIDTH;
+    desiredWidth = WIDTH + 2 * SETTINGS_WIDTH;
     const int HEADER_HEIGHT = 22;
 
     auto processor = static_cast<MeanSpikeRate*>(getProcessor());
@@ -38,8 +38,8 @@ MeanSpikeRateEditor::MeanSpikeRateEditor(MeanSpikeRate* parentNode)
     spikeChannelViewport->setScrollBarsShown(false, false, true, false);
     spikeChannelViewport->setBounds(0, HEADER_HEIGHT, CONTENT_WIDTH, BUTTON_VIEWPORT_HEIGHT);
 
-    spikeChannelCanvas = new Component();
-    spikeChannelViewport->setViewedComponent(spikeChannelCanvas);
+    spikeChannelSelector = new SpikeChannelSelector(this, BUTTON_WIDTH, BUTTON_HEIGHT, ROW_LENGTH, MARGIN);
+    spikeChannelViewport->setViewedComponent(spikeChannelSelector, false);
 
     addAndMakeVisible(spikeChannelViewport);
 
@@ -72,8 +72,8 @@ MeanSpikeRateEditor::MeanSpikeRateEditor(MeanSpikeRate* parentNode)
 
     timeConstEditable = new Label("timeConstE");
     timeConstEditable->setEditable(true);
-    timeConstEditable->setBounds(xPos += 80, yPos, 45, TEXT_HEIGHT);
-    timeConstEditable->setText(String(processor->timeConstMs), dontSendNotification);
+    timeConstEditable->setBounds(xPos += 80, yPos, 55, TEXT_HEIGHT);
+    timeConstEditable->setText(formatFloatList(processor->getTimeConstants()), dontSendNotification);
     timeConstEditable->setColour(Label::backgroundColourId, Colours::grey);
     timeConstEditable->setColour(Label::textColourId, Colours::white);
     timeConstEditable->setTooltip(TIME_CONST_TOOLTIP);
@@ -81,11 +81,234 @@ MeanSpikeRateEditor::MeanSpikeRateEditor(MeanSpikeRate* parentNode)
     addAndMakeVisible(timeConstEditable);
 
     timeConstUnit = new Label("timeConstU", "ms");
-    timeConstUnit->setBounds(xPos + 45, yPos + 1, 25, TEXT_HEIGHT);
+    timeConstUnit->setBounds(xPos + 55, yPos + 1, 25, TEXT_HEIGHT);
     timeConstUnit->setFont(Font("Small Text", 12, Font::plain));
     timeConstUnit->setColour(Label::textColourId, Colours::darkgrey);
     timeConstUnit->setTooltip(TIME_CONST_TOOLTIP);
     addAndMakeVisible(timeConstUnit);
+
+    xPos = 10;
+    yPos += TEXT_HEIGHT + 5;
+
+    threadsLabel = new Label("threadsL", "Threads:");
+    threadsLabel->setBounds(xPos, yPos + 1, 80, TEXT_HEIGHT);
+    threadsLabel->setFont(Font("Small Text", 12, Font::plain));
+    threadsLabel->setColour(Label::textColourId, Colours::darkgrey);
+    threadsLabel->setTooltip(THREADS_TOOLTIP);
+    addAndMakeVisible(threadsLabel);
+
+    threadsEditable = new Label("threadsE");
+    threadsEditable->setEditable(true);
+    threadsEditable->setBounds(xPos + 80, yPos, 55, TEXT_HEIGHT);
+    threadsEditable->setText(String(processor->numThreads), dontSendNotification);
+    threadsEditable->setColour(Label::backgroundColourId, Colours::grey);
+    threadsEditable->setColour(Label::textColourId, Colours::white);
+    threadsEditable->setTooltip(THREADS_TOOLTIP);
+    threadsEditable->addListener(this);
+    addAndMakeVisible(threadsEditable);
+
+    // output mode settings
+    xPos = WIDTH;
+    yPos = HEADER_HEIGHT + 5;
+
+    modeLabel = new Label("modeL", "Mode:");
+    modeLabel->setBounds(xPos, yPos + 1, 45, TEXT_HEIGHT);
+    modeLabel->setFont(Font("Small Text", 12, Font::plain));
+    modeLabel->setColour(Label::textColourId, Colours::darkgrey);
+    modeLabel->setTooltip(MODE_TOOLTIP);
+    addAndMakeVisible(modeLabel);
+
+    modeBox = new ComboBox("modeB");
+    modeBox->addItem("Mean", OUTPUT_MEAN + 1);
+    modeBox->addItem("Electrodes", OUTPUT_PER_ELECTRODE + 1);
+    modeBox->addItem("Groups", OUTPUT_PER_GROUP + 1);
+    modeBox->addItem("Units", OUTPUT_PER_UNIT + 1);
+    modeBox->setSelectedId(processor->outputMode + 1, dontSendNotification);
+    modeBox->setBounds(xPos + 45, yPos, 85, TEXT_HEIGHT);
+    modeBox->setTooltip(MODE_TOOLTIP);
+    modeBox->addListener(this);
+    addAndMakeVisible(modeBox);
+
+    yPos += TEXT_HEIGHT + 5;
+
+    groupsLabel = new Label("groupsL", "Groups:");
+    groupsLabel->setBounds(xPos, yPos + 1, 45, TEXT_HEIGHT);
+    groupsLabel->setFont(Font("Small Text", 12, Font::plain));
+    groupsLabel->setColour(Label::textColourId, Colours::darkgrey);
+    groupsLabel->setTooltip(GROUPS_TOOLTIP);
+    addAndMakeVisible(groupsLabel);
+
+    groupsEditable = new Label("groupsE");
+    groupsEditable->setEditable(true);
+    groupsEditable->setBounds(xPos + 45, yPos, 85, TEXT_HEIGHT);
+    groupsEditable->setColour(Label::backgroundColourId, Colours::grey);
+    groupsEditable->setColour(Label::textColourId, Colours::white);
+    groupsEditable->addListener(this);
+    addAndMakeVisible(groupsEditable);
+    updateGroupsField();
+
+    yPos += TEXT_HEIGHT + 5;
+
+    batchButton = new ToggleButton("Batch spikes");
+    batchButton->setBounds(xPos, yPos, 130, TEXT_HEIGHT);
+    batchButton->setToggleState(processor->batchSpikes, dontSendNotification);
+    batchButton->setTooltip(BATCH_TOOLTIP);
+    batchButton->addListener(this);
+    addAndMakeVisible(batchButton);
+
+    yPos += TEXT_HEIGHT + 5;
+
+    smoothingLabel = new Label("smoothingL", "Smooth:");
+    smoothingLabel->setBounds(xPos, yPos + 1, 50, TEXT_HEIGHT);
+    smoothingLabel->setFont(Font("Small Text", 12, Font::plain));
+    smoothingLabel->setColour(Label::textColourId, Colours::darkgrey);
+    smoothingLabel->setTooltip(SMOOTHING_TOOLTIP);
+    addAndMakeVisible(smoothingLabel);
+
+    smoothingEditable = new Label("smoothingE");
+    smoothingEditable->setEditable(true);
+    smoothingEditable->setBounds(xPos + 50, yPos, 50, TEXT_HEIGHT);
+    smoothingEditable->setText(String(processor->smoothingMs), dontSendNotification);
+    smoothingEditable->setColour(Label::backgroundColourId, Colours::grey);
+    smoothingEditable->setColour(Label::textColourId, Colours::white);
+    smoothingEditable->setTooltip(SMOOTHING_TOOLTIP);
+    smoothingEditable->addListener(this);
+    addAndMakeVisible(smoothingEditable);
+
+    smoothingUnit = new Label("smoothingU", "ms");
+    smoothingUnit->setBounds(xPos + 100, yPos + 1, 25, TEXT_HEIGHT);
+    smoothingUnit->setFont(Font("Small Text", 12, Font::plain));
+    smoothingUnit->setColour(Label::textColourId, Colours::darkgrey);
+    smoothingUnit->setTooltip(SMOOTHING_TOOLTIP);
+    addAndMakeVisible(smoothingUnit);
+
+    yPos += TEXT_HEIGHT + 5;
+
+    normalizeButton = new ToggleButton("Sum, then divide");
+    normalizeButton->setBounds(xPos, yPos, 130, TEXT_HEIGHT);
+    normalizeButton->setToggleState(processor->normalizeOnOutput, dontSendNotification);
+    normalizeButton->setTooltip(NORMALIZE_TOOLTIP);
+    normalizeButton->addListener(this);
+    addAndMakeVisible(normalizeButton);
+
+    // kernel settings
+    xPos = WIDTH + SETTINGS_WIDTH;
+    yPos = HEADER_HEIGHT + 5;
+
+    kernelLabel = new Label("kernelL", "Kernel:");
+    kernelLabel->setBounds(xPos, yPos + 1, 45, TEXT_HEIGHT);
+    kernelLabel->setFont(Font("Small Text", 12, Font::plain));
+    kernelLabel->setColour(Label::textColourId, Colours::darkgrey);
+    kernelLabel->setTooltip(KERNEL_TOOLTIP);
+    addAndMakeVisible(kernelLabel);
+
+    kernelBox = new ComboBox("kernelB");
+    for (int type = 0; type < NUM_KERNEL_TYPES; ++type)
+    {
+        kernelBox->addItem(getKernelName(static_cast<RateKernelType>(type)), type + 1);
+    }
+    kernelBox->setSelectedId(processor->kernelType + 1, dontSendNotification);
+    kernelBox->setBounds(xPos + 45, yPos, 85, TEXT_HEIGHT);
+    kernelBox->setTooltip(KERNEL_TOOLTIP);
+    kernelBox->addListener(this);
+    addAndMakeVisible(kernelBox);
+
+    yPos += TEXT_HEIGHT + 5;
+
+    readoutLabel = new Label("readoutL", "Readout:");
+    readoutLabel->setBounds(xPos, yPos + 1, 55, TEXT_HEIGHT);
+    readoutLabel->setFont(Font("Small Text", 12, Font::plain));
+    readoutLabel->setColour(Label::textColourId, Colours::darkgrey);
+    readoutLabel->setTooltip(READOUT_TOOLTIP);
+    addAndMakeVisible(readoutLabel);
+
+    readoutEditable = new Label("readoutE");
+    readoutEditable->setEditable(true);
+    readoutEditable->setBounds(xPos + 55, yPos, 45, TEXT_HEIGHT);
+    readoutEditable->setText(String(processor->readoutInterval), dontSendNotification);
+    readoutEditable->setColour(Label::backgroundColourId, Colours::grey);
+    readoutEditable->setColour(Label::textColourId, Colours::white);
+    readoutEditable->setTooltip(READOUT_TOOLTIP);
+    readoutEditable->addListener(this);
+    addAndMakeVisible(readoutEditable);
+
+    readoutUnit = new Label("readoutU", "samp");
+    readoutUnit->setBounds(xPos + 100, yPos + 1, 35, TEXT_HEIGHT);
+    readoutUnit->setFont(Font("Small Text", 12, Font::plain));
+    readoutUnit->setColour(Label::textColourId, Colours::darkgrey);
+    readoutUnit->setTooltip(READOUT_TOOLTIP);
+    addAndMakeVisible(readoutUnit);
+
+    yPos += TEXT_HEIGHT + 5;
+
+    addChannelsButton = new ToggleButton("Add channels");
+    addChannelsButton->setBounds(xPos, yPos, 130, TEXT_HEIGHT);
+    addChannelsButton->setToggleState(processor->addOutputChannels, dontSendNotification);
+    addChannelsButton->setTooltip(ADD_CHANNELS_TOOLTIP);
+    addChannelsButton->addListener(this);
+    addAndMakeVisible(addChannelsButton);
+
+    yPos += TEXT_HEIGHT + 5;
+
+    thresholdLabel = new Label("thresholdL", "TTL:");
+    thresholdLabel->setBounds(xPos, yPos + 1, 30, TEXT_HEIGHT);
+    thresholdLabel->setFont(Font("Small Text", 12, Font::plain));
+    thresholdLabel->setColour(Label::textColourId, Colours::darkgrey);
+    thresholdLabel->setTooltip(THRESHOLD_TOOLTIP);
+    addAndMakeVisible(thresholdLabel);
+
+    thresholdOnEditable = new Label("thresholdOnE");
+    thresholdOnEditable->setEditable(true);
+    thresholdOnEditable->setBounds(xPos + 30, yPos, 40, TEXT_HEIGHT);
+    thresholdOnEditable->setText(String(processor->thresholdOnHz), dontSendNotification);
+    thresholdOnEditable->setColour(Label::backgroundColourId, Colours::grey);
+    thresholdOnEditable->setColour(Label::textColourId, Colours::white);
+    thresholdOnEditable->setTooltip(THRESHOLD_TOOLTIP);
+    thresholdOnEditable->addListener(this);
+    addAndMakeVisible(thresholdOnEditable);
+
+    thresholdOffEditable = new Label("thresholdOffE");
+    thresholdOffEditable->setEditable(true);
+    thresholdOffEditable->setBounds(xPos + 75, yPos, 40, TEXT_HEIGHT);
+    thresholdOffEditable->setText(String(processor->thresholdOffHz), dontSendNotification);
+    thresholdOffEditable->setColour(Label::backgroundColourId, Colours::grey);
+    thresholdOffEditable->setColour(Label::textColourId, Colours::white);
+    thresholdOffEditable->setTooltip(THRESHOLD_TOOLTIP);
+    thresholdOffEditable->addListener(this);
+    addAndMakeVisible(thresholdOffEditable);
+
+    thresholdUnit = new Label("thresholdU", "Hz");
+    thresholdUnit->setBounds(xPos + 115, yPos + 1, 25, TEXT_HEIGHT);
+    thresholdUnit->setFont(Font("Small Text", 12, Font::plain));
+    thresholdUnit->setColour(Label::textColourId, Colours::darkgrey);
+    thresholdUnit->setTooltip(THRESHOLD_TOOLTIP);
+    addAndMakeVisible(thresholdUnit);
+
+    yPos += TEXT_HEIGHT + 5;
+
+    exportLabel = new Label("exportL", "Export:");
+    exportLabel->setBounds(xPos, yPos + 1, 55, TEXT_HEIGHT);
+    exportLabel->setFont(Font("Small Text", 12, Font::plain));
+    exportLabel->setColour(Label::textColourId, Colours::darkgrey);
+    exportLabel->setTooltip(EXPORT_TOOLTIP);
+    addAndMakeVisible(exportLabel);
+
+    exportEditable = new Label("exportE");
+    exportEditable->setEditable(true);
+    exportEditable->setBounds(xPos + 55, yPos, 45, TEXT_HEIGHT);
+    exportEditable->setText(String(processor->exportInterval), dontSendNotification);
+    exportEditable->setColour(Label::backgroundColourId, Colours::grey);
+    exportEditable->setColour(Label::textColourId, Colours::white);
+    exportEditable->setTooltip(EXPORT_TOOLTIP);
+    exportEditable->addListener(this);
+    addAndMakeVisible(exportEditable);
+
+    exportUnit = new Label("exportU", "samp");
+    exportUnit->setBounds(xPos + 100, yPos + 1, 35, TEXT_HEIGHT);
+    exportUnit->setFont(Font("Small Text", 12, Font::plain));
+    exportUnit->setColour(Label::textColourId, Colours::darkgrey);
+    exportUnit->setTooltip(EXPORT_TOOLTIP);
+    addAndMakeVisible(exportUnit);
 }
 
 MeanSpikeRateEditor::~MeanSpikeRateEditor() {}
@@ -96,7 +319,7 @@ void MeanSpikeRateEditor::updateSettings()
 
     // update output channel options
     int oldNumChans = outputBox->getNumItems();
-    int newNumChans = processor->getNumInputs();
+    int newNumChans = processor->numInputChans; // not the added output channels
 
     if (newNumChans != oldNumChans)
     {
@@ -115,144 +338,468 @@ void MeanSpikeRateEditor::updateSettings()
             outputBox->setSelectedId(1, sendNotificationAsync);
         }
     }
+    else if (newNumChans > processor->outputChan && outputBox->getSelectedId() != processor->outputChan + 1)
+    {
+        // (e.g. set by loading a configuration)
+        outputBox->setSelectedId(processor->outputChan + 1, dontSendNotification);
+    }
 
-    // update electrode buttons
+    // update electrode toggles (just their labels - the selection is carried over by the processor)
     auto& spikeChannelArray = processor->spikeChannelArray;
+    StringArray labels;
+    labels.ensureStorageAllocated(spikeChannelArray.size());
+    for (auto chan : spikeChannelArray)
+    {
+        labels.add(getChannelLabel(chan));
+    }
+    spikeChannelSelector->setLabels(labels);
+}
+
+void MeanSpikeRateEditor::updateChannelButtonStates()
+{
+    spikeChannelSelector->repaint();
+}
+
+void MeanSpikeRateEditor::comboBoxChanged(ComboBox* comboBoxThatHasChanged)
+{
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+
+    if (comboBoxThatHasChanged == outputBox)
+    {
+        processor->setParameter(OUTPUT_CHAN, comboBoxThatHasChanged->getSelectedId() - 1);
+    }
+    else if (comboBoxThatHasChanged == modeBox)
+    {
+        processor->setParameter(OUTPUT_MODE, comboBoxThatHasChanged->getSelectedId() - 1);
+        updateGroupsField();
+        CoreServices::updateSignalChain(this);
+    }
+    else if (comboBoxThatHasChanged == kernelBox)
+    {
+        processor->setParameter(KERNEL, comboBoxThatHasChanged->getSelectedId() - 1);
+        CoreServices::updateSignalChain(this);
+    }
+}
 
-    // make spikeChannelButtons array match the spikeChannelArray
-    int numSpikeChans = spikeChannelArray.size();
-    int numButtons;
-    for (int kChan = 0; kChan < numSpikeChans; ++kChan)
+void MeanSpikeRateEditor::labelTextChanged(Label* labelThatHasChanged)
+{
+    if (labelThatHasChanged == timeConstEditable)
     {
-        numButtons = spikeChannelButtons.size();
-        jassert(numButtons >= kChan);
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+        Array<double> oldVals = processor->getTimeConstants();
+
+        Array<double> newVals;
+        bool success = updateFloatListLabel(labelThatHasChanged, 0.01F, FLT_MAX, MeanSpikeRate::MAX_TIME_CONSTS,
+            oldVals, &newVals);
+
+        if (success && newVals.size() != oldVals.size() && CoreServices::getAcquisitionStatus())
+        {
+            // number of outputs can't change during acquisition
+            labelThatHasChanged->setText(formatFloatList(oldVals), dontSendNotification);
+            success = false;
+        }
 
-        if (numButtons > kChan)
+        if (success)
         {
-            // check whether this or a later button matches the channel
-            String name = spikeChannelArray[kChan]->getName();
-            if (spikeChannelButtons[kChan]->getTooltip() == name)
+            processor->setTimeConstants(newVals);
+            if (newVals.size() != oldVals.size())
             {
-                continue; // already in the right place
+                CoreServices::updateSignalChain(this);
             }
+        }
+    }
+    else if (labelThatHasChanged == smoothingEditable)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
 
-            bool found = false;
-            for (int kButton = kChan + 1; kButton < numButtons; ++kButton)
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 0.0F, FLT_MAX, static_cast<float>(processor->smoothingMs), &newVal))
+        {
+            processor->setParameter(TIME_CONST_SMOOTHING, newVal);
+        }
+    }
+    else if (labelThatHasChanged == thresholdOnEditable)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 0.0F, FLT_MAX, static_cast<float>(processor->thresholdOnHz), &newVal))
+        {
+            processor->setParameter(THRESHOLD_ON, newVal);
+        }
+    }
+    else if (labelThatHasChanged == thresholdOffEditable)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 0.0F, FLT_MAX, static_cast<float>(processor->thresholdOffHz), &newVal))
+        {
+            processor->setParameter(THRESHOLD_OFF, newVal);
+        }
+    }
+    else if (labelThatHasChanged == readoutEditable)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 0.0F, FLT_MAX, static_cast<float>(processor->readoutInterval), &newVal))
+        {
+            int newInterval = static_cast<int>(newVal);
+            labelThatHasChanged->setText(String(newInterval), dontSendNotification);
+            if (newInterval != processor->readoutInterval)
             {
-                if (spikeChannelButtons[kButton]->getTooltip() == name)
-                {
-                    found = true;
-                    spikeChannelButtons.swap(kChan, kButton);
-                    break;
-                }
+                processor->setParameter(READOUT_INTERVAL, static_cast<float>(newInterval));
+                CoreServices::updateSignalChain(this);
             }
+        }
+    }
+    else if (labelThatHasChanged == threadsEditable)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
 
-            if (found)
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 1.0F, static_cast<float>(MeanSpikeRate::MAX_THREADS),
+            static_cast<float>(processor->numThreads), &newVal))
+        {
+            int newNumThreads = static_cast<int>(newVal);
+            labelThatHasChanged->setText(String(newNumThreads), dontSendNotification);
+            if (newNumThreads != processor->numThreads)
             {
-                continue; // button found and swapped to right place
+                processor->setParameter(NUM_THREADS, static_cast<float>(newNumThreads));
+                CoreServices::updateSignalChain(this);
             }
         }
+    }
+    else if (labelThatHasChanged == exportEditable)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
 
-        // have to add a new button
-        spikeChannelButtons.insert(kChan, makeNewChannelButton(spikeChannelArray[kChan]));
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 0.0F, FLT_MAX, static_cast<float>(processor->exportInterval), &newVal))
+        {
+            int newInterval = static_cast<int>(newVal);
+            labelThatHasChanged->setText(String(newInterval), dontSendNotification);
+            processor->setParameter(EXPORT_INTERVAL, static_cast<float>(newInterval));
+        }
     }
+    else if (labelThatHasChanged == groupsEditable && modeBox->getSelectedId() == OUTPUT_PER_UNIT + 1)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
 
-    // remove extra buttons
-    numButtons = spikeChannelButtons.size();
-    if (numButtons > numSpikeChans)
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 1.0F, static_cast<float>(MeanSpikeRate::MAX_UNITS_LIMIT),
+            static_cast<float>(processor->maxUnits), &newVal))
+        {
+            int newMaxUnits = static_cast<int>(newVal);
+            labelThatHasChanged->setText(String(newMaxUnits), dontSendNotification);
+            if (newMaxUnits != processor->maxUnits)
+            {
+                processor->setParameter(MAX_UNITS, static_cast<float>(newMaxUnits));
+                CoreServices::updateSignalChain(this);
+            }
+        }
+    }
+    else if (labelThatHasChanged == groupsEditable)
     {
-        spikeChannelButtons.removeLast(numButtons - numSpikeChans);
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+
+        if (processor->setElectrodeGroups(labelThatHasChanged->getText()) && processor->outputMode == OUTPUT_PER_GROUP)
+        {
+            CoreServices::updateSignalChain(this);
+        }
+        labelThatHasChanged->setText(processor->getElectrodeGroups(), dontSendNotification);
     }
+}
+
+void MeanSpikeRateEditor::startAcquisition()
+{
+    GenericEditor::startAcquisition();
+    modeBox->setEnabled(false);
+    groupsEditable->setEnabled(false);
+    kernelBox->setEnabled(false);
+    readoutEditable->setEnabled(false);
+    exportEditable->setEnabled(false);
+    threadsEditable->setEnabled(false);
+    addChannelsButton->setEnabled(false);
+    normalizeButton->setEnabled(false);
+}
 
-    // position the buttons
-    layoutChannelButtons();
+void MeanSpikeRateEditor::stopAcquisition()
+{
+    GenericEditor::stopAcquisition();
+    modeBox->setEnabled(true);
+    groupsEditable->setEnabled(true);
+    kernelBox->setEnabled(true);
+    readoutEditable->setEnabled(true);
+    exportEditable->setEnabled(true);
+    threadsEditable->setEnabled(true);
+    addChannelsButton->setEnabled(true);
+    normalizeButton->setEnabled(true);
 }
 
-int MeanSpikeRateEditor::getNumActiveElectrodes()
+void MeanSpikeRateEditor::buttonEvent(Button* button)
 {
-    int numActive = 0;
-    for (auto button : spikeChannelButtons)
+    if (button == batchButton)
     {
-        if (button->getToggleState())
-        {
-            numActive++;
-        }
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+        processor->setParameter(BATCH_SPIKES, button->getToggleState() ? 1.0f : 0.0f);
+        return;
+    }
+
+    if (button == addChannelsButton)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+        processor->setParameter(ADD_CHANNELS, button->getToggleState() ? 1.0f : 0.0f);
+        CoreServices::updateSignalChain(this);
+        return;
+    }
+
+    if (button == normalizeButton)
+    {
+        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+        processor->setParameter(NORMALIZE_ON_OUTPUT, button->getToggleState() ? 1.0f : 0.0f);
+        CoreServices::updateSignalChain(this);
+        return;
     }
-    return numActive;
 }
 
-void MeanSpikeRateEditor::comboBoxChanged(ComboBox* comboBoxThatHasChanged)
+bool MeanSpikeRateEditor::isSpikeChannelEnabled(int index)
 {
     auto processor = static_cast<MeanSpikeRate*>(getProcessor());
-    processor->setParameter(OUTPUT_CHAN, comboBoxThatHasChanged->getSelectedId() - 1);
+    return processor->getSpikeChannelEnabled(index);
 }
 
-void MeanSpikeRateEditor::labelTextChanged(Label* labelThatHasChanged)
+void MeanSpikeRateEditor::spikeChannelsClicked(int first, int last, bool enabled)
 {
-    if (labelThatHasChanged == timeConstEditable)
+    // the audio thread only sees the processor's copy of the selection
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+    for (int kChan = first; kChan <= last; ++kChan)
     {
-        auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+        processor->setSpikeChannelEnabled(kChan, enabled);
+    }
+}
 
-        float newVal;
-        bool success = updateFloatLabel(labelThatHasChanged, 0.01F, FLT_MAX, static_cast<float>(processor->timeConstMs), &newVal);
+void MeanSpikeRateEditor::spikeChannelRightClicked(int index)
+{
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+    String label = getChannelLabel(processor->spikeChannelArray[index]);
+
+    ElectrodeGroups groups;
+    groups.parse(processor->getElectrodeGroups().toStdString());
+    int numGroups = groups.getNumGroups();
+
+    enum { SETTINGS = 1, SELECT_ALL, SELECT_NONE, SELECT_ONLY, INVERT, SELECT_SPEC, SELECT_GROUP };
+
+    PopupMenu menu;
+    menu.addItem(SETTINGS, "Weight and gate of " + label + "...");
+    menu.addSeparator();
+    menu.addItem(SELECT_ALL, "Select all");
+    menu.addItem(SELECT_NONE, "Select none");
+    menu.addItem(SELECT_ONLY, "Select only " + label);
+    menu.addItem(INVERT, "Invert selection");
+    menu.addItem(SELECT_SPEC, "Select electrodes...");
+    for (int group = 0; group < numGroups; ++group)
+    {
+        menu.addItem(SELECT_GROUP + group, "Select only group " + String(group + 1));
+    }
 
-        if (success)
+    int result = menu.show();
+    switch (result)
+    {
+    case 0:
+        return; // dismissed
+
+    case SETTINGS:
+        editChannelSettings(index);
+        return;
+
+    case SELECT_ALL:
+        selectChannels([](int) { return true; });
+        return;
+
+    case SELECT_NONE:
+        selectChannels([](int) { return false; });
+        return;
+
+    case SELECT_ONLY:
+        selectChannels([index](int kChan) { return kChan == index; });
+        return;
+
+    case INVERT:
+        selectChannels([processor](int kChan) { return !processor->getSpikeChannelEnabled(kChan); });
+        return;
+
+    case SELECT_SPEC:
+        selectChannelsFromSpec();
+        return;
+
+    default:
+    {
+        int numChans = processor->spikeChannelArray.size();
+        Array<bool> inGroup;
+        inGroup.insertMultiple(0, false, numChans);
+        for (int kChan : groups.getGroup(result - SELECT_GROUP))
         {
-            processor->setParameter(TIME_CONST, newVal);
+            if (kChan < numChans)
+            {
+                inGroup.set(kChan, true);
+            }
         }
+        selectChannels([&inGroup](int kChan) { return inGroup[kChan]; });
+        return;
+    }
     }
 }
 
-bool MeanSpikeRateEditor::getSpikeChannelEnabled(int index)
+String MeanSpikeRateEditor::getSpikeChannelTooltip(int index)
 {
-    if (index < 0 || index >= spikeChannelButtons.size())
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+    float weight = processor->getSpikeChannelWeight(index);
+    WaveformGate gate = processor->getSpikeChannelGate(index);
+    StringArray limits;
+    if (gate.minPeak > 0)
     {
-        jassertfalse;
-        return false;
+        limits.add("peak >= " + String(gate.minPeak));
     }
-    return spikeChannelButtons[index]->getToggleState();
-}
-
-void MeanSpikeRateEditor::setSpikeChannelEnabled(int index, bool enabled)
-{
-    if (index < 0 || index >= spikeChannelButtons.size())
+    if (gate.maxPeak > 0)
     {
-        jassertfalse;
-        return;
+        limits.add("peak <= " + String(gate.maxPeak));
+    }
+    if (gate.minPeakToTrough > 0)
+    {
+        limits.add("peak-to-trough >= " + String(gate.minPeakToTrough));
+    }
+    if (gate.minWidth > 0)
+    {
+        limits.add("width >= " + String(gate.minWidth));
+    }
+    if (gate.maxWidth > 0)
+    {
+        limits.add("width <= " + String(gate.maxWidth));
     }
-    spikeChannelButtons[index]->setToggleState(enabled, sendNotificationSync);
+
+    return String(index + 1) + ": " + processor->spikeChannelArray[index]->getName()
+        + (weight != 1.0f ? "\nWeight: " + String(weight) : String())
+        + (limits.isEmpty() ? String() : "\nOnly spikes with " + limits.joinIntoString(", "))
+        + "\n(shift-click to toggle a range, right-click for weight, gate and bulk selection)";
 }
 
 void MeanSpikeRateEditor::saveCustomParameters(XmlElement* xml)
 {
     xml->setAttribute("Type", "MeanSpikeRateEditor");
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
 
     XmlElement* paramValues = xml->createNewChildElement("VALUES");
     paramValues->setAttribute("outputChan", outputBox.get() ? outputBox->getSelectedId() - 1 : -1);
     paramValues->setAttribute("timeConstMs", timeConstEditable.get() ? timeConstEditable->getText() : "1000");
+    paramValues->setAttribute("outputMode", modeBox.get() ? modeBox->getSelectedId() - 1 : OUTPUT_MEAN);
+    paramValues->setAttribute("electrodeGroups", processor->getElectrodeGroups());
+    paramValues->setAttribute("maxUnits", processor->maxUnits);
+    paramValues->setAttribute("batchSpikes", batchButton.get() ? batchButton->getToggleState() : true);
+    paramValues->setAttribute("kernel", kernelBox.get() ? kernelBox->getSelectedId() - 1 : KERNEL_EXPONENTIAL);
+    paramValues->setAttribute("addChannels", addChannelsButton.get() ? addChannelsButton->getToggleState() : true);
+    paramValues->setAttribute("readoutInterval", readoutEditable.get() ? readoutEditable->getText() : "1");
+    paramValues->setAttribute("smoothingMs", smoothingEditable.get() ? smoothingEditable->getText() : "0");
+    paramValues->setAttribute("thresholdOnHz", thresholdOnEditable.get() ? thresholdOnEditable->getText() : "0");
+    paramValues->setAttribute("thresholdOffHz", thresholdOffEditable.get() ? thresholdOffEditable->getText() : "0");
+    paramValues->setAttribute("exportInterval", exportEditable.get() ? exportEditable->getText() : "0");
+    paramValues->setAttribute("numThreads", processor->numThreads);
+    paramValues->setAttribute("normalizeOnOutput", normalizeButton.get() ? normalizeButton->getToggleState() : false);
 }
 
 void MeanSpikeRateEditor::loadCustomParameters(XmlElement* xml)
 {
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+
+    // the values go straight to the processor, and the widgets are set without notifications (whose
+    // handlers could update the signal chain once per changed setting). the update that follows loading
+    // applies them all at once and refreshes the rest of the editor.
     forEachXmlChildElementWithTagName(*xml, xmlNode, "VALUES")
     {
         int newOutputChan = xmlNode->getIntAttribute("outputChan", -1);
-        if (newOutputChan >= 0 && newOutputChan < outputBox->getNumItems())
+        if (newOutputChan >= 0)
+        {
+            processor->setParameter(OUTPUT_CHAN, static_cast<float>(newOutputChan));
+        }
+
+        timeConstEditable->setText(xmlNode->getStringAttribute("timeConstMs", timeConstEditable->getText()), dontSendNotification);
+        Array<double> newTimeConsts;
+        if (updateFloatListLabel(timeConstEditable, 0.01F, FLT_MAX, MeanSpikeRate::MAX_TIME_CONSTS,
+            processor->getTimeConstants(), &newTimeConsts))
+        {
+            processor->setTimeConstants(newTimeConsts);
+        }
+
+        // (groups and units share a field, and only take effect on the next signal chain update)
+        processor->setElectrodeGroups(xmlNode->getStringAttribute("electrodeGroups", processor->getElectrodeGroups()));
+        processor->setParameter(MAX_UNITS, static_cast<float>(xmlNode->getIntAttribute("maxUnits", processor->maxUnits)));
+
+        loadToggle(batchButton, xmlNode->getBoolAttribute("batchSpikes", batchButton->getToggleState()), BATCH_SPIKES);
+        loadToggle(normalizeButton, xmlNode->getBoolAttribute("normalizeOnOutput", false), NORMALIZE_ON_OUTPUT);
+        // configurations saved before channels could be added overwrote the output channel
+        loadToggle(addChannelsButton, xmlNode->getBoolAttribute("addChannels", false), ADD_CHANNELS);
+
+        loadLabel(smoothingEditable, xmlNode->getStringAttribute("smoothingMs", smoothingEditable->getText()),
+            0.0F, FLT_MAX, static_cast<float>(processor->smoothingMs), TIME_CONST_SMOOTHING, false);
+        loadLabel(thresholdOnEditable, xmlNode->getStringAttribute("thresholdOnHz", thresholdOnEditable->getText()),
+            0.0F, FLT_MAX, static_cast<float>(processor->thresholdOnHz), THRESHOLD_ON, false);
+        loadLabel(thresholdOffEditable, xmlNode->getStringAttribute("thresholdOffHz", thresholdOffEditable->getText()),
+            0.0F, FLT_MAX, static_cast<float>(processor->thresholdOffHz), THRESHOLD_OFF, false);
+        loadLabel(exportEditable, xmlNode->getStringAttribute("exportInterval", exportEditable->getText()),
+            0.0F, FLT_MAX, static_cast<float>(processor->exportInterval), EXPORT_INTERVAL, true);
+        loadLabel(threadsEditable, String(xmlNode->getIntAttribute("numThreads", processor->numThreads)),
+            1.0F, static_cast<float>(MeanSpikeRate::MAX_THREADS), static_cast<float>(processor->numThreads), NUM_THREADS, true);
+        loadLabel(readoutEditable, xmlNode->getStringAttribute("readoutInterval", readoutEditable->getText()),
+            0.0F, FLT_MAX, static_cast<float>(processor->readoutInterval), READOUT_INTERVAL, true);
+
+        int newKernel = xmlNode->getIntAttribute("kernel", KERNEL_EXPONENTIAL);
+        if (newKernel >= 0 && newKernel < NUM_KERNEL_TYPES)
         {
-            outputBox->setSelectedId(newOutputChan + 1, sendNotificationSync);
+            kernelBox->setSelectedId(newKernel + 1, dontSendNotification);
+            processor->setParameter(KERNEL, static_cast<float>(newKernel));
         }
 
-        timeConstEditable->setText(xmlNode->getStringAttribute("timeConstMs", timeConstEditable->getText()), sendNotificationSync);
+        int newOutputMode = xmlNode->getIntAttribute("outputMode", OUTPUT_MEAN);
+        if (newOutputMode >= OUTPUT_MEAN && newOutputMode <= OUTPUT_PER_UNIT)
+        {
+            modeBox->setSelectedId(newOutputMode + 1, dontSendNotification);
+            processor->setParameter(OUTPUT_MODE, static_cast<float>(newOutputMode));
+        }
+        updateGroupsField();
     }
+
+    // the spike channel settings come before the editor's in the configuration
+    processor->applyLoadedChannelSettings();
 }
 
 /* -------- private ----------- */
 
-ElectrodeButton* MeanSpikeRateEditor::makeNewChannelButton(SpikeChannel* chan)
+void MeanSpikeRateEditor::loadToggle(Button* button, bool state, int parameterIndex)
+{
+    button->setToggleState(state, dontSendNotification);
+    getProcessor()->setParameter(parameterIndex, state ? 1.0f : 0.0f);
+}
+
+void MeanSpikeRateEditor::loadLabel(Label* label, const String& text, float min, float max, float currentValue,
+    int parameterIndex, bool isInteger)
+{
+    label->setText(text, dontSendNotification);
+
+    float newVal;
+    if (updateFloatLabel(label, min, max, currentValue, &newVal))
+    {
+        if (isInteger)
+        {
+            newVal = static_cast<float>(static_cast<int>(newVal));
+            label->setText(String(static_cast<int>(newVal)), dontSendNotification);
+        }
+        getProcessor()->setParameter(parameterIndex, newVal);
+    }
+}
+
+String MeanSpikeRateEditor::getChannelLabel(const SpikeChannel* chan)
 {
-    auto button = new ElectrodeButton(0);
-    button->setToggleState(true, dontSendNotification);
-    
     String prefix;
     switch (chan->getChannelType())
     {
@@ -273,29 +820,125 @@ ElectrodeButton* MeanSpikeRateEditor::makeNewChannelButton(SpikeChannel* chan)
         break;
     }
 
-    button->setButtonText(prefix + String(chan->getSourceTypeIndex()));
-    button->setTooltip(chan->getName());
+    return prefix + String(chan->getSourceTypeIndex());
+}
+
+void MeanSpikeRateEditor::selectChannels(std::function<bool(int)> shouldEnable)
+{
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+    int numChans = processor->spikeChannelArray.size();
+    for (int kChan = 0; kChan < numChans; ++kChan)
+    {
+        bool enable = shouldEnable(kChan);
+        if (enable != processor->getSpikeChannelEnabled(kChan))
+        {
+            processor->setSpikeChannelEnabled(kChan, enable);
+        }
+    }
+    updateChannelButtonStates();
+}
+
+void MeanSpikeRateEditor::selectChannelsFromSpec()
+{
+    AlertWindow window("Select electrodes", "Electrodes to select, numbered in button order (e.g. \"1-64, 100\"; "
+        "groups separated by semicolons are all selected):", AlertWindow::NoIcon, this);
+    window.addTextEditor("electrodes", String(), "Electrodes:");
+    window.addButton("OK", 1, KeyPress(KeyPress::returnKey));
+    window.addButton("Cancel", 0, KeyPress(KeyPress::escapeKey));
+    if (window.runModalLoop() != 1)
+    {
+        return;
+    }
+
+    String spec = window.getTextEditorContents("electrodes");
+    ElectrodeGroups groups;
+    if (!groups.parse(spec.toStdString()))
+    {
+        CoreServices::sendStatusMessage("Invalid electrode list: " + spec);
+        return;
+    }
 
-    return button;
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+    int numChans = processor->spikeChannelArray.size();
+    Array<bool> selected;
+    selected.insertMultiple(0, false, numChans);
+    for (int group = 0; group < groups.getNumGroups(); ++group)
+    {
+        for (int kChan : groups.getGroup(group))
+        {
+            if (kChan < numChans)
+            {
+                selected.set(kChan, true);
+            }
+        }
+    }
+    selectChannels([&selected](int kChan) { return selected[kChan]; });
 }
 
-void MeanSpikeRateEditor::layoutChannelButtons()
+void MeanSpikeRateEditor::editChannelSettings(int index)
 {
-    int nButtons = spikeChannelButtons.size();
-    int nRows = nButtons > 0 ? (nButtons - 1) / ROW_LENGTH + 1 : 0;
-    spikeChannelCanvas->setBounds(0, 0, WIDTH, MARGIN * 2 + nRows * BUTTON_HEIGHT);
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
+    String name = processor->spikeChannelArray[index]->getName();
+    WaveformGate gate = processor->getSpikeChannelGate(index);
+
+    AlertWindow window("Electrode settings", "Weight of " + name + " in the mean over electrodes, and limits on the "
+        "waveforms of the spikes that count (peak and peak-to-trough in uV over all channels, width in samples "
+        "between the trough and peak; 0 = no limit):", AlertWindow::NoIcon, this);
+    window.addTextEditor("weight", String(processor->getSpikeChannelWeight(index)), "Weight:");
+    window.addTextEditor("minPeak", String(gate.minPeak), "Min. peak:");
+    window.addTextEditor("maxPeak", String(gate.maxPeak), "Max. peak:");
+    window.addTextEditor("minPeakToTrough", String(gate.minPeakToTrough), "Min. peak-to-trough:");
+    window.addTextEditor("minWidth", String(gate.minWidth), "Min. width:");
+    window.addTextEditor("maxWidth", String(gate.maxWidth), "Max. width:");
+    window.addButton("OK", 1, KeyPress(KeyPress::returnKey));
+    window.addButton("Cancel", 0, KeyPress(KeyPress::escapeKey));
+    if (window.runModalLoop() != 1)
+    {
+        return;
+    }
 
-    for (int kButton = 0; kButton < nButtons; ++kButton)
+    // all values are >= 0
+    const char* fields[] = { "weight", "minPeak", "maxPeak", "minPeakToTrough", "minWidth", "maxWidth" };
+    float values[6];
+    for (int kField = 0; kField < 6; ++kField)
     {
-        int row = kButton / ROW_LENGTH;
-        int col = kButton % ROW_LENGTH;
+        String text = window.getTextEditorContents(fields[kField]).trim();
+        if (text.isEmpty() || !text.containsOnly("0123456789.eE+-"))
+        {
+            CoreServices::sendStatusMessage("Invalid electrode setting: " + text);
+            return;
+        }
+        values[kField] = jmax(0.0f, text.getFloatValue());
+    }
+
+    gate.minPeak = values[1];
+    gate.maxPeak = values[2];
+    gate.minPeakToTrough = values[3];
+    gate.minWidth = static_cast<int>(values[4]);
+    gate.maxWidth = static_cast<int>(values[5]);
+    processor->setSpikeChannelWeight(index, values[0]);
+    processor->setSpikeChannelGate(index, gate);
+    updateChannelButtonStates();
+}
 
-        ElectrodeButton* button = spikeChannelButtons[kButton];
-        button->setBounds(MARGIN + col * BUTTON_WIDTH, MARGIN + row * BUTTON_HEIGHT,
-            BUTTON_WIDTH, BUTTON_HEIGHT);
+void MeanSpikeRateEditor::updateGroupsField()
+{
+    auto processor = static_cast<MeanSpikeRate*>(getProcessor());
 
-        spikeChannelCanvas->addAndMakeVisible(button);
-    }    
+    if (modeBox->getSelectedId() == OUTPUT_PER_UNIT + 1)
+    {
+        groupsLabel->setText("Units:", dontSendNotification);
+        groupsLabel->setTooltip(UNITS_TOOLTIP);
+        groupsEditable->setText(String(processor->maxUnits), dontSendNotification);
+        groupsEditable->setTooltip(UNITS_TOOLTIP);
+    }
+    else
+    {
+        groupsLabel->setText("Groups:", dontSendNotification);
+        groupsLabel->setTooltip(GROUPS_TOOLTIP);
+        groupsEditable->setText(processor->getElectrodeGroups(), dontSendNotification);
+        groupsEditable->setTooltip(GROUPS_TOOLTIP);
+    }
 }
 
 bool MeanSpikeRateEditor::updateFloatLabel(Label* label, float min, float max,
@@ -318,3 +961,45 @@ bool MeanSpikeRateEditor::updateFloatLabel(Label* label, float min, float max,
     label->setText(String(*out), dontSendNotification);
     return true;
 }
+
+bool MeanSpikeRateEditor::updateFloatListLabel(Label* label, float min, float max, int maxValues,
+    const Array<double>& defaultValues, Array<double>* out)
+{
+    StringArray tokens;
+    tokens.addTokens(label->getText(), ",; ", "");
+    tokens.removeEmptyStrings();
+
+    Array<double> parsed;
+    for (const String& token : tokens)
+    {
+        try
+        {
+            parsed.add(jmax(min, jmin(max, std::stof(token.toRawUTF8()))));
+        }
+        catch (const std::logic_error&)
+        {
+            parsed.clear();
+            break;
+        }
+    }
+
+    if (parsed.isEmpty() || parsed.size() > maxValues)
+    {
+        label->setText(formatFloatList(defaultValues), dontSendNotification);
+        return false;
+    }
+
+    *out = parsed;
+    label->setText(formatFloatList(parsed), dontSendNotification);
+    return true;
+}
+
+String MeanSpikeRateEditor::formatFloatList(const Array<double>& values)
+{
+    StringArray strings;
+    for (double value : values)
+    {
+        strings.add(String(static_cast<float>(value)));
+    }
+    return strings.joinIntoString(", ");
+}
@@ -26,11 +26,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <EditorHeaders.h>
 #include "MeanSpikeRate.h"
+#include "SpikeChannelSelector.h"
+#include <functional>
 
 class MeanSpikeRateEditor 
     : public GenericEditor
     , public ComboBoxListener
     , public LabelListener
+    , public SpikeChannelSelector::Listener
 {
 public:
     MeanSpikeRateEditor(MeanSpikeRate* parentNode);
@@ -38,7 +41,8 @@ public:
 
     void updateSettings() override;
 
-    int getNumActiveElectrodes();
+    // redraws the electrode toggles from the processor's selection
+    void updateChannelButtonStates();
 
     // implements ComboBox::Listener
     void comboBoxChanged(ComboBox* comboBoxThatHasChanged) override;
@@ -46,16 +50,45 @@ public:
     // implements Label::Listener
     void labelTextChanged(Label* labelThatHasChanged) override;
 
-    bool getSpikeChannelEnabled(int index);
-    void setSpikeChannelEnabled(int index, bool enabled);
+    // batch, add channels or normalization button toggled
+    void buttonEvent(Button* button) override;
+
+    // implements SpikeChannelSelector::Listener
+    bool isSpikeChannelEnabled(int index) override;
+    void spikeChannelsClicked(int first, int last, bool enabled) override;
+    void spikeChannelRightClicked(int index) override; // shows a menu of bulk selections and settings
+    String getSpikeChannelTooltip(int index) override; // name, weight and gate
+
+    // output mode, groups, kernel, readout and export intervals, adding channels, normalization and threads can only be changed while not acquiring
+    void startAcquisition() override;
+    void stopAcquisition() override;
 
     void saveCustomParameters(XmlElement* xml) override;
     void loadCustomParameters(XmlElement* xml) override;
 
 private:
     // functions
-    ElectrodeButton* makeNewChannelButton(SpikeChannel* chan);
-    void layoutChannelButtons();
+    // short label for the electrode toggle, e.g. "TT3" for the third tetrode
+    static String getChannelLabel(const SpikeChannel* chan);
+
+    // enables exactly the electrodes for which shouldEnable(index) returns true
+    void selectChannels(std::function<bool(int)> shouldEnable);
+
+    // asks for a list of electrodes to select, in the format of the electrode groups (in a modal dialog)
+    void selectChannelsFromSpec();
+
+    // asks for a new weight and waveform gate for an electrode (in a modal dialog)
+    void editChannelSettings(int index);
+
+    // the groups field sets the maximum number of units instead in unit mode
+    void updateGroupsField();
+
+    // set a widget to a loaded value and the processor's parameter to match, without notifying
+    // the widget's listener (which may update the signal chain). a label's text is only applied
+    // if it is valid, as in updateFloatLabel.
+    void loadToggle(Button* button, bool state, int parameterIndex);
+    void loadLabel(Label* label, const String& text, float min, float max, float currentValue,
+        int parameterIndex, bool isInteger);
 
     /*
      * Ouputs whether the label contained a valid input; if so, it is stored in *out
@@ -65,10 +98,18 @@ private:
     static bool updateFloatLabel(Label* label, float min, float max,
         float defaultValue, float* out);
 
+    /*
+     * Same as updateFloatLabel for a list of at most maxValues comma-separated values.
+     * If the input is invalid, the label is reset to the defaultValues.
+     */
+    static bool updateFloatListLabel(Label* label, float min, float max, int maxValues,
+        const Array<double>& defaultValues, Array<double>* out);
+
+    static String formatFloatList(const Array<double>& values);
+
     // UI elements
     ScopedPointer<Viewport> spikeChannelViewport;
-    ScopedPointer<Component> spikeChannelCanvas;
-    OwnedArray<ElectrodeButton> spikeChannelButtons;
+    ScopedPointer<SpikeChannelSelector> spikeChannelSelector;
 
     ScopedPointer<Label> outputLabel;
     ScopedPointer<ComboBox> outputBox;
@@ -77,6 +118,41 @@ private:
     ScopedPointer<Label> timeConstEditable;
     ScopedPointer<Label> timeConstUnit;
 
+    ScopedPointer<Label> threadsLabel;
+    ScopedPointer<Label> threadsEditable;
+
+    ScopedPointer<Label> modeLabel;
+    ScopedPointer<ComboBox> modeBox;
+
+    ScopedPointer<Label> groupsLabel;
+    ScopedPointer<Label> groupsEditable;
+
+    ScopedPointer<ToggleButton> batchButton;
+
+    ScopedPointer<Label> smoothingLabel;
+    ScopedPointer<Label> smoothingEditable;
+    ScopedPointer<Label> smoothingUnit;
+
+    ScopedPointer<ToggleButton> normalizeButton;
+
+    ScopedPointer<Label> kernelLabel;
+    ScopedPointer<ComboBox> kernelBox;
+
+    ScopedPointer<Label> readoutLabel;
+    ScopedPointer<Label> readoutEditable;
+    ScopedPointer<Label> readoutUnit;
+
+    ScopedPointer<ToggleButton> addChannelsButton;
+
+    ScopedPointer<Label> thresholdLabel;
+    ScopedPointer<Label> thresholdOnEditable;
+    ScopedPointer<Label> thresholdOffEditable;
+    ScopedPointer<Label> thresholdUnit;
+
+    ScopedPointer<Label> exportLabel;
+    ScopedPointer<Label> exportEditable;
+    ScopedPointer<Label> exportUnit;
+
     // constants
     static const int WIDTH = 170;
     static const int CONTENT_WIDTH = WIDTH - 7;
@@ -85,9 +161,22 @@ private:
     static const int ROW_LENGTH = CONTENT_WIDTH / BUTTON_WIDTH;
     static const int MARGIN = (CONTENT_WIDTH - ROW_LENGTH * BUTTON_WIDTH) / 2;
     static const int BUTTON_VIEWPORT_HEIGHT = 50;
-
-    const String OUTPUT_TOOLTIP = "Continuous channel to overwrite with the spike rate (meaned over time and selected electrodes)";
-    const String TIME_CONST_TOOLTIP = "Time for the influence of a single spike to decay to 36.8% (1/e) of its initial value (larger = smoother, smaller = faster reaction to changes)";
+    static const int SETTINGS_WIDTH = 140;
+
+    const String OUTPUT_TOOLTIP = "Continuous channel to overwrite with the spike rate (meaned over time and selected electrodes), or whose sample rate to use for added channels";
+    const String ADD_CHANNELS_TOOLTIP = "Output the rate on new continuous channels (in Hz) added after the input channels, instead of overwriting the output channel and those after it";
+    const String MODE_TOOLTIP = "Output the mean rate over all selected electrodes, or the rate of each selected electrode or group on consecutive channels starting at the output channel, or read out the rate of each sorted unit of the selected electrodes as events";
+    const String GROUPS_TOOLTIP = "Electrode groups for group output, e.g. \"1-4; 5, 7\" (groups separated by semicolons, electrodes numbered in button order)";
+    const String UNITS_TOOLTIP = "Maximum number of sorted units whose rate is tracked at once (each has a slot in the rate events until its rate decays to 0; spikes of further units are dropped)";
+    const String BATCH_TOOLTIP = "Collect and sort each buffer's spikes before processing them (required if spikes can arrive out of order, e.g. after a Merger)";
+    const String KERNEL_TOOLTIP = "Shape of the smoothing kernel: exponential decay, a cascade of 2 (alpha), 4 (gamma) or 8 (approx. Gaussian) exponential stages with a mean delay of one time constant, or a count over a sliding window one time constant long";
+    const String READOUT_TOOLTIP = "1: write the rate to the continuous channels on every sample. N > 1: leave the continuous channels untouched and instead send the rate of each output as a float array event every N samples. 0: send it once per buffer";
+    const String NORMALIZE_TOOLTIP = "Keep the sum of the selected electrodes' rates and divide it by their number when it is output, so that selecting or deselecting an electrode changes the divisor from the next buffer on. Otherwise, each spike is divided by the number selected when it arrives, and the output moves to the new mean gradually";
+    const String SMOOTHING_TOOLTIP = "When a time constant is changed, move to the new value gradually over this time (0 = change immediately)";
+    const String THRESHOLD_TOOLTIP = "Exponential kernel only: send a TTL event on one line per output (in output channel order) when its rate rises to the first value (Hz) or above, and when it falls below the second value again. 0 = no TTL events";
+    const String EXPORT_TOOLTIP = "0: off. N > 0: write the rate of each output to the shared memory region /msr-<node ID> every N samples (or with each readout event, if the rate is sent as events), for other processes to read with the msr_reader library";
+    const String THREADS_TOOLTIP = "Number of threads to compute the rates on during acquisition: the electrodes are split between the audio thread and N - 1 worker threads, each pinned to its own CPU, which wait for each buffer by spinning and so keep their CPUs busy while buffers use them (they sleep after 50 ms without work). Only worth it for many electrodes and time constants; small buffers are still computed on the audio thread alone";
+    const String TIME_CONST_TOOLTIP = "Time for the influence of a single spike to decay to 36.8% (1/e) of its initial value (larger = smoother, smaller = faster reaction to changes). Enter several comma-separated values to output the rate at each time constant on consecutive channels";
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MeanSpikeRateEditor);
 };
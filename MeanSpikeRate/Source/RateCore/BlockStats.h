@@ -0,0 +1,185 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BLOCK_STATS_H_INCLUDED
+#define BLOCK_STATS_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/* Optional instrumentation of the plugin's hot path, enabled by building with
+ * MSR_INSTRUMENTATION=1 (the CMake option of the same name). Statements wrapped in
+ * MSR_STATS(...) are only compiled in when it is enabled, so otherwise they cost nothing.
+ */
+#ifndef MSR_INSTRUMENTATION
+#define MSR_INSTRUMENTATION 0
+#endif
+
+#if MSR_INSTRUMENTATION
+#define MSR_STATS(...) __VA_ARGS__
+#else
+#define MSR_STATS(...)
+#endif
+
+/* Per-block processing statistics: wall time (total, maximum and a histogram with
+ * power-of-two microsecond buckets), spikes handled and rejected (from deselected
+ * channels or by a waveform gate), and the longest run of samples filled between
+ * consecutive spikes.
+ *
+ * Written by a single thread (the audio thread) and read by any other without locks:
+ * each counter is an atomic that only the writer updates, with plain loads and stores
+ * rather than read-modify-write operations. A reader may see counters from different
+ * blocks, but each one is consistent. reset must not be called while blocks are being
+ * recorded.
+ */
+class BlockStats
+{
+public:
+    // bucket 0 is < 1 us, bucket k is [2^(k-1), 2^k) us, the last one is everything longer
+    static const int NUM_BUCKETS = 18;
+
+    BlockStats()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        numBlocks.store(0, std::memory_order_relaxed);
+        numSpikes.store(0, std::memory_order_relaxed);
+        numRejected.store(0, std::memory_order_relaxed);
+        maxFillLength.store(0, std::memory_order_relaxed);
+        totalNs.store(0, std::memory_order_relaxed);
+        maxNs.store(0, std::memory_order_relaxed);
+        for (int bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+        {
+            histogram[bucket].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // writer side
+    void addBlock(int64_t ns, int blockSpikes, int blockRejected, int blockMaxFill)
+    {
+        increment(numBlocks, 1);
+        increment(numSpikes, blockSpikes);
+        increment(numRejected, blockRejected);
+        increment(totalNs, ns);
+        increment(histogram[getBucket(ns)], 1);
+
+        if (blockMaxFill > maxFillLength.load(std::memory_order_relaxed))
+        {
+            maxFillLength.store(blockMaxFill, std::memory_order_relaxed);
+        }
+        if (ns > maxNs.load(std::memory_order_relaxed))
+        {
+            maxNs.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    static int getBucket(int64_t ns)
+    {
+        int bucket = 0;
+        for (int64_t us = ns / 1000; us > 0 && bucket < NUM_BUCKETS - 1; us >>= 1)
+        {
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    // reader side
+    uint64_t getNumBlocks() const { return numBlocks.load(std::memory_order_relaxed); }
+    uint64_t getNumSpikes() const { return numSpikes.load(std::memory_order_relaxed); }
+    uint64_t getNumRejected() const { return numRejected.load(std::memory_order_relaxed); }
+    int64_t getMaxFillLength() const { return maxFillLength.load(std::memory_order_relaxed); }
+    int64_t getTotalNs() const { return totalNs.load(std::memory_order_relaxed); }
+    int64_t getMaxNs() const { return maxNs.load(std::memory_order_relaxed); }
+    uint64_t getBucketCount(int bucket) const { return histogram[bucket].load(std::memory_order_relaxed); }
+
+    // multi-line summary for logging
+    std::string toString() const
+    {
+        std::ostringstream out;
+        uint64_t blocks = getNumBlocks();
+        out << blocks << " blocks, " << getNumSpikes() << " spikes handled, " << getNumRejected()
+            << " rejected (channel not selected or gated), longest fill between spikes " << getMaxFillLength() << " samples\n";
+        out << "block time: mean " << (blocks > 0 ? getTotalNs() / 1000.0 / blocks : 0.0)
+            << " us, max " << getMaxNs() / 1000.0 << " us\n";
+
+        for (int bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+        {
+            uint64_t count = getBucketCount(bucket);
+            if (count == 0)
+            {
+                continue;
+            }
+
+            out << "  ";
+            if (bucket == 0)
+            {
+                out << "< 1";
+            }
+            else if (bucket == NUM_BUCKETS - 1)
+            {
+                out << ">= " << (1 << (bucket - 1));
+            }
+            else
+            {
+                out << (1 << (bucket - 1)) << "-" << (1 << bucket);
+            }
+            out << " us: " << count << "\n";
+        }
+        return out.str();
+    }
+
+private:
+    template <typename T>
+    static void increment(std::atomic<T>& counter, T amount)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static void increment(std::atomic<uint64_t>& counter, int amount)
+    {
+        increment<uint64_t>(counter, static_cast<uint64_t>(amount));
+    }
+
+    std::atomic<uint64_t> numBlocks;
+    std::atomic<uint64_t> numSpikes;
+    std::atomic<uint64_t> numRejected;
+    std::atomic<int64_t> maxFillLength;
+    std::atomic<int64_t> totalNs;
+    std::atomic<int64_t> maxNs;
+    std::atomic<uint64_t> histogram[NUM_BUCKETS];
+};
+
+// for timing blocks with MSR_STATS
+inline int64_t getStatsTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // BLOCK_STATS_H_INCLUDED
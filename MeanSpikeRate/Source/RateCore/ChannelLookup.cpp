@@ -0,0 +1,105 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ChannelLookup.h"
+
+ChannelLookup::ChannelLookup()
+    : mask(0)
+{}
+
+void ChannelLookup::build(const uint64_t* keys, int numKeys)
+{
+    // keep the load factor at or below 1/2
+    size_t capacity = 4;
+    while (capacity < static_cast<size_t>(numKeys) * 2)
+    {
+        capacity *= 2;
+    }
+
+    Slot empty = { 0, -1 };
+    slots.assign(capacity, empty);
+    mask = capacity - 1;
+
+    for (int kKey = 0; kKey < numKeys; ++kKey)
+    {
+        uint64_t slot = hash(keys[kKey]) & mask;
+        while (slots[slot].index != -1 && slots[slot].key != keys[kKey])
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        if (slots[slot].index != -1)
+        {
+            continue; // repeated key
+        }
+        slots[slot].key = keys[kKey];
+        slots[slot].index = kKey;
+    }
+}
+
+void ChannelLookup::clear()
+{
+    slots.clear();
+    mask = 0;
+}
+
+int ChannelLookup::find(uint64_t key) const
+{
+    if (slots.empty())
+    {
+        return -1;
+    }
+
+    for (uint64_t slot = hash(key) & mask; ; slot = (slot + 1) & mask)
+    {
+        const Slot& s = slots[slot];
+        if (s.index == -1 || s.key == key)
+        {
+            return s.index;
+        }
+    }
+}
+
+uint64_t ChannelLookup::keyForName(const char* name, size_t length)
+{
+    uint64_t key = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; ++i)
+    {
+        key ^= static_cast<unsigned char>(name[i]);
+        key *= 0x100000001b3ULL;
+    }
+    return key;
+}
+
+// private
+
+uint64_t ChannelLookup::hash(uint64_t key)
+{
+    // splitmix64 finalizer - pointers have low entropy in the low bits
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
@@ -0,0 +1,71 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CHANNEL_LOOKUP_H_INCLUDED
+#define CHANNEL_LOOKUP_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Maps 64-bit channel keys (e.g. SpikeChannel pointers) to channel indices using an
+ * open-addressing hash table. The table is built once (allocating) and then queried
+ * without any allocation, so find() is safe to use on the audio thread.
+ *
+ * Also used on the message thread to match channels across signal chain updates by a
+ * key that stays the same (keyForName), which keeps that linear in the number of channels.
+ */
+class ChannelLookup
+{
+public:
+    ChannelLookup();
+
+    // index i of the lookup corresponds to keys[i]; if a key repeats, the first index is found
+    void build(const uint64_t* keys, int numKeys);
+    void clear();
+
+    // returns -1 if the key is not in the table
+    int find(uint64_t key) const;
+
+    static uint64_t keyFor(const void* ptr)
+    {
+        return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+    }
+
+    // 64-bit FNV-1a hash of a channel name (distinct names colliding is negligibly unlikely)
+    static uint64_t keyForName(const char* name, size_t length);
+
+private:
+    static uint64_t hash(uint64_t key);
+
+    struct Slot
+    {
+        uint64_t key;
+        int index;         // -1 = empty
+    };
+
+    std::vector<Slot> slots;
+    uint64_t mask;
+};
+
+#endif // CHANNEL_LOOKUP_H_INCLUDED
@@ -0,0 +1,240 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ChannelSelection.h"
+#include "ChannelLookup.h"
+#include <algorithm>
+
+ChannelSelection::ChannelSelection()
+    : numChannels   (0)
+    , numEnabled    (0)
+    , numGroups     (0)
+    , version       (0)
+{}
+
+void ChannelSelection::resize(int newNumChannels, bool enabledByDefault)
+{
+    numChannels = newNumChannels > 0 ? newNumChannels : 0;
+    int numWords = (numChannels + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    words.reset(numWords > 0 ? new std::atomic<uint32_t>[numWords] : nullptr);
+
+    for (int kWord = 0; kWord < numWords; ++kWord)
+    {
+        uint32_t bits = 0;
+        if (enabledByDefault)
+        {
+            int bitsInWord = numChannels - kWord * BITS_PER_WORD;
+            bits = bitsInWord >= BITS_PER_WORD ? ~uint32_t(0) : (uint32_t(1) << bitsInWord) - 1;
+        }
+        words[kWord].store(bits, std::memory_order_relaxed);
+    }
+
+    weights.reset(numChannels > 0 ? new std::atomic<float>[numChannels] : nullptr);
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        weights[channel].store(1.0f, std::memory_order_relaxed);
+    }
+
+    // no groups until they are set again
+    channelGroups.reset(numChannels > 0 ? new int[numChannels] : nullptr);
+    std::fill(channelGroups.get(), channelGroups.get() + numChannels, -1);
+    groupNumEnabled.reset();
+    groupTotalWeights.reset();
+    numGroups = 0;
+
+    numEnabled.store(enabledByDefault ? numChannels : 0, std::memory_order_release);
+    version.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void ChannelSelection::remap(const uint64_t* oldKeys, const uint64_t* newKeys, int numNewChannels,
+    std::vector<int>& oldIndices)
+{
+    // keys are looked up rather than searched for, so that this stays linear with thousands of channels
+    ChannelLookup oldLookup;
+    oldLookup.build(oldKeys, numChannels);
+
+    int numNew = numNewChannels > 0 ? numNewChannels : 0;
+    oldIndices.resize(numNew);
+    std::vector<char> newEnabled(numNew);
+    std::vector<float> newWeights(numNew);
+    for (int channel = 0; channel < numNew; ++channel)
+    {
+        int oldIndex = oldLookup.find(newKeys[channel]);
+        oldIndices[channel] = oldIndex;
+        newEnabled[channel] = oldIndex == -1 || isEnabled(oldIndex);
+        newWeights[channel] = oldIndex == -1 ? 1.0f : getWeight(oldIndex);
+    }
+
+    resize(numNew);
+    for (int channel = 0; channel < numNew; ++channel)
+    {
+        setEnabled(channel, newEnabled[channel] != 0);
+        setWeight(channel, newWeights[channel]);
+    }
+}
+
+int ChannelSelection::size() const
+{
+    return numChannels;
+}
+
+bool ChannelSelection::setEnabled(int channel, bool enabled)
+{
+    if (channel < 0 || channel >= numChannels)
+    {
+        return false;
+    }
+
+    uint32_t mask = uint32_t(1) << (channel % BITS_PER_WORD);
+    std::atomic<uint32_t>& word = words[channel / BITS_PER_WORD];
+
+    uint32_t oldBits = enabled
+        ? word.fetch_or(mask, std::memory_order_acq_rel)
+        : word.fetch_and(~mask, std::memory_order_acq_rel);
+
+    bool wasEnabled = (oldBits & mask) != 0;
+    if (wasEnabled == enabled)
+    {
+        return false;
+    }
+
+    int change = enabled ? 1 : -1;
+    int group = channelGroups[channel];
+    if (group != -1)
+    {
+        int groupCount = groupNumEnabled[group].fetch_add(change, std::memory_order_acq_rel) + change;
+        addToTotalWeight(group, groupCount, change * weights[channel].load(std::memory_order_relaxed));
+    }
+    numEnabled.fetch_add(change, std::memory_order_acq_rel);
+    version.fetch_add(1, std::memory_order_acq_rel);
+    return true;
+}
+
+bool ChannelSelection::isEnabled(int channel) const
+{
+    if (channel < 0 || channel >= numChannels)
+    {
+        return false;
+    }
+
+    uint32_t mask = uint32_t(1) << (channel % BITS_PER_WORD);
+    return (words[channel / BITS_PER_WORD].load(std::memory_order_acquire) & mask) != 0;
+}
+
+int ChannelSelection::getNumEnabled() const
+{
+    return numEnabled.load(std::memory_order_acquire);
+}
+
+bool ChannelSelection::setWeight(int channel, float weight)
+{
+    if (channel < 0 || channel >= numChannels || !(weight >= 0))
+    {
+        return false;
+    }
+
+    float oldWeight = weights[channel].exchange(weight, std::memory_order_acq_rel);
+    if (oldWeight == weight)
+    {
+        return false;
+    }
+
+    int group = channelGroups[channel];
+    if (group != -1 && isEnabled(channel))
+    {
+        addToTotalWeight(group, groupNumEnabled[group].load(std::memory_order_relaxed), static_cast<double>(weight) - oldWeight);
+    }
+    version.fetch_add(1, std::memory_order_acq_rel);
+    return true;
+}
+
+float ChannelSelection::getWeight(int channel) const
+{
+    if (channel < 0 || channel >= numChannels)
+    {
+        return 0.0f;
+    }
+    return weights[channel].load(std::memory_order_acquire);
+}
+
+void ChannelSelection::setGroups(const int* newChannelGroups, int newNumGroups)
+{
+    numGroups = newNumGroups > 0 ? newNumGroups : 0;
+    groupNumEnabled.reset(numGroups > 0 ? new std::atomic<int>[numGroups] : nullptr);
+    groupTotalWeights.reset(numGroups > 0 ? new std::atomic<double>[numGroups] : nullptr);
+    for (int group = 0; group < numGroups; ++group)
+    {
+        groupNumEnabled[group].store(0, std::memory_order_relaxed);
+        groupTotalWeights[group].store(0.0, std::memory_order_relaxed);
+    }
+
+    // count the channels that are already enabled
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        int group = newChannelGroups[channel];
+        channelGroups[channel] = group >= 0 && group < numGroups ? group : -1;
+        if (channelGroups[channel] != -1 && isEnabled(channel))
+        {
+            groupNumEnabled[group].fetch_add(1, std::memory_order_relaxed);
+            groupTotalWeights[group].store(groupTotalWeights[group].load(std::memory_order_relaxed)
+                + weights[channel].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    version.fetch_add(1, std::memory_order_acq_rel);
+}
+
+int ChannelSelection::getNumGroups() const
+{
+    return numGroups;
+}
+
+int ChannelSelection::getNumEnabled(int group) const
+{
+    if (group < 0 || group >= numGroups)
+    {
+        return 0;
+    }
+    return groupNumEnabled[group].load(std::memory_order_acquire);
+}
+
+void ChannelSelection::addToTotalWeight(int group, int groupCount, double delta)
+{
+    // the total is updated incrementally, so reset it exactly when the group is empty
+    double total = groupCount > 0 ? groupTotalWeights[group].load(std::memory_order_relaxed) + delta : 0.0;
+    groupTotalWeights[group].store(total, std::memory_order_release);
+}
+
+double ChannelSelection::getTotalWeight(int group) const
+{
+    if (group < 0 || group >= numGroups)
+    {
+        return 0.0;
+    }
+    return groupTotalWeights[group].load(std::memory_order_acquire);
+}
+
+unsigned ChannelSelection::getVersion() const
+{
+    return version.load(std::memory_order_acquire);
+}
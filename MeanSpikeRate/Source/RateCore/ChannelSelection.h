@@ -0,0 +1,101 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CHANNEL_SELECTION_H_INCLUDED
+#define CHANNEL_SELECTION_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* Set of enabled spike channels, stored as a bitset of atomic words plus a count
+ * of enabled channels, along with a weight for each channel. Individual channels can be
+ * toggled and reweighted from one thread (e.g. the message thread) while another (the
+ * audio thread) reads the set, without locks.
+ *
+ * Channels can also be assigned to groups (e.g. the estimator source they feed into),
+ * whose counts and total weights of enabled channels are kept up to date on each change,
+ * so reading them doesn't need a scan over the channels.
+ *
+ * resize() and setGroups() reallocate and must not be called concurrently with any other
+ * method (in the plugin they are only called from updateSettings, while not acquiring).
+ */
+class ChannelSelection
+{
+public:
+    ChannelSelection();
+
+    // resets to numChannels channels, all set to enabledByDefault with a weight of 1
+    void resize(int numChannels, bool enabledByDefault = true);
+
+    // resizes to the channels identified by newKeys, carrying over the enabled state and weight of each
+    // current channel (identified by oldKeys, one per channel) whose key is among them. other channels are
+    // enabled with a weight of 1. oldIndices receives the current index of each new channel (-1 if it is
+    // new), for carrying over other settings. reallocates, like resize().
+    void remap(const uint64_t* oldKeys, const uint64_t* newKeys, int numNewChannels, std::vector<int>& oldIndices);
+    int size() const;
+
+    // returns true if the state of the channel changed
+    bool setEnabled(int channel, bool enabled);
+    bool isEnabled(int channel) const;
+
+    int getNumEnabled() const;
+
+    // weight of the channel's spikes (>= 0), whether or not it is enabled. returns true if it changed.
+    bool setWeight(int channel, float weight);
+    float getWeight(int channel) const;
+
+    // assigns channel k to group channelGroups[k] (in [0, numGroups), or -1 for none)
+    void setGroups(const int* channelGroups, int numGroups);
+    int getNumGroups() const;
+
+    // number of enabled channels in a group
+    int getNumEnabled(int group) const;
+
+    // sum of the weights of the enabled channels in a group
+    double getTotalWeight(int group) const;
+
+    // incremented on every change, so readers can tell when to update anything derived from the selection
+    unsigned getVersion() const;
+
+private:
+    static const int BITS_PER_WORD = 32;
+
+    // adds delta to a group's total weight, given its number of enabled channels after the change
+    void addToTotalWeight(int group, int groupNumEnabled, double delta);
+
+    std::unique_ptr<std::atomic<uint32_t>[]> words;
+    int numChannels;
+    std::atomic<int> numEnabled;
+    std::unique_ptr<std::atomic<float>[]> weights;
+
+    // (the totals are only written by the one thread that changes the selection)
+    std::unique_ptr<int[]> channelGroups;
+    std::unique_ptr<std::atomic<int>[]> groupNumEnabled;
+    std::unique_ptr<std::atomic<double>[]> groupTotalWeights;
+    int numGroups;
+    std::atomic<unsigned> version;
+};
+
+#endif // CHANNEL_SELECTION_H_INCLUDED
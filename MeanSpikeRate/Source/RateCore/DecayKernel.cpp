@@ -0,0 +1,234 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "DecayKernel.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MSR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MSR_TARGET_AVX2
+#else
+#define MSR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define MSR_X86 0
+#endif
+
+namespace
+{
+    void scaleScalar(float* out, const float* powers, float start, int n)
+    {
+        for (int k = 0; k < n; ++k)
+        {
+            out[k] = start * powers[k];
+        }
+    }
+
+#if MSR_X86
+    void scaleSSE(float* out, const float* powers, float start, int n)
+    {
+        __m128 vStart = _mm_set1_ps(start);
+        int k = 0;
+        for (; k + 4 <= n; k += 4)
+        {
+            _mm_storeu_ps(out + k, _mm_mul_ps(vStart, _mm_loadu_ps(powers + k)));
+        }
+        scaleScalar(out + k, powers + k, start, n - k);
+    }
+
+    MSR_TARGET_AVX2
+    void scaleAVX2(float* out, const float* powers, float start, int n)
+    {
+        __m256 vStart = _mm256_set1_ps(start);
+        int k = 0;
+        for (; k + 8 <= n; k += 8)
+        {
+            _mm256_storeu_ps(out + k, _mm256_mul_ps(vStart, _mm256_loadu_ps(powers + k)));
+        }
+        scaleScalar(out + k, powers + k, start, n - k);
+    }
+
+    bool cpuHasAVX2()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif // MSR_X86
+
+    DecayKernel::Path detectBestPath()
+    {
+#if MSR_X86
+        if (cpuHasAVX2())
+        {
+            return DecayKernel::AVX2;
+        }
+        return DecayKernel::SSE; // baseline on x86-64
+#else
+        return DecayKernel::SCALAR;
+#endif
+    }
+}
+
+DecayKernel::Path DecayKernel::getBestPath()
+{
+    static const Path bestPath = detectBestPath();
+    return bestPath;
+}
+
+bool DecayKernel::isPathSupported(Path path)
+{
+    return path <= getBestPath();
+}
+
+const char* DecayKernel::getPathName(Path path)
+{
+    switch (path)
+    {
+    case SSE:
+        return "SSE";
+
+    case AVX2:
+        return "AVX2";
+
+    default:
+        return "scalar";
+    }
+}
+
+void DecayKernel::scale(float* out, const float* powers, float start, int n)
+{
+    scale(out, powers, start, n, getBestPath());
+}
+
+void DecayKernel::scale(float* out, const float* powers, float start, int n, Path path)
+{
+    switch (path)
+    {
+#if MSR_X86
+    case AVX2:
+        scaleAVX2(out, powers, start, n);
+        break;
+
+    case SSE:
+        scaleSSE(out, powers, start, n);
+        break;
+#endif
+
+    default:
+        scaleScalar(out, powers, start, n);
+        break;
+    }
+}
+
+/*** DecayPowerTable ***/
+
+DecayPowerTable::DecayPowerTable()
+    : decay (-1.0)
+    , exact (false)
+{
+    setDecay(1.0);
+}
+
+void DecayPowerTable::setDecay(double decayPerSample, bool newExact)
+{
+    if (decayPerSample == decay && (exact || !newExact))
+    {
+        return;
+    }
+
+    // if exact, each power is computed directly rather than by repeated multiplication, so that
+    // the table has no accumulated error to compound as it is applied run after run
+    decay = decayPerSample;
+    exact = newExact;
+    powers[0] = 1.0;
+    for (int k = 1; k <= SIZE; ++k)
+    {
+        powers[k] = exact ? std::pow(decay, k) : powers[k - 1] * decay;
+    }
+    for (int k = 0; k < SIZE; ++k)
+    {
+        floatPowers[k] = static_cast<float>(powers[k]);
+    }
+}
+
+double DecayPowerTable::getDecay() const
+{
+    return decay;
+}
+
+bool DecayPowerTable::isExact() const
+{
+    return exact;
+}
+
+void DecayPowerTable::computeFractionalPowers(double decay, int numSteps, double* out, bool exact)
+{
+    double step = exact ? 0.0 : std::pow(decay, 1.0 / numSteps);
+    out[0] = 1.0;
+    for (int k = 1; k < numSteps; ++k)
+    {
+        out[k] = exact ? std::pow(decay, double(k) / numSteps) : out[k - 1] * step;
+    }
+}
+
+double DecayPowerTable::getPower(long long n) const
+{
+    if (n <= SIZE)
+    {
+        return powers[n];
+    }
+    return powers[n % SIZE] * std::pow(powers[SIZE], static_cast<double>(n / SIZE));
+}
+
+double DecayPowerTable::fill(float* out, int n, double start, double outputScale) const
+{
+    while (n > 0)
+    {
+        int chunk = n < SIZE ? n : SIZE;
+        DecayKernel::scale(out, floatPowers, static_cast<float>(start * outputScale), chunk);
+        start *= powers[chunk];
+        out += chunk;
+        n -= chunk;
+    }
+    return start;
+}
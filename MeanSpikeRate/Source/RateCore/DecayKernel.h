@@ -0,0 +1,95 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef DECAY_KERNEL_H_INCLUDED
+#define DECAY_KERNEL_H_INCLUDED
+
+/* Fills runs of exponentially decaying samples without a loop-carried multiply.
+ *
+ * Instead of the serial recurrence out[k] = x; x *= decay, a run of length n starting
+ * at value x0 is computed in closed form as out[k] = x0 * decay^k, using a table of
+ * powers of decay. Each output sample is then independent and the multiply is done
+ * with AVX2 or SSE where available (selected at runtime), or a scalar loop otherwise.
+ *
+ * Accuracy: each output sample is within 3 float ulps (relative error < 2e-7) of the
+ * exact value x0 * decay^k. The serial float recurrence accumulates one rounding per
+ * sample, so the two differ by at most about (k + 3) ulps at offset k into a run.
+ */
+
+class DecayKernel
+{
+public:
+    enum Path
+    {
+        SCALAR,
+        SSE,
+        AVX2
+    };
+
+    // the fastest path supported by this CPU (detected once)
+    static Path getBestPath();
+    static bool isPathSupported(Path path);
+    static const char* getPathName(Path path);
+
+    // out[k] = start * powers[k] for k in [0, n)
+    static void scale(float* out, const float* powers, float start, int n);
+    static void scale(float* out, const float* powers, float start, int n, Path path);
+};
+
+/* Table of powers of a decay factor, recomputed only when the factor changes (each
+ * entry to within an ulp of the exact power).
+ *
+ * While the factor changes every block (e.g. during a TimeConstRamp), the table can be
+ * updated approximately instead: by repeated multiplication, which is several times
+ * cheaper than a pow per entry, with each entry within about 1e-13 (relative) of the
+ * exact power. It is recomputed exactly once the factor is set with exact = true.
+ */
+class DecayPowerTable
+{
+public:
+    // runs longer than this are filled in chunks
+    static const int SIZE = 2048;
+
+    DecayPowerTable();
+
+    void setDecay(double decayPerSample, bool exact = true);
+    double getDecay() const;
+    bool isExact() const;
+
+    // out[k] = decay^(k / numSteps) for k in [0, numSteps), approximately if not exact (as above)
+    static void computeFractionalPowers(double decay, int numSteps, double* out, bool exact = true);
+
+    // decay^n for any n >= 0
+    double getPower(long long n) const;
+
+    // out[k] = start * decay^k * outputScale for k in [0, n); returns start * decay^n
+    double fill(float* out, int n, double start, double outputScale = 1.0) const;
+
+private:
+    double decay;
+    bool exact;
+    float floatPowers[SIZE];       // decay^k, k in [0, SIZE)
+    double powers[SIZE + 1];       // decay^k, k in [0, SIZE]
+};
+
+#endif // DECAY_KERNEL_H_INCLUDED
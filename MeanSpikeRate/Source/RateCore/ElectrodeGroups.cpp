@@ -0,0 +1,163 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ElectrodeGroups.h"
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+namespace
+{
+    std::string trim(const std::string& str)
+    {
+        size_t start = str.find_first_not_of(" \t");
+        if (start == std::string::npos)
+        {
+            return "";
+        }
+        size_t end = str.find_last_not_of(" \t");
+        return str.substr(start, end - start + 1);
+    }
+
+    // parses a positive integer that makes up the whole string
+    bool parsePositiveInt(const std::string& str, int* out)
+    {
+        std::string trimmed = trim(str);
+        if (trimmed.empty())
+        {
+            return false;
+        }
+        for (char c : trimmed)
+        {
+            if (!std::isdigit(static_cast<unsigned char>(c)))
+            {
+                return false;
+            }
+        }
+        *out = std::atoi(trimmed.c_str());
+        return *out > 0;
+    }
+
+    std::vector<std::string> split(const std::string& str, char delim)
+    {
+        std::vector<std::string> parts;
+        std::stringstream stream(str);
+        std::string part;
+        while (std::getline(stream, part, delim))
+        {
+            parts.push_back(part);
+        }
+        return parts;
+    }
+}
+
+bool ElectrodeGroups::parse(const std::string& spec)
+{
+    std::vector<std::vector<int>> newGroups;
+
+    for (const std::string& groupSpec : split(spec, ';'))
+    {
+        if (trim(groupSpec).empty())
+        {
+            continue;
+        }
+
+        std::vector<int> group;
+        for (const std::string& item : split(groupSpec, ','))
+        {
+            size_t dash = item.find('-');
+            int first, last;
+            if (dash == std::string::npos)
+            {
+                if (!parsePositiveInt(item, &first))
+                {
+                    return false;
+                }
+                last = first;
+            }
+            else if (!parsePositiveInt(item.substr(0, dash), &first)
+                || !parsePositiveInt(item.substr(dash + 1), &last) || last < first)
+            {
+                return false;
+            }
+
+            for (int chan = first; chan <= last; ++chan)
+            {
+                group.push_back(chan - 1);
+            }
+        }
+
+        if (!group.empty())
+        {
+            newGroups.push_back(group);
+        }
+    }
+
+    groups.swap(newGroups);
+    return true;
+}
+
+std::string ElectrodeGroups::toString() const
+{
+    std::ostringstream out;
+    for (size_t kGroup = 0; kGroup < groups.size(); ++kGroup)
+    {
+        if (kGroup > 0)
+        {
+            out << "; ";
+        }
+
+        const std::vector<int>& group = groups[kGroup];
+        for (size_t k = 0; k < group.size(); ++k)
+        {
+            // collapse consecutive channels into ranges
+            size_t end = k;
+            while (end + 1 < group.size() && group[end + 1] == group[end] + 1)
+            {
+                ++end;
+            }
+
+            if (k > 0)
+            {
+                out << ",";
+            }
+            out << group[k] + 1;
+            if (end > k)
+            {
+                out << "-" << group[end] + 1;
+            }
+            k = end;
+        }
+    }
+    return out.str();
+}
+
+int ElectrodeGroups::getNumGroups() const
+{
+    return static_cast<int>(groups.size());
+}
+
+const std::vector<int>& ElectrodeGroups::getGroup(int group) const
+{
+    return groups[group];
+}
@@ -0,0 +1,53 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ELECTRODE_GROUPS_H_INCLUDED
+#define ELECTRODE_GROUPS_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+/* User-defined groups of electrodes (spike channels) to average over.
+ *
+ * Groups are written as a list separated by semicolons, each group being a comma-separated
+ * list of 1-based spike channel numbers or ranges, e.g. "1-4; 5, 7, 9-12".
+ */
+class ElectrodeGroups
+{
+public:
+    // returns false (leaving the groups unchanged) if the spec can't be parsed
+    bool parse(const std::string& spec);
+
+    // normalized version of the spec
+    std::string toString() const;
+
+    int getNumGroups() const;
+
+    // 0-based channel indices in the given group
+    const std::vector<int>& getGroup(int group) const;
+
+private:
+    std::vector<std::vector<int>> groups;
+};
+
+#endif // ELECTRODE_GROUPS_H_INCLUDED
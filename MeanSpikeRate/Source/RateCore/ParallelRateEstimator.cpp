@@ -0,0 +1,490 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ParallelRateEstimator.h"
+#include <algorithm>
+#include <cassert>
+
+ParallelRateEstimator::ParallelRateEstimator()
+    : numThreads            (1)
+    , numSources            (1)
+    , numTimeConsts         (1)
+    , sourcesPerPartition   (1)
+    , kernelType            (KERNEL_EXPONENTIAL)
+    , spikeCapacity         (16384)
+    , readoutCapacity       (0)
+    , maxRate               (RateEstimator::DEFAULT_MAX_RATE)
+    , numDropped            (0)
+    , minWorkPerThread      (DEFAULT_MIN_WORK_PER_THREAD)
+    , numThreadsUsed        (1)
+    , thresholdEnabled      (false)
+    , thresholdOn           (0)
+    , thresholdOff          (0)
+    , blockOutputs          (nullptr)
+    , blockSize             (0)
+    , blockJob              (*this)
+{
+    updatePartitions();
+}
+
+void ParallelRateEstimator::setNumThreads(int newNumThreads)
+{
+    assert(newNumThreads >= 1 && newNumThreads <= WorkerPool::MAX_WORKERS + 1);
+
+    numThreads = newNumThreads;
+    updatePartitions();
+
+    if (areWorkersRunning())
+    {
+        startWorkers();
+    }
+}
+
+int ParallelRateEstimator::getNumThreads() const
+{
+    return numThreads;
+}
+
+void ParallelRateEstimator::startWorkers()
+{
+    if (numThreads > 1)
+    {
+        pool.start(numThreads - 1);
+    }
+    else
+    {
+        pool.stop();
+    }
+}
+
+void ParallelRateEstimator::stopWorkers()
+{
+    pool.stop();
+}
+
+bool ParallelRateEstimator::areWorkersRunning() const
+{
+    return pool.getNumWorkers() > 0;
+}
+
+void ParallelRateEstimator::setMinWorkPerThread(long long work)
+{
+    minWorkPerThread = std::max(1LL, work);
+}
+
+int ParallelRateEstimator::getNumThreadsUsed() const
+{
+    return numThreadsUsed;
+}
+
+void ParallelRateEstimator::setSpikeCapacity(int capacity)
+{
+    spikeCapacity = capacity;
+    for (Partition& partition : partitions)
+    {
+        partition.spikes.setCapacity(isPartitioned() ? spikeCapacity : 0);
+    }
+}
+
+void ParallelRateEstimator::setReadoutCapacity(int maxReadouts)
+{
+    readoutCapacity = std::max(0, maxReadouts);
+    for (Partition& partition : partitions)
+    {
+        // (a single partition reads out straight into the caller's readouts)
+        size_t readoutSize = static_cast<size_t>(readoutCapacity) * partition.numSources * numTimeConsts;
+        partition.readouts.assign(isPartitioned() ? readoutSize : 0, 0.0f);
+        partition.estimator.setReadoutCapacity(readoutCapacity);
+    }
+}
+
+int ParallelRateEstimator::getAndResetNumDropped()
+{
+    int dropped = numDropped;
+    numDropped = 0;
+    for (Partition& partition : partitions)
+    {
+        dropped += partition.spikes.getAndResetNumDropped() + partition.estimator.getAndResetNumDropped();
+    }
+    return dropped;
+}
+
+void ParallelRateEstimator::setKernel(RateKernelType type)
+{
+    kernelType = type;
+    for (Partition& partition : partitions)
+    {
+        partition.estimator.setKernel(type);
+    }
+
+    // (new engines start without a threshold, as in RateEstimator)
+    thresholdEnabled = false;
+    thresholdOn = 0;
+    thresholdOff = 0;
+    crossings.clear();
+}
+
+RateKernelType ParallelRateEstimator::getKernel() const
+{
+    return partitions[0].estimator.getKernel();
+}
+
+void ParallelRateEstimator::setNumStates(int newNumSources, int newNumTimeConsts)
+{
+    assert(newNumSources >= 0 && newNumTimeConsts > 0);
+
+    numSources = newNumSources;
+    numTimeConsts = newNumTimeConsts;
+    updatePartitions();
+}
+
+int ParallelRateEstimator::getNumStates() const
+{
+    return numSources * numTimeConsts;
+}
+
+int ParallelRateEstimator::getNumSources() const
+{
+    return numSources;
+}
+
+int ParallelRateEstimator::getNumTimeConsts() const
+{
+    return numTimeConsts;
+}
+
+void ParallelRateEstimator::setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping)
+{
+    for (Partition& partition : partitions)
+    {
+        partition.estimator.setTimeConstant(timeConst, timeConstMs, sampleRate, ramping);
+    }
+}
+
+void ParallelRateEstimator::setTimeConstant(double timeConstMs, double sampleRate)
+{
+    for (Partition& partition : partitions)
+    {
+        partition.estimator.setTimeConstant(timeConstMs, sampleRate);
+    }
+}
+
+void ParallelRateEstimator::setSourceGain(int source, double gain)
+{
+    Partition& partition = partitions[getPartitionOf(source)];
+    partition.estimator.setSourceGain(source - partition.firstSource, gain);
+}
+
+void ParallelRateEstimator::setSourceOutputScale(int source, double scale)
+{
+    Partition& partition = partitions[getPartitionOf(source)];
+    partition.estimator.setSourceOutputScale(source - partition.firstSource, scale);
+}
+
+void ParallelRateEstimator::setMaxRate(double maxRateHz)
+{
+    maxRate = maxRateHz;
+    for (Partition& partition : partitions)
+    {
+        partition.estimator.setMaxRate(maxRate);
+    }
+}
+
+void ParallelRateEstimator::processBlock(float* const* outputs, int numSamples, const SpikeBatch& batch)
+{
+    if (!isPartitioned())
+    {
+        partitions[0].estimator.processBlock(outputs, numSamples, batch);
+        numThreadsUsed = 1;
+        return;
+    }
+
+    bucketSpikes(batch);
+    runBlock(outputs, numSamples, -1, 0, nullptr);
+}
+
+int ParallelRateEstimator::processBlockReadout(float* const* outputs, int numSamples, const SpikeBatch& batch,
+    int firstReadout, int readoutInterval, float* readouts)
+{
+    assert(readoutInterval > 0);
+
+    if (!isPartitioned())
+    {
+        numThreadsUsed = 1;
+        return partitions[0].estimator.processBlockReadout(outputs, numSamples, batch, firstReadout,
+            readoutInterval, readouts);
+    }
+
+    bucketSpikes(batch);
+    runBlock(outputs, numSamples, firstReadout, readoutInterval, readouts);
+    return partitions[0].numReadouts;
+}
+
+void ParallelRateEstimator::startBlock(float* const* outputs, int numSamples)
+{
+    if (!isPartitioned())
+    {
+        partitions[0].estimator.startBlock(outputs, numSamples);
+        return;
+    }
+
+    blockOutputs = outputs;
+    blockSize = numSamples;
+    for (Partition& partition : partitions)
+    {
+        partition.spikes.clear();
+    }
+}
+
+void ParallelRateEstimator::addSpike(int source, int samplePosition, int subSample, float weight)
+{
+    if (!isPartitioned())
+    {
+        partitions[0].estimator.addSpike(source, samplePosition, subSample, weight);
+        return;
+    }
+
+    Partition& partition = partitions[getPartitionOf(source)];
+    partition.spikes.add(samplePosition, source - partition.firstSource, subSample, weight);
+}
+
+void ParallelRateEstimator::finishBlock()
+{
+    if (!isPartitioned())
+    {
+        partitions[0].estimator.finishBlock();
+        numThreadsUsed = 1;
+        return;
+    }
+
+    runBlock(blockOutputs, blockSize, -1, 0, nullptr);
+    blockOutputs = nullptr;
+}
+
+bool ParallelRateEstimator::setThreshold(double onLevel, double offLevel)
+{
+    bool supported = true;
+    for (Partition& partition : partitions)
+    {
+        supported &= partition.estimator.setThreshold(onLevel, offLevel);
+    }
+
+    thresholdEnabled = onLevel > 0 && supported;
+    thresholdOn = onLevel;
+    thresholdOff = offLevel;
+    return supported;
+}
+
+const std::vector<ThresholdCrossing>& ParallelRateEstimator::getCrossings() const
+{
+    return isPartitioned() ? crossings : partitions[0].estimator.getCrossings();
+}
+
+double ParallelRateEstimator::getMean(int state) const
+{
+    if (numSources == 0)
+    {
+        return 0;
+    }
+
+    int timeConst = state / numSources;
+    int source = state % numSources;
+    const Partition& partition = partitions[getPartitionOf(source)];
+    return partition.estimator.getMean(timeConst * partition.numSources + source - partition.firstSource);
+}
+
+void ParallelRateEstimator::reset()
+{
+    for (Partition& partition : partitions)
+    {
+        partition.estimator.reset();
+    }
+    crossings.clear();
+}
+
+// private
+
+ParallelRateEstimator::BlockJob::BlockJob(ParallelRateEstimator& owner)
+    : numThreads        (1)
+    , outputs           (nullptr)
+    , numSamples        (0)
+    , firstReadout      (-1)
+    , readoutInterval   (0)
+    , readouts          (nullptr)
+    , owner             (owner)
+{}
+
+void ParallelRateEstimator::BlockJob::runPart(int part)
+{
+    // partitions are dealt out round-robin, in case there are more than threads
+    int numPartitions = static_cast<int>(owner.partitions.size());
+    for (int index = part; index < numPartitions; index += numThreads)
+    {
+        owner.processPartition(index, *this);
+    }
+}
+
+void ParallelRateEstimator::updatePartitions()
+{
+    // contiguous ranges of sources, with none left empty
+    int numPartitions = std::max(1, std::min(numThreads, numSources));
+    sourcesPerPartition = std::max(1, (numSources + numPartitions - 1) / numPartitions);
+    numPartitions = std::max(1, (numSources + sourcesPerPartition - 1) / sourcesPerPartition);
+
+    partitions.clear();
+    partitions.resize(numPartitions);
+    for (int index = 0; index < numPartitions; ++index)
+    {
+        Partition& partition = partitions[index];
+        partition.firstSource = index * sourcesPerPartition;
+        partition.numSources = std::min(sourcesPerPartition, numSources - partition.firstSource);
+        partition.numReadouts = 0;
+        partition.estimator.setKernel(kernelType);
+        partition.estimator.setMaxRate(maxRate);
+        partition.estimator.setNumStates(std::max(0, partition.numSources), numTimeConsts);
+        partition.estimator.setThreshold(thresholdEnabled ? thresholdOn : 0, thresholdOff);
+        partition.outputs.assign(partition.numSources * numTimeConsts, nullptr);
+    }
+    setSpikeCapacity(spikeCapacity);
+    setReadoutCapacity(readoutCapacity);
+
+    crossings.clear();
+    crossings.reserve(isPartitioned() ? numPartitions * RateEngine<ExponentialKernel>::MAX_CROSSINGS : 0);
+}
+
+int ParallelRateEstimator::getPartitionOf(int source) const
+{
+    assert(source >= 0 && source < numSources);
+    return source / sourcesPerPartition;
+}
+
+void ParallelRateEstimator::bucketSpikes(const SpikeBatch& batch)
+{
+    for (Partition& partition : partitions)
+    {
+        partition.spikes.clear();
+    }
+
+    // (the batch is sorted, so each bucket is too)
+    int numSpikes = batch.size();
+    for (int kSpike = 0; kSpike < numSpikes; ++kSpike)
+    {
+        const SpikeBatch::Spike& spike = batch[kSpike];
+        Partition& partition = partitions[getPartitionOf(spike.source)];
+        partition.spikes.add(spike.samplePosition, spike.source - partition.firstSource, spike.subSample, spike.weight);
+    }
+}
+
+void ParallelRateEstimator::runBlock(float* const* outputs, int numSamples, int firstReadout, int readoutInterval,
+    float* readouts)
+{
+    int numPartitions = static_cast<int>(partitions.size());
+    long long work = static_cast<long long>(getNumStates()) * numSamples;
+    for (Partition& partition : partitions)
+    {
+        work += static_cast<long long>(partition.spikes.size()) * numTimeConsts;
+    }
+
+    int maxThreads = std::min(numPartitions, pool.getNumWorkers() + 1);
+    long long threadsForWork = std::max(1LL, work / minWorkPerThread);
+    int threads = static_cast<int>(std::min(static_cast<long long>(maxThreads), threadsForWork));
+
+    blockJob.numThreads = threads;
+    blockJob.outputs = outputs;
+    blockJob.numSamples = numSamples;
+    blockJob.firstReadout = firstReadout;
+    blockJob.readoutInterval = readoutInterval;
+    blockJob.readouts = readouts;
+    if (threads > 1)
+    {
+        pool.run(blockJob, threads);
+    }
+    else
+    {
+        blockJob.runPart(0);
+    }
+    numThreadsUsed = threads;
+
+    // (outputs can also go off when the threshold is disabled)
+    collectCrossings();
+}
+
+void ParallelRateEstimator::processPartition(int index, const BlockJob& block)
+{
+    Partition& partition = partitions[index];
+    int partitionSources = partition.numSources;
+    for (int timeConst = 0, state = 0; timeConst < numTimeConsts; ++timeConst)
+    {
+        for (int source = 0; source < partitionSources; ++source, ++state)
+        {
+            partition.outputs[state] = block.outputs != nullptr
+                ? block.outputs[timeConst * numSources + partition.firstSource + source] : nullptr;
+        }
+    }
+
+    partition.spikes.prepare(block.numSamples);
+    float* const* outputs = block.outputs != nullptr ? partition.outputs.data() : nullptr;
+    if (block.firstReadout < 0)
+    {
+        partition.estimator.processBlock(outputs, block.numSamples, partition.spikes);
+        return;
+    }
+
+    partition.numReadouts = partition.estimator.processBlockReadout(outputs, block.numSamples, partition.spikes,
+        block.firstReadout, block.readoutInterval, partition.readouts.data());
+
+    // to the readouts of all states
+    int partitionStates = partitionSources * numTimeConsts;
+    int numStates = getNumStates();
+    for (int kRead = 0; kRead < partition.numReadouts; ++kRead)
+    {
+        const float* values = partition.readouts.data() + static_cast<size_t>(kRead) * partitionStates;
+        float* allValues = block.readouts + static_cast<size_t>(kRead) * numStates + partition.firstSource;
+        for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+        {
+            std::copy(values + timeConst * partitionSources, values + (timeConst + 1) * partitionSources,
+                allValues + timeConst * numSources);
+        }
+    }
+}
+
+void ParallelRateEstimator::collectCrossings()
+{
+    crossings.clear();
+    for (const Partition& partition : partitions)
+    {
+        for (const ThresholdCrossing& crossing : partition.estimator.getCrossings())
+        {
+            ThresholdCrossing global = crossing;
+            int timeConst = crossing.state / partition.numSources;
+            int source = crossing.state % partition.numSources;
+            global.state = timeConst * numSources + partition.firstSource + source;
+            crossings.push_back(global);
+        }
+    }
+}
+
+bool ParallelRateEstimator::isPartitioned() const
+{
+    return partitions.size() > 1;
+}
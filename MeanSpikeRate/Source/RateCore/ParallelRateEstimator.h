@@ -0,0 +1,184 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PARALLEL_RATE_ESTIMATOR_H_INCLUDED
+#define PARALLEL_RATE_ESTIMATOR_H_INCLUDED
+
+#include "RateEstimator.h"
+#include "WorkerPool.h"
+#include <vector>
+
+/* RateEstimator whose sources are split into contiguous partitions, each with its own
+ * estimator (holding all of its sources' time constants), that can be processed on
+ * several threads at once: the calling thread and the workers of a WorkerPool. This is
+ * for large banks of states (e.g. a thousand electrodes at several time constants) that
+ * are too much work for one thread within a block.
+ *
+ * Each block's spikes are bucketed by partition on the calling thread (they stay sorted),
+ * then every thread processes its partitions and the call returns once all are done.
+ * States only depend on their own spikes, so the output is identical to a single
+ * RateEstimator's. If the block is small (fewer than minWorkPerThread state-samples and
+ * spikes per thread) fewer threads are used, down to processing all partitions on the
+ * calling thread; with one thread there is a single partition and every call goes
+ * straight to its estimator.
+ *
+ * The interface is that of RateEstimator, except that spikes passed to the incremental
+ * interface are collected and only processed by finishBlock when there are several
+ * partitions. States are numbered as in RateEstimator (timeConst * numSources + source).
+ */
+class ParallelRateEstimator
+{
+public:
+    ParallelRateEstimator();
+
+    // number of partitions, and of threads to process them with (including the calling thread).
+    // reallocates and resets all states; not for use on the audio thread
+    void setNumThreads(int numThreads);
+    int getNumThreads() const;
+
+    // the numThreads - 1 worker threads only run (and occupy their CPUs) between these calls;
+    // otherwise all partitions are processed on the calling thread. not for use on the audio thread.
+    void startWorkers();
+    void stopWorkers();
+    bool areWorkersRunning() const;
+
+    // blocks with less work than this per thread (in states times samples, plus spikes
+    // times time constants) use fewer threads
+    static const long long DEFAULT_MIN_WORK_PER_THREAD = 32768;
+    void setMinWorkPerThread(long long work);
+
+    // number of threads the last block was processed with
+    int getNumThreadsUsed() const;
+
+    // maximum number of spikes per block in the incremental interface (more are dropped and counted,
+    // together with those dropped by the partitions' estimators); not for use on the audio thread
+    void setSpikeCapacity(int capacity);
+    int getAndResetNumDropped();
+
+    // maximum number of readouts per block (0 by default): the partitions' readouts are sized for it, and
+    // later readouts in a block are skipped, as in RateEstimator; not for use on the audio thread
+    void setReadoutCapacity(int maxReadouts);
+
+    // as in RateEstimator
+    void setKernel(RateKernelType type);
+    RateKernelType getKernel() const;
+
+    void setNumStates(int numSources, int numTimeConsts = 1);
+    int getNumStates() const;
+    int getNumSources() const;
+    int getNumTimeConsts() const;
+
+    void setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping = false);
+    void setTimeConstant(double timeConstMs, double sampleRate);
+    void setSourceGain(int source, double gain);
+    void setSourceOutputScale(int source, double scale);
+    void setMaxRate(double maxRateHz);
+
+    void processBlock(float* const* outputs, int numSamples, const SpikeBatch& batch);
+    int processBlockReadout(float* const* outputs, int numSamples, const SpikeBatch& batch, int firstReadout,
+        int readoutInterval, float* readouts);
+
+    void startBlock(float* const* outputs, int numSamples);
+    void addSpike(int source, int samplePosition, int subSample = 0, float weight = 1.0f);
+    void finishBlock();
+
+    bool setThreshold(double onLevel, double offLevel);
+    const std::vector<ThresholdCrossing>& getCrossings() const;
+
+    double getMean(int state) const;
+    void reset();
+
+private:
+    struct Partition
+    {
+        RateEstimator estimator;
+        int firstSource;
+        int numSources;
+        SpikeBatch spikes;              // this block's spikes, with sources relative to firstSource
+        std::vector<float*> outputs;    // this block's outputs of the partition's states
+        std::vector<float> readouts;    // readouts of the partition's states (if reading out)
+        int numReadouts;
+    };
+
+    // processes the partitions of one block (see runBlock)
+    class BlockJob : public WorkerPool::Job
+    {
+    public:
+        explicit BlockJob(ParallelRateEstimator& owner);
+        void runPart(int part) override;
+
+        int numThreads;
+        float* const* outputs;
+        int numSamples;
+        int firstReadout;       // -1 = no readouts
+        int readoutInterval;
+        float* readouts;
+
+    private:
+        ParallelRateEstimator& owner;
+    };
+
+    // (re)creates the partitions for the current numbers of threads, sources and time constants
+    void updatePartitions();
+
+    int getPartitionOf(int source) const;
+
+    // buckets the block's spikes by partition
+    void bucketSpikes(const SpikeBatch& batch);
+
+    // processes the partitions' buckets on as many threads as the work calls for
+    void runBlock(float* const* outputs, int numSamples, int firstReadout, int readoutInterval, float* readouts);
+
+    void processPartition(int index, const BlockJob& block);
+
+    void collectCrossings();
+
+    bool isPartitioned() const;
+
+    int numThreads;
+    int numSources;
+    int numTimeConsts;
+    int sourcesPerPartition;
+    RateKernelType kernelType;
+    int spikeCapacity;
+    int readoutCapacity;
+    double maxRate;
+    int numDropped;
+    long long minWorkPerThread;
+    int numThreadsUsed;
+
+    bool thresholdEnabled;
+    double thresholdOn;
+    double thresholdOff;
+    std::vector<ThresholdCrossing> crossings;   // of all partitions, with global states
+
+    // incremental interface
+    float* const* blockOutputs;
+    int blockSize;
+
+    std::vector<Partition> partitions;
+    BlockJob blockJob;
+    WorkerPool pool;
+};
+
+#endif // PARALLEL_RATE_ESTIMATOR_H_INCLUDED
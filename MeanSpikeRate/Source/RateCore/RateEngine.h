@@ -0,0 +1,533 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RATE_ENGINE_H_INCLUDED
+#define RATE_ENGINE_H_INCLUDED
+
+#include "RateKernels.h"
+#include "SpikeBatch.h"
+#include <cassert>
+#include <climits>
+#include <vector>
+
+// an output crossing its threshold (see RateEstimator::setThreshold)
+struct ThresholdCrossing
+{
+    int samplePosition;
+    int state;
+    bool rising;
+};
+
+/* Interface to a RateEngine with any kernel, for RateEstimator. Calls through it are
+ * per block or per spike; nothing is dispatched per sample.
+ */
+class RateEngineBase
+{
+public:
+    virtual ~RateEngineBase() {}
+
+    virtual void setNumStates(int numSources, int numTimeConsts) = 0;
+    virtual int getNumStates() const = 0;
+    virtual int getNumSources() const = 0;
+    virtual int getNumTimeConsts() const = 0;
+
+    virtual void setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping) = 0;
+    virtual void setSourceGain(int source, double gain) = 0;
+    virtual void setSourceOutputScale(int source, double scale) = 0;
+    virtual void setMaxRate(double maxRateHz) = 0;
+    virtual int getAndResetNumDropped() = 0;
+    virtual void setReadoutCapacity(int maxReadouts) = 0;
+
+    // spikeSources may be null if all spikes are from source 0
+    virtual void processBlock(float* const* outputs, int numSamples, const int* spikePositions,
+        const int* spikeSources, int numSpikes) = 0;
+    virtual void processBlock(float* const* outputs, int numSamples, const SpikeBatch& batch) = 0;
+
+    virtual int processBlockReadout(float* const* outputs, int numSamples, const SpikeBatch& batch, int firstReadout,
+        int readoutInterval, float* readouts) = 0;
+
+    virtual void startBlock(float* const* outputs, int numSamples) = 0;
+    virtual void addSpike(int source, int samplePosition, int subSample, float weight) = 0;
+    virtual void finishBlock() = 0;
+
+    virtual bool setThreshold(double onLevel, double offLevel) = 0;
+    virtual const std::vector<ThresholdCrossing>& getCrossings() const = 0;
+
+    virtual double getMean(int state) const = 0;
+    virtual void reset() = 0;
+};
+
+/* Bookkeeping of sources, time constants and output positions for the rate estimate,
+ * with the smoothing done by Kernel (see RateKernels.h). See RateEstimator for the
+ * meaning of each method.
+ */
+template <typename Kernel>
+class RateEngine : public RateEngineBase
+{
+public:
+    // crossings beyond this many per block are not recorded
+    static const int MAX_CROSSINGS = 4096;
+
+    RateEngine()
+        : numSources        (0)
+        , maxRate           (0)
+        , readoutCapacity   (-1)
+        , blockSize         (0)
+        , thresholdEnabled  (false)
+        , thresholdOn       (0)
+        , thresholdOff      (0)
+        , releaseAll        (false)
+    {
+        crossings.reserve(MAX_CROSSINGS);
+        setNumStates(1, 1);
+    }
+
+    void setNumStates(int newNumSources, int numTimeConsts) override
+    {
+        assert(newNumSources >= 0 && numTimeConsts > 0);
+
+        numSources = newNumSources;
+        int numStates = numSources * numTimeConsts;
+
+        timeConstSecs.assign(numTimeConsts, 1.0);
+        sampleRates.assign(numTimeConsts, 0.0);
+        ramped.assign(numTimeConsts, 0);
+        gains.assign(numSources, 1.0);
+        outputScales.assign(numSources, 1.0);
+
+        spikeAmps.assign(numStates, 0.0);
+        wpBuffers.assign(numStates, nullptr);
+        currSamples.assign(numStates, 0);
+        aboveThreshold.assign(numStates, 0);
+        offCrossings.assign(numStates, 0);
+        scaleChanged.assign(numStates, 0);
+
+        kernel.setNumStates(numStates, numTimeConsts);
+        for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+        {
+            updateSpikeAmps(timeConst);
+        }
+    }
+
+    int getNumStates() const override
+    {
+        return static_cast<int>(spikeAmps.size());
+    }
+
+    int getNumSources() const override
+    {
+        return numSources;
+    }
+
+    int getNumTimeConsts() const override
+    {
+        return static_cast<int>(timeConstSecs.size());
+    }
+
+    void setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping) override
+    {
+        assert(timeConst >= 0 && timeConst < getNumTimeConsts());
+        assert(timeConstMs > 0 && sampleRate > 0);
+
+        // (a value set while ramping is set again exactly once the ramp ends on it)
+        double timeConstSec = timeConstMs / 1000.0;
+        if (timeConstSec == timeConstSecs[timeConst] && sampleRate == sampleRates[timeConst]
+            && (ramping || !ramped[timeConst]))
+        {
+            return;
+        }
+
+        timeConstSecs[timeConst] = timeConstSec;
+        sampleRates[timeConst] = sampleRate;
+        ramped[timeConst] = ramping;
+        kernel.setTimeConstant(timeConst, timeConstSec * sampleRate, !ramping);
+        kernel.setMaxSpikes(timeConst, maxRate * timeConstSec);
+        updateSpikeAmps(timeConst);
+
+        // outputs above the threshold now decay at a different rate (from the start of the next block)
+        if (Kernel::HAS_ANALYTIC_CROSSINGS && thresholdEnabled)
+        {
+            for (int state = timeConst * numSources; state < (timeConst + 1) * numSources; ++state)
+            {
+                if (aboveThreshold[state])
+                {
+                    updateOffCrossing(state, timeConst, 0);
+                }
+            }
+        }
+    }
+
+    void setMaxRate(double maxRateHz) override
+    {
+        maxRate = maxRateHz;
+        int numTimeConsts = getNumTimeConsts();
+        for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+        {
+            if (sampleRates[timeConst] > 0) // (time constant set)
+            {
+                kernel.setMaxSpikes(timeConst, maxRate * timeConstSecs[timeConst]);
+            }
+        }
+    }
+
+    int getAndResetNumDropped() override
+    {
+        return kernel.getAndResetNumDropped();
+    }
+
+    void setReadoutCapacity(int maxReadouts) override
+    {
+        readoutCapacity = maxReadouts;
+    }
+
+    void setSourceGain(int source, double gain) override
+    {
+        assert(source >= 0 && source < numSources);
+
+        gains[source] = gain;
+        int numTimeConsts = getNumTimeConsts();
+        for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+        {
+            spikeAmps[timeConst * numSources + source] = gain / timeConstSecs[timeConst];
+        }
+    }
+
+    void setSourceOutputScale(int source, double scale) override
+    {
+        assert(source >= 0 && source < numSources);
+        assert(scale >= 0);
+
+        if (scale == outputScales[source])
+        {
+            return;
+        }
+        outputScales[source] = scale;
+
+        // the output can cross the threshold without a spike now, which startBlock checks for
+        int numStates = getNumStates();
+        for (int state = source; state < numStates; state += numSources)
+        {
+            scaleChanged[state] = 1;
+        }
+    }
+
+    void processBlock(float* const* outputs, int numSamples, const int* spikePositions,
+        const int* spikeSources, int numSpikes) override
+    {
+        startBlock(outputs, numSamples);
+        for (int kSpike = 0; kSpike < numSpikes; ++kSpike)
+        {
+            addSpikeImpl(spikeSources != nullptr ? spikeSources[kSpike] : 0, spikePositions[kSpike], 0, 1.0f);
+        }
+        finishBlock();
+    }
+
+    void processBlock(float* const* outputs, int numSamples, const SpikeBatch& batch) override
+    {
+        startBlock(outputs, numSamples);
+        int numSpikes = batch.size();
+        for (int kSpike = 0; kSpike < numSpikes; ++kSpike)
+        {
+            const SpikeBatch::Spike& spike = batch[kSpike];
+            addSpikeImpl(spike.source, spike.samplePosition, spike.subSample, spike.weight);
+        }
+        finishBlock();
+    }
+
+    int processBlockReadout(float* const* outputs, int numSamples, const SpikeBatch& batch, int firstReadout,
+        int readoutInterval, float* readouts) override
+    {
+        assert(readoutInterval > 0);
+
+        startBlock(outputs, numSamples);
+        int numStates = getNumStates();
+
+        // unless there are outputs, states are only advanced to each readout and spike, without writing the samples in between
+        int numSpikes = batch.size();
+        int kSpike = 0;
+        int numReadouts = 0;
+        for (int readout = firstReadout; readout < numSamples; readout += readoutInterval)
+        {
+            if (readoutCapacity >= 0 && numReadouts >= readoutCapacity)
+            {
+                break; // (the rest of the block is still processed below)
+            }
+
+            for (; kSpike < numSpikes && batch[kSpike].samplePosition <= readout; ++kSpike)
+            {
+                const SpikeBatch::Spike& spike = batch[kSpike];
+                addSpikeImpl(spike.source, spike.samplePosition, spike.subSample, spike.weight);
+            }
+
+            float* values = readouts + numReadouts * numStates;
+            int numTimeConsts = getNumTimeConsts();
+            for (int timeConst = 0, state = 0; timeConst < numTimeConsts; ++timeConst)
+            {
+                for (int source = 0; source < numSources; ++source, ++state)
+                {
+                    fillTo(state, timeConst, readout);
+                    values[state] = static_cast<float>(kernel.getValue(state) * outputScales[source]);
+                }
+            }
+            ++numReadouts;
+        }
+
+        for (; kSpike < numSpikes; ++kSpike)
+        {
+            const SpikeBatch::Spike& spike = batch[kSpike];
+            addSpikeImpl(spike.source, spike.samplePosition, spike.subSample, spike.weight);
+        }
+        finishBlock();
+        return numReadouts;
+    }
+
+    // outputs may be null to not write any output
+    void startBlock(float* const* outputs, int numSamples) override
+    {
+        blockSize = numSamples;
+        crossings.clear();
+        int numStates = getNumStates();
+        for (int state = 0; state < numStates; ++state)
+        {
+            wpBuffers[state] = outputs != nullptr ? outputs[state] : nullptr;
+            currSamples[state] = 0;
+
+            // outputs that were above the threshold when it was changed, disabled or reset go off now
+            if (aboveThreshold[state] && (releaseAll || !thresholdEnabled))
+            {
+                addCrossing(0, state, false);
+            }
+        }
+        releaseAll = false;
+
+        // outputs whose scale changed may have crossed the threshold at the start of the block
+        for (int state = 0; state < numStates; ++state)
+        {
+            if (scaleChanged[state])
+            {
+                scaleChanged[state] = 0;
+                if (Kernel::HAS_ANALYTIC_CROSSINGS && thresholdEnabled)
+                {
+                    checkRisingCrossing(state, state / numSources, 0);
+                }
+            }
+        }
+    }
+
+    void addSpike(int source, int samplePosition, int subSample, float weight) override
+    {
+        addSpikeImpl(source, samplePosition, subSample, weight);
+    }
+
+    void finishBlock() override
+    {
+        // after all spikes are handled, finish writing samples
+        int numTimeConsts = getNumTimeConsts();
+        for (int timeConst = 0, state = 0; timeConst < numTimeConsts; ++timeConst)
+        {
+            for (int source = 0; source < numSources; ++source, ++state)
+            {
+                fillTo(state, timeConst, blockSize);
+                wpBuffers[state] = nullptr;
+                kernel.finishBlock(state);
+
+                if (aboveThreshold[state] && offCrossings[state] != LLONG_MAX)
+                {
+                    offCrossings[state] -= blockSize;
+                }
+            }
+        }
+    }
+
+    bool setThreshold(double onLevel, double offLevel) override
+    {
+        bool enable = onLevel > 0;
+        if (enable && !Kernel::HAS_ANALYTIC_CROSSINGS)
+        {
+            thresholdEnabled = false;
+            return false;
+        }
+
+        offLevel = offLevel < onLevel ? offLevel : onLevel;
+        if (onLevel != thresholdOn || offLevel != thresholdOff)
+        {
+            // start over, since the pending falling crossings depend on the off level
+            releaseAll = true;
+        }
+
+        thresholdEnabled = enable;
+        thresholdOn = onLevel;
+        thresholdOff = offLevel;
+        return true;
+    }
+
+    const std::vector<ThresholdCrossing>& getCrossings() const override
+    {
+        return crossings;
+    }
+
+    double getMean(int state) const override
+    {
+        if (numSources == 0)
+        {
+            return 0;
+        }
+        return kernel.getValue(state) * outputScales[state % numSources];
+    }
+
+    void reset() override
+    {
+        kernel.reset();
+        releaseAll = true;
+    }
+
+private:
+    void addSpikeImpl(int source, int samplePosition, int subSample, float weight)
+    {
+        assert(source >= 0 && source < numSources);
+        assert(subSample >= 0 && subSample < SpikeTimeMapping::SUB_SAMPLE_STEPS);
+
+        int numStates = getNumStates();
+        int timeConst = 0;
+        for (int state = source; state < numStates; state += numSources, ++timeConst)
+        {
+            assert(samplePosition >= currSamples[state]); // spike sample must not have already been finished
+
+            // write samples up to the spike position
+            fillTo(state, timeConst, samplePosition);
+
+            // add spike contribution
+            kernel.addSpike(state, timeConst, spikeAmps[state] * weight, subSample);
+
+            // the output can only rise above the threshold at a spike
+            if (Kernel::HAS_ANALYTIC_CROSSINGS && thresholdEnabled)
+            {
+                checkRisingCrossing(state, timeConst, samplePosition);
+            }
+        }
+    }
+
+    void checkRisingCrossing(int state, int timeConst, int samplePosition)
+    {
+        if (!aboveThreshold[state])
+        {
+            if (kernel.getValue(state) * outputScales[state % numSources] < thresholdOn)
+            {
+                return;
+            }
+            aboveThreshold[state] = 1;
+            addCrossing(samplePosition, state, true);
+        }
+
+        updateOffCrossing(state, timeConst, samplePosition);
+    }
+
+    // compute when an output that is above the threshold at samplePosition will fall below the off level,
+    // which fillTo checks for
+    void updateOffCrossing(int state, int timeConst, int samplePosition)
+    {
+        // (the kernel's value is compared to the level before scaling; a zero scale is below any level)
+        double scale = outputScales[state % numSources];
+        int samplesUntilOff = scale > 0 ? kernel.getSamplesUntilBelow(state, timeConst, thresholdOff / scale) : 0;
+        offCrossings[state] = samplesUntilOff == INT_MAX ? LLONG_MAX : samplePosition + static_cast<long long>(samplesUntilOff);
+    }
+
+    void addCrossing(int samplePosition, int state, bool rising)
+    {
+        if (!rising)
+        {
+            aboveThreshold[state] = 0;
+        }
+
+        if (crossings.size() < MAX_CROSSINGS)
+        {
+            ThresholdCrossing crossing = { samplePosition, state, rising };
+            crossings.push_back(crossing);
+        }
+    }
+
+    // write samples of a state up to (not including) samplePosition
+    void fillTo(int state, int timeConst, int samplePosition)
+    {
+        int currSample = currSamples[state];
+        if (samplePosition <= currSample)
+        {
+            return;
+        }
+
+        if (aboveThreshold[state] && offCrossings[state] < samplePosition)
+        {
+            addCrossing(static_cast<int>(offCrossings[state]), state, false);
+        }
+
+        float* out = wpBuffers[state] != nullptr ? wpBuffers[state] + currSample : nullptr;
+        kernel.fill(state, timeConst, out, samplePosition - currSample, outputScales[state - timeConst * numSources]);
+        currSamples[state] = samplePosition;
+    }
+
+    void updateSpikeAmps(int timeConst)
+    {
+        // the amplitude of each spike such that if there is a steady rate of spiking,
+        // the average over time of the output (at the limit where the process has been
+        // continuing forever) equals the actual spike rate in Hz. For a kernel with unit
+        // integral, this is just 1 / (time const in sec), scaled by the gain of the source.
+        double* amps = spikeAmps.data() + timeConst * numSources;
+        for (int source = 0; source < numSources; ++source)
+        {
+            amps[source] = gains[source] / timeConstSecs[timeConst];
+        }
+    }
+
+    int numSources;
+    double maxRate;     // per source, in Hz (see RateEstimator::setMaxRate)
+    int readoutCapacity; // -1 = no limit
+
+    // per time constant
+    std::vector<double> timeConstSecs;
+    std::vector<double> sampleRates;
+    std::vector<char> ramped;         // kernel's tables only updated approximately (see DecayPowerTable)
+
+    // per source
+    std::vector<double> gains;
+    std::vector<double> outputScales; // applied to the value of each state when it is output
+
+    // per state
+    std::vector<double> spikeAmps;   // contribution of a single spike
+    std::vector<float*> wpBuffers;
+    std::vector<int> currSamples;    // allows processing samples while handling events
+    std::vector<char> aboveThreshold;
+    std::vector<long long> offCrossings; // sample (relative to the block) at which an output above the threshold falls below the off level
+    std::vector<char> scaleChanged;      // output scale changed since the last block
+
+    int blockSize;
+
+    bool thresholdEnabled;
+    double thresholdOn;
+    double thresholdOff;
+    bool releaseAll;    // whether all outputs above the threshold go off at the start of the next block
+    std::vector<ThresholdCrossing> crossings; // in the current block
+
+    Kernel kernel;
+};
+
+#endif // RATE_ENGINE_H_INCLUDED
@@ -0,0 +1,202 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "RateEstimator.h"
+#include <cassert>
+
+const double RateEstimator::MIN_MEAN = ExponentialKernel::MIN_VALUE;
+const double RateEstimator::DEFAULT_MAX_RATE = 500.0;
+
+RateEstimator::RateEstimator()
+    : maxRate           (DEFAULT_MAX_RATE)
+    , readoutCapacity   (-1)
+{
+    setKernel(KERNEL_EXPONENTIAL);
+}
+
+void RateEstimator::setKernel(RateKernelType type)
+{
+    int numSources = engine ? engine->getNumSources() : 1;
+    int numTimeConsts = engine ? engine->getNumTimeConsts() : 1;
+
+    kernelType = type;
+    switch (type)
+    {
+    case KERNEL_ALPHA:
+        engine.reset(new RateEngine<CascadeKernel<2>>());
+        break;
+
+    case KERNEL_GAMMA:
+        engine.reset(new RateEngine<CascadeKernel<4>>());
+        break;
+
+    case KERNEL_GAUSSIAN:
+        engine.reset(new RateEngine<CascadeKernel<8>>());
+        break;
+
+    case KERNEL_BOXCAR:
+        engine.reset(new RateEngine<BoxcarKernel>());
+        break;
+
+    default:
+        assert(type == KERNEL_EXPONENTIAL);
+        kernelType = KERNEL_EXPONENTIAL;
+        engine.reset(new RateEngine<ExponentialKernel>());
+        break;
+    }
+
+    engine->setMaxRate(maxRate);
+    engine->setReadoutCapacity(readoutCapacity);
+    engine->setNumStates(numSources, numTimeConsts);
+}
+
+RateKernelType RateEstimator::getKernel() const
+{
+    return kernelType;
+}
+
+void RateEstimator::setNumStates(int numSources, int numTimeConsts)
+{
+    engine->setNumStates(numSources, numTimeConsts);
+}
+
+int RateEstimator::getNumStates() const
+{
+    return engine->getNumStates();
+}
+
+int RateEstimator::getNumSources() const
+{
+    return engine->getNumSources();
+}
+
+int RateEstimator::getNumTimeConsts() const
+{
+    return engine->getNumTimeConsts();
+}
+
+void RateEstimator::setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping)
+{
+    engine->setTimeConstant(timeConst, timeConstMs, sampleRate, ramping);
+}
+
+void RateEstimator::setTimeConstant(double timeConstMs, double sampleRate)
+{
+    int numTimeConsts = getNumTimeConsts();
+    for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+    {
+        engine->setTimeConstant(timeConst, timeConstMs, sampleRate, false);
+    }
+}
+
+void RateEstimator::setMaxRate(double maxRateHz)
+{
+    maxRate = maxRateHz;
+    engine->setMaxRate(maxRate);
+}
+
+int RateEstimator::getAndResetNumDropped()
+{
+    return engine->getAndResetNumDropped();
+}
+
+void RateEstimator::setReadoutCapacity(int maxReadouts)
+{
+    readoutCapacity = maxReadouts;
+    engine->setReadoutCapacity(readoutCapacity);
+}
+
+void RateEstimator::setSourceGain(int source, double gain)
+{
+    engine->setSourceGain(source, gain);
+}
+
+void RateEstimator::setSourceOutputScale(int source, double scale)
+{
+    engine->setSourceOutputScale(source, scale);
+}
+
+void RateEstimator::processBlock(float* const* outputs, int numSamples, const int* spikePositions,
+    const int* spikeSources, int numSpikes)
+{
+    engine->processBlock(outputs, numSamples, spikePositions, spikeSources, numSpikes);
+}
+
+void RateEstimator::processBlock(float* const* outputs, int numSamples, const SpikeBatch& batch)
+{
+    engine->processBlock(outputs, numSamples, batch);
+}
+
+void RateEstimator::processBlock(float* output, int numSamples, const int* spikePositions, int numSpikes)
+{
+    assert(getNumStates() == 1);
+
+    engine->processBlock(&output, numSamples, spikePositions, nullptr, numSpikes);
+}
+
+int RateEstimator::processBlockReadout(int numSamples, const SpikeBatch& batch, int firstReadout,
+    int readoutInterval, float* readouts)
+{
+    return engine->processBlockReadout(nullptr, numSamples, batch, firstReadout, readoutInterval, readouts);
+}
+
+int RateEstimator::processBlockReadout(float* const* outputs, int numSamples, const SpikeBatch& batch,
+    int firstReadout, int readoutInterval, float* readouts)
+{
+    return engine->processBlockReadout(outputs, numSamples, batch, firstReadout, readoutInterval, readouts);
+}
+
+void RateEstimator::startBlock(float* const* outputs, int numSamples)
+{
+    engine->startBlock(outputs, numSamples);
+}
+
+void RateEstimator::addSpike(int source, int samplePosition, int subSample, float weight)
+{
+    engine->addSpike(source, samplePosition, subSample, weight);
+}
+
+void RateEstimator::finishBlock()
+{
+    engine->finishBlock();
+}
+
+bool RateEstimator::setThreshold(double onLevel, double offLevel)
+{
+    return engine->setThreshold(onLevel, offLevel);
+}
+
+const std::vector<ThresholdCrossing>& RateEstimator::getCrossings() const
+{
+    return engine->getCrossings();
+}
+
+double RateEstimator::getMean(int state) const
+{
+    return engine->getMean(state);
+}
+
+void RateEstimator::reset()
+{
+    engine->reset();
+}
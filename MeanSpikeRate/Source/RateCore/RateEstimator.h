@@ -0,0 +1,157 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RATE_ESTIMATOR_H_INCLUDED
+#define RATE_ESTIMATOR_H_INCLUDED
+
+#include "RateEngine.h"
+#include <memory>
+
+/* Rate estimation kernel used by MeanSpikeRate, kept free of JUCE and Open Ephys
+ * dependencies so that it can be built and benchmarked on its own.
+ *
+ * Maintains a bank of moving averages of spike events (by default, exponentially
+ * weighted). Spikes come from a number of "sources" (e.g. one for the mean over all
+ * electrodes, or one per electrode), and each source is tracked at one or more time
+ * constants. Each (time constant, source) pair is a "state", with index
+ * timeConst * numSources + source. Spikes can either be passed in as a sorted list of
+ * sample positions for a whole block (processBlock, e.g. from a SpikeBatch) or one at
+ * a time as they arrive (startBlock / addSpike / finishBlock).
+ *
+ * The smoothing kernel can be chosen with setKernel (see RateKernels.h). Each kernel
+ * has its own instantiation of RateEngine, so its inner loop is specialised for it;
+ * the choice is only dispatched once per block or spike.
+ *
+ * State variables are stored as parallel arrays, contiguous per time constant. Each
+ * state keeps track of how far its own output has been written, so a spike only costs
+ * the fill of the runs since its source's previous spike, regardless of the number of
+ * sources. With the exponential kernel, runs are filled with DecayPowerTable (see
+ * DecayKernel.h for the accuracy relative to a serial per-sample update).
+ *
+ * States are kept in double precision and only rounded to float on output, so a
+ * mean that is decayed and incremented over a session of billions of samples does not
+ * drift. Values that have decayed below MIN_MEAN are flushed to zero at the end of each
+ * block, which keeps long silences from producing denormals. Kernel constants and spike
+ * amplitudes are cached and only recomputed when a time constant, the sample rate or a
+ * source gain changes, so setting the parameters before every block is cheap.
+ *
+ * Spikes from a stream with a different sample rate than the output can carry a
+ * sub-sample offset (see SpikeTimeMapping); the spike's amplitude is then decayed by
+ * that fraction of a sample, using a table per time constant that is only recomputed
+ * when the decay changes.
+ */
+class RateEstimator
+{
+public:
+    RateEstimator();
+
+    // replaces the engine and resets all states (keeping the number of states);
+    // not for use on the audio thread
+    void setKernel(RateKernelType type);
+    RateKernelType getKernel() const;
+
+    // allocates and resets all states; not for use on the audio thread
+    void setNumStates(int numSources, int numTimeConsts = 1);
+    int getNumStates() const;
+    int getNumSources() const;
+    int getNumTimeConsts() const;
+
+    // means smaller than this are flushed to zero
+    static const double MIN_MEAN;
+
+    // the boxcar kernel's windows hold the spikes of up to this average rate per source (more are
+    // dropped and counted). they are sized when it or a time constant is set; the default is
+    // DEFAULT_MAX_RATE (Hz). the other kernels have no such limit.
+    static const double DEFAULT_MAX_RATE;
+    void setMaxRate(double maxRateHz);
+    int getAndResetNumDropped();
+
+    // maximum number of readouts per block that processBlockReadout writes; later readouts in the block are
+    // skipped (the states are still advanced over all of it), so that a fixed buffer can't be overrun.
+    // negative (the default) for no limit.
+    void setReadoutCapacity(int maxReadouts);
+
+    // update algorithm parameters (can be called before each block; only does any work on a change).
+    // ramping = the time constant is set again next block (e.g. by a TimeConstRamp), so its decay
+    // tables are only updated approximately, and recomputed once it is set without ramping.
+    void setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping = false);
+    void setTimeConstant(double timeConstMs, double sampleRate); // for all time constants
+
+    // the output of a source is the spike rate per electrode times gain (e.g. 1 / number of electrodes to average)
+    void setSourceGain(int source, double gain);
+
+    // the output of a source is also multiplied by scale. Unlike the gain, which weights each spike as it
+    // is added, this applies to the whole state (including spikes added before it changed) from the start
+    // of the next block, e.g. to keep the sum over electrodes in the state and only divide it when it is output.
+    void setSourceOutputScale(int source, double scale);
+
+    // write the rate for one block of samples, given the sorted positions and sources of all spikes in the block.
+    // outputs[state] may be null if the state should be updated without writing output.
+    void processBlock(float* const* outputs, int numSamples, const int* spikePositions,
+        const int* spikeSources, int numSpikes);
+
+    // batch must have been prepared (sorted) for this block
+    void processBlock(float* const* outputs, int numSamples, const SpikeBatch& batch);
+
+    // single-state version
+    void processBlock(float* output, int numSamples, const int* spikePositions, int numSpikes);
+
+    // decimated version: advances the states over the block without writing every sample, and
+    // only reads out the value of every state at samples firstReadout + k * readoutInterval
+    // (k >= 0) within the block. The values of the kth readout go to readouts[k * numStates + state],
+    // which must have room for all of them (or the readout capacity). Returns the number of readouts.
+    int processBlockReadout(int numSamples, const SpikeBatch& batch, int firstReadout,
+        int readoutInterval, float* readouts);
+
+    // same, but also writes every sample to outputs, as processBlock does (null outputs are skipped)
+    int processBlockReadout(float* const* outputs, int numSamples, const SpikeBatch& batch, int firstReadout,
+        int readoutInterval, float* readouts);
+
+    // incremental interface: spike positions must be nondecreasing within each source in a block.
+    // each spike's contribution is multiplied by its weight (as is that of spikes in a SpikeBatch).
+    void startBlock(float* const* outputs, int numSamples);
+    void addSpike(int source, int samplePosition, int subSample = 0, float weight = 1.0f);
+    void finishBlock();
+
+    // threshold detection: an output turns "on" when it rises to onLevel or above (which can only
+    // happen at a spike, or at the start of a block if its output scale changed) and "off" when it
+    // falls below offLevel (<= onLevel, for hysteresis). Falling crossings are found in closed form,
+    // without checking every sample. onLevel <= 0 disables it; outputs that are on then turn off
+    // at the start of the next block. Returns false if the kernel doesn't support it (only the
+    // exponential kernel does).
+    bool setThreshold(double onLevel, double offLevel);
+
+    // crossings in the last block, in the order they were found (sorted within each state)
+    const std::vector<ThresholdCrossing>& getCrossings() const;
+
+    double getMean(int state) const;
+    void reset();
+
+private:
+    RateKernelType kernelType;
+    double maxRate;
+    int readoutCapacity;
+    std::unique_ptr<RateEngineBase> engine;
+};
+
+#endif // RATE_ESTIMATOR_H_INCLUDED
@@ -0,0 +1,118 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RATE_FRAME_RING_H_INCLUDED
+#define RATE_FRAME_RING_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+
+/* Layout of the shared memory ring buffer through which the plugin exports rate frames
+ * to other processes (written by RateFrameWriter, read by RateFrameReader in Reader/).
+ * Only fixed-size types are used, so that the writer and readers can be built separately.
+ *
+ * The region consists of:
+ *   - a RateFrameRingHeader
+ *   - the enabled state of each spike channel, one bit per channel in 32-bit atomic words
+ *   - capacity frames of frameBytes each: a RateFrameHeader followed by numValues floats
+ * (each section starting on a CACHE_LINE boundary).
+ *
+ * There is a single writer, which never waits for readers: once the ring is full, each
+ * frame overwrites the oldest one. Each frame is guarded by a sequence number (a seqlock),
+ * which is odd while the frame is being written, so a reader can tell if a frame it copied
+ * was overwritten in the meantime. Any number of readers can follow the ring independently.
+ */
+
+namespace RateFrameRing
+{
+    const uint32_t MAGIC = 0x4d535246; // "MSRF"
+    const uint32_t VERSION = 1;
+    const int CACHE_LINE = 64;
+
+    // the sequence numbers and frame count must be shared between processes without locks
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "64-bit atomics must be lock-free");
+
+    struct alignas(CACHE_LINE) RateFrameRingHeader
+    {
+        std::atomic<uint32_t> magic;    // set last by the writer, once the rest of the header is valid
+        uint32_t version;
+        uint32_t numValues;             // per frame: one per output, source-major (as the plugin's output channels)
+        uint32_t numSources;
+        uint32_t numTimeConsts;
+        uint32_t numChannels;           // spike channels
+        uint32_t capacity;              // frames
+        uint32_t frameBytes;
+        uint64_t channelsOffset;        // byte offsets from the start of the region
+        uint64_t framesOffset;
+        uint64_t totalBytes;
+        double sampleRate;              // of the frame timestamps
+
+        alignas(CACHE_LINE) std::atomic<uint64_t> writeCount; // number of frames written so far
+    };
+
+    struct RateFrameHeader
+    {
+        std::atomic<uint64_t> sequence; // 2n + 1 while frame n is being written, 2n + 2 once it is complete
+        int64_t timestamp;              // in samples
+    };
+
+    // the values that follow a frame's header (through a float pointer, as the header itself isn't trivially copyable)
+    inline float* getFrameValues(RateFrameHeader* frame)
+    {
+        return reinterpret_cast<float*>(frame + 1);
+    }
+
+    inline const float* getFrameValues(const RateFrameHeader* frame)
+    {
+        return reinterpret_cast<const float*>(frame + 1);
+    }
+
+    inline uint64_t alignToCacheLine(uint64_t bytes)
+    {
+        return (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    }
+
+    inline int getNumChannelWords(int numChannels)
+    {
+        return (numChannels + 31) / 32;
+    }
+
+    // fills in the sizes and offsets of the header (except the atomics) for the given dimensions
+    inline void computeLayout(RateFrameRingHeader* header, int numSources, int numTimeConsts,
+        int numChannels, int capacity)
+    {
+        header->version = VERSION;
+        header->numValues = static_cast<uint32_t>(numSources * numTimeConsts);
+        header->numSources = static_cast<uint32_t>(numSources);
+        header->numTimeConsts = static_cast<uint32_t>(numTimeConsts);
+        header->numChannels = static_cast<uint32_t>(numChannels);
+        header->capacity = static_cast<uint32_t>(capacity);
+        header->frameBytes = static_cast<uint32_t>(alignToCacheLine(sizeof(RateFrameHeader) + header->numValues * sizeof(float)));
+        header->channelsOffset = alignToCacheLine(sizeof(RateFrameRingHeader));
+        header->framesOffset = header->channelsOffset
+            + alignToCacheLine(getNumChannelWords(numChannels) * sizeof(std::atomic<uint32_t>));
+        header->totalBytes = header->framesOffset + static_cast<uint64_t>(capacity) * header->frameBytes;
+    }
+}
+
+#endif // RATE_FRAME_RING_H_INCLUDED
@@ -0,0 +1,196 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "RateFrameWriter.h"
+
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace RateFrameRing;
+
+RateFrameWriter::RateFrameWriter()
+    : header        (nullptr)
+    , channelWords  (nullptr)
+    , frames        (nullptr)
+    , numWritten    (0)
+{}
+
+RateFrameWriter::~RateFrameWriter()
+{
+    close();
+}
+
+bool RateFrameWriter::open(const std::string& newName, int numSources, int numTimeConsts, int numChannels,
+    int capacity, double sampleRate)
+{
+    close();
+
+#ifdef _WIN32
+    (void)newName; (void)numSources; (void)numTimeConsts; (void)numChannels; (void)capacity; (void)sampleRate;
+    return false;
+#else
+    if (numSources <= 0 || numTimeConsts <= 0 || numChannels < 0 || capacity <= 0)
+    {
+        return false;
+    }
+
+    RateFrameRingHeader layout;
+    computeLayout(&layout, numSources, numTimeConsts, numChannels, capacity);
+
+    // replace any region left behind by a previous run, so readers never attach to a stale layout
+    shm_unlink(newName.c_str());
+    int fd = shm_open(newName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    void* region = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(layout.totalBytes)) == 0)
+    {
+        region = mmap(nullptr, layout.totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (region == MAP_FAILED)
+    {
+        shm_unlink(newName.c_str());
+        return false;
+    }
+
+    // the region is zero-filled, so all frames start out with sequence 0 (never written)
+    char* base = static_cast<char*>(region);
+    header = new (base) RateFrameRingHeader;
+    header->version = layout.version;
+    header->numValues = layout.numValues;
+    header->numSources = layout.numSources;
+    header->numTimeConsts = layout.numTimeConsts;
+    header->numChannels = layout.numChannels;
+    header->capacity = layout.capacity;
+    header->frameBytes = layout.frameBytes;
+    header->channelsOffset = layout.channelsOffset;
+    header->framesOffset = layout.framesOffset;
+    header->totalBytes = layout.totalBytes;
+    header->sampleRate = sampleRate;
+    header->writeCount.store(0, std::memory_order_relaxed);
+
+    channelWords = reinterpret_cast<std::atomic<uint32_t>*>(base + layout.channelsOffset);
+    for (int word = 0; word < getNumChannelWords(numChannels); ++word)
+    {
+        new (channelWords + word) std::atomic<uint32_t>(0);
+    }
+
+    frames = base + layout.framesOffset;
+    for (int frame = 0; frame < capacity; ++frame)
+    {
+        RateFrameHeader* frameHeader = new (frames + static_cast<size_t>(frame) * layout.frameBytes) RateFrameHeader;
+        frameHeader->sequence.store(0, std::memory_order_relaxed);
+        frameHeader->timestamp = 0;
+    }
+
+    numWritten = 0;
+    name = newName;
+    header->magic.store(MAGIC, std::memory_order_release);
+    return true;
+#endif
+}
+
+void RateFrameWriter::close()
+{
+#ifndef _WIN32
+    if (header == nullptr)
+    {
+        return;
+    }
+
+    munmap(header, header->totalBytes);
+    shm_unlink(name.c_str());
+#endif
+    header = nullptr;
+    channelWords = nullptr;
+    frames = nullptr;
+    name.clear();
+}
+
+bool RateFrameWriter::isOpen() const
+{
+    return header != nullptr;
+}
+
+const std::string& RateFrameWriter::getName() const
+{
+    return name;
+}
+
+int RateFrameWriter::getNumValues() const
+{
+    return header != nullptr ? static_cast<int>(header->numValues) : 0;
+}
+
+void RateFrameWriter::setChannelEnabled(int channel, bool enabled)
+{
+    if (header == nullptr || channel < 0 || channel >= static_cast<int>(header->numChannels))
+    {
+        return;
+    }
+
+    uint32_t bit = 1u << (channel % 32);
+    std::atomic<uint32_t>& word = channelWords[channel / 32];
+    if (enabled)
+    {
+        word.fetch_or(bit, std::memory_order_relaxed);
+    }
+    else
+    {
+        word.fetch_and(~bit, std::memory_order_relaxed);
+    }
+}
+
+void RateFrameWriter::write(int64_t timestamp, const float* values)
+{
+    if (header == nullptr)
+    {
+        return;
+    }
+
+    uint64_t frame = numWritten;
+    RateFrameHeader* frameHeader = reinterpret_cast<RateFrameHeader*>(
+        frames + static_cast<size_t>(frame % header->capacity) * header->frameBytes);
+
+    // mark the frame as being written before touching its contents
+    frameHeader->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    frameHeader->timestamp = timestamp;
+    std::memcpy(getFrameValues(frameHeader), values, header->numValues * sizeof(float));
+
+    frameHeader->sequence.store(2 * frame + 2, std::memory_order_release);
+    numWritten = frame + 1;
+    header->writeCount.store(numWritten, std::memory_order_release);
+}
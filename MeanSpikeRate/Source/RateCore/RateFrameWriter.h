@@ -0,0 +1,73 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RATE_FRAME_WRITER_H_INCLUDED
+#define RATE_FRAME_WRITER_H_INCLUDED
+
+#include "RateFrameRing.h"
+#include <string>
+
+/* Creates a POSIX shared memory region with the RateFrameRing layout and writes rate
+ * frames into it, as the only writer. open and close allocate and make system calls;
+ * everything else is safe to call on the audio thread (write only copies the values and
+ * never waits for readers).
+ *
+ * Not available on Windows, where open always fails.
+ */
+class RateFrameWriter
+{
+public:
+    RateFrameWriter();
+    ~RateFrameWriter();
+
+    // name must start with a '/' (e.g. "/msr-105"). An existing region of the same name is replaced.
+    // returns false (leaving the writer closed) if the region could not be created.
+    bool open(const std::string& name, int numSources, int numTimeConsts, int numChannels,
+        int capacity, double sampleRate);
+
+    // unmaps and removes the region (readers that still have it mapped can finish reading it)
+    void close();
+
+    bool isOpen() const;
+    const std::string& getName() const;
+    int getNumValues() const;
+
+    // visible to readers from the next frame on
+    void setChannelEnabled(int channel, bool enabled);
+
+    // values must hold getNumValues() floats
+    void write(int64_t timestamp, const float* values);
+
+private:
+    RateFrameRing::RateFrameRingHeader* header;
+    std::atomic<uint32_t>* channelWords;
+    char* frames;
+    uint64_t numWritten;
+    std::string name;
+
+    // not copyable
+    RateFrameWriter(const RateFrameWriter&) = delete;
+    RateFrameWriter& operator=(const RateFrameWriter&) = delete;
+};
+
+#endif // RATE_FRAME_WRITER_H_INCLUDED
@@ -0,0 +1,196 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "RateKernels.h"
+#include <algorithm>
+
+const char* getKernelName(RateKernelType type)
+{
+    switch (type)
+    {
+    case KERNEL_EXPONENTIAL: return "Exponential";
+    case KERNEL_ALPHA:       return "Alpha";
+    case KERNEL_GAMMA:       return "Gamma";
+    case KERNEL_GAUSSIAN:    return "Gaussian";
+    case KERNEL_BOXCAR:      return "Boxcar";
+    default:                 return "";
+    }
+}
+
+/*** ExponentialKernel ***/
+
+const double ExponentialKernel::MIN_VALUE = 1e-30;
+
+void ExponentialKernel::setNumStates(int numStates, int numTimeConsts)
+{
+    decayTables.assign(numTimeConsts, DecayPowerTable());
+    logDecays.assign(numTimeConsts, 0.0);
+    subSampleDecays.assign(numTimeConsts * SpikeTimeMapping::SUB_SAMPLE_STEPS, 1.0);
+    means.assign(numStates, 0.0);
+}
+
+void ExponentialKernel::setTimeConstant(int timeConst, double timeConstSamples, bool exact)
+{
+    double decay = std::exp(-1 / timeConstSamples);
+    DecayPowerTable& decayTable = decayTables[timeConst];
+    if (decay == decayTable.getDecay() && (decayTable.isExact() || !exact))
+    {
+        return;
+    }
+
+    decayTable.setDecay(decay, exact);
+    logDecays[timeConst] = -1 / timeConstSamples;
+    DecayPowerTable::computeFractionalPowers(decay, SpikeTimeMapping::SUB_SAMPLE_STEPS,
+        subSampleDecays.data() + timeConst * SpikeTimeMapping::SUB_SAMPLE_STEPS, exact);
+}
+
+void ExponentialKernel::reset()
+{
+    means.assign(means.size(), 0.0);
+}
+
+/*** BoxcarKernel ***/
+
+void BoxcarKernel::setNumStates(int numStates, int numTimeConsts)
+{
+    windowLengths.assign(numTimeConsts, 1);
+
+    Window empty;
+    empty.ring.resize(MIN_CAPACITY);
+    empty.head = 0;
+    empty.size = 0;
+    empty.sum = 0.0;
+    empty.currSample = 0;
+    windows.assign(numStates, empty);
+    statesPerTimeConst = numStates / numTimeConsts;
+    numDropped = 0;
+}
+
+void BoxcarKernel::setTimeConstant(int timeConst, double timeConstSamples, bool)
+{
+    windowLengths[timeConst] = std::max(1LL, static_cast<long long>(timeConstSamples + 0.5));
+}
+
+void BoxcarKernel::fill(int state, int, float* out, int n, double outputScale)
+{
+    Window& window = windows[state];
+    long long start = window.currSample;
+    long long end = start + n;
+    int mask = static_cast<int>(window.ring.size()) - 1;
+
+    // output is constant between the times spikes leave the window. spikes that leave
+    // at the end sample are removed too, so that the window's sum is the value of that sample.
+    long long curr = start;
+    while (window.size > 0 && window.ring[window.head].expiry <= end)
+    {
+        const WindowSpike& spike = window.ring[window.head];
+        if (out != nullptr && spike.expiry > curr)
+        {
+            std::fill(out + (curr - start), out + (spike.expiry - start), static_cast<float>(window.sum * outputScale));
+        }
+        curr = std::max(curr, spike.expiry);
+
+        window.sum -= spike.amp;
+        window.head = (window.head + 1) & mask;
+        if (--window.size == 0)
+        {
+            window.sum = 0.0;
+        }
+    }
+
+    if (out != nullptr)
+    {
+        std::fill(out + (curr - start), out + n, static_cast<float>(window.sum * outputScale));
+    }
+    window.currSample = end;
+}
+
+void BoxcarKernel::addSpike(int state, int timeConst, double amp, int)
+{
+    Window& window = windows[state];
+    int capacity = static_cast<int>(window.ring.size());
+    if (window.size == capacity)
+    {
+        ++numDropped;
+        return;
+    }
+
+    // the window may have been shortened, so keep expiries nondecreasing
+    long long expiry = window.currSample + windowLengths[timeConst];
+    if (window.size > 0)
+    {
+        int last = (window.head + window.size - 1) & (capacity - 1);
+        expiry = std::max(expiry, window.ring[last].expiry);
+    }
+
+    WindowSpike& spike = window.ring[(window.head + window.size) & (capacity - 1)];
+    spike.expiry = expiry;
+    spike.amp = amp;
+    ++window.size;
+    window.sum += amp;
+}
+
+void BoxcarKernel::setMaxSpikes(int timeConst, double maxSpikes)
+{
+    int capacity = MIN_CAPACITY;
+    while (capacity < MAX_CAPACITY && capacity < maxSpikes + 1)
+    {
+        capacity *= 2;
+    }
+
+    for (int state = timeConst * statesPerTimeConst; state < (timeConst + 1) * statesPerTimeConst; ++state)
+    {
+        Window& window = windows[state];
+        int oldCapacity = static_cast<int>(window.ring.size());
+        if (oldCapacity >= capacity)
+        {
+            continue;
+        }
+
+        // unroll into the larger ring
+        std::vector<WindowSpike> newRing(capacity);
+        for (int k = 0; k < window.size; ++k)
+        {
+            newRing[k] = window.ring[(window.head + k) & (oldCapacity - 1)];
+        }
+        window.ring.swap(newRing);
+        window.head = 0;
+    }
+}
+
+int BoxcarKernel::getAndResetNumDropped()
+{
+    int dropped = numDropped;
+    numDropped = 0;
+    return dropped;
+}
+
+void BoxcarKernel::reset()
+{
+    for (Window& window : windows)
+    {
+        window.head = 0;
+        window.size = 0;
+        window.sum = 0.0;
+    }
+}
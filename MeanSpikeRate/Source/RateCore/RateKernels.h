@@ -0,0 +1,358 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RATE_KERNELS_H_INCLUDED
+#define RATE_KERNELS_H_INCLUDED
+
+#include "DecayKernel.h"
+#include "SpikeTimeMapping.h"
+#include <climits>
+#include <cmath>
+#include <vector>
+
+/* Smoothing kernels for RateEngine. A kernel holds the value of each state and is
+ * responsible for advancing it over runs of samples without spikes and for adding
+ * spikes to it. RateEngine takes the kernel as a template parameter, so the calls below
+ * are resolved (and inlined) at compile time, and each kernel's inner loop is
+ * specialised for it.
+ *
+ * Each kernel integrates to one (in Hz * seconds), so at a steady spike rate the average
+ * output equals the rate whatever the kernel. Kernels implement:
+ *
+ *   void setNumStates(int numStates, int numTimeConsts)     - allocates and resets
+ *   void setTimeConstant(int timeConst, double timeConstSamples, bool exact)
+ *                                                           - exact = false while the time constant
+ *                                                             is ramping (see DecayPowerTable)
+ *   void fill(int state, int timeConst, float* out, int n, double outputScale)
+ *                                                           - advance n samples, writing them
+ *                                                             times outputScale to out unless
+ *                                                             it is null
+ *   void addSpike(int state, int timeConst, double amp, int subSample)
+ *                                                           - amp = gain / time const (s)
+ *   void setMaxSpikes(int timeConst, double maxSpikes)      - most spikes a state is expected to
+ *                                                             receive within one time constant
+ *   int getAndResetNumDropped()                             - spikes dropped because of it
+ *   void finishBlock(int state)
+ *   double getValue(int state) const
+ *   void reset()
+ *
+ * and, if HAS_ANALYTIC_CROSSINGS (otherwise it is never called):
+ *
+ *   int getSamplesUntilBelow(int state, int timeConst, double level) const
+ *                      - number of samples after the current one at which the value first
+ *                        falls below level without further spikes (0 if it is already below)
+ */
+
+enum RateKernelType
+{
+    KERNEL_EXPONENTIAL, // first-order exponential decay
+    KERNEL_ALPHA,       // 2-stage exponential cascade
+    KERNEL_GAMMA,       // 4-stage exponential cascade
+    KERNEL_GAUSSIAN,    // 8-stage exponential cascade (approximately a causal, delayed Gaussian)
+    KERNEL_BOXCAR,      // number of spikes in a sliding window
+    NUM_KERNEL_TYPES
+};
+
+const char* getKernelName(RateKernelType type);
+
+/* Exponentially weighted moving average: each spike adds its amplitude, which then decays
+ * by a constant factor per sample. Runs are filled in closed form with a DecayPowerTable.
+ * Spikes with a sub-sample offset are decayed by that fraction of a sample, using a table
+ * per time constant that is only recomputed when the decay changes.
+ */
+class ExponentialKernel
+{
+public:
+    // values smaller than this are flushed to zero at the end of each block
+    static const double MIN_VALUE;
+
+    // without spikes the value only decreases, so its crossings can be solved for
+    static const bool HAS_ANALYTIC_CROSSINGS = true;
+
+    void setNumStates(int numStates, int numTimeConsts);
+    void setTimeConstant(int timeConst, double timeConstSamples, bool exact);
+
+    void fill(int state, int timeConst, float* out, int n, double outputScale)
+    {
+        const DecayPowerTable& decayTable = decayTables[timeConst];
+        if (out != nullptr)
+        {
+            means[state] = decayTable.fill(out, n, means[state], outputScale);
+        }
+        else
+        {
+            means[state] *= decayTable.getPower(n);
+        }
+    }
+
+    void addSpike(int state, int timeConst, double amp, int subSample)
+    {
+        if (subSample != 0)
+        {
+            amp *= subSampleDecays[timeConst * SpikeTimeMapping::SUB_SAMPLE_STEPS + subSample];
+        }
+        means[state] += amp;
+    }
+
+    void setMaxSpikes(int, double) {}
+
+    int getAndResetNumDropped()
+    {
+        return 0;
+    }
+
+    void finishBlock(int state)
+    {
+        if (means[state] < MIN_VALUE)
+        {
+            means[state] = 0.0;
+        }
+    }
+
+    double getValue(int state) const
+    {
+        return means[state];
+    }
+
+    int getSamplesUntilBelow(int state, int timeConst, double level) const
+    {
+        double value = means[state];
+        if (value < level)
+        {
+            return 0;
+        }
+        if (level <= 0 || logDecays[timeConst] == 0) // (no time constant set yet)
+        {
+            return INT_MAX;
+        }
+
+        // smallest n with value * decay^n < level
+        double n = std::floor(std::log(level / value) / logDecays[timeConst]) + 1;
+        return n < INT_MAX ? static_cast<int>(n) : INT_MAX;
+    }
+
+    void reset();
+
+private:
+    // per time constant
+    std::vector<DecayPowerTable> decayTables;
+    std::vector<double> logDecays;
+    std::vector<double> subSampleDecays; // decay^(k / SUB_SAMPLE_STEPS), SUB_SAMPLE_STEPS entries per time constant
+
+    // per state
+    std::vector<double> means;
+};
+
+/* Cascade of NUM_STAGES exponential stages with equal time constants, the first driven
+ * by the spikes and each of the others by the previous one; the output is the last
+ * stage. The impulse response is a gamma kernel (alpha kernel for 2 stages), which
+ * rises smoothly and peaks some time after the spike, approaching a Gaussian as the
+ * number of stages increases. The time constant of each stage is the given time
+ * constant / NUM_STAGES, so that the mean delay of the kernel equals the time constant.
+ *
+ * All stages are updated together in one pass over the samples.
+ */
+template <int NUM_STAGES>
+class CascadeKernel
+{
+public:
+    static const bool HAS_ANALYTIC_CROSSINGS = false;
+
+    void setNumStates(int numStates, int numTimeConsts)
+    {
+        decays.assign(numTimeConsts, 0.0);
+        subSampleDecays.assign(numTimeConsts * SpikeTimeMapping::SUB_SAMPLE_STEPS, 1.0);
+        stages.assign(numStates * NUM_STAGES, 0.0);
+    }
+
+    void setTimeConstant(int timeConst, double timeConstSamples, bool exact)
+    {
+        double decay = std::exp(-NUM_STAGES / timeConstSamples);
+        decays[timeConst] = decay;
+        DecayPowerTable::computeFractionalPowers(decay, SpikeTimeMapping::SUB_SAMPLE_STEPS,
+            subSampleDecays.data() + timeConst * SpikeTimeMapping::SUB_SAMPLE_STEPS, exact);
+    }
+
+    void fill(int state, int timeConst, float* out, int n, double outputScale)
+    {
+        // y[k] <- d * y[k] + (1 - d) * y[k - 1], which keeps the integral of each stage
+        // equal to that of the first
+        double decay = decays[timeConst];
+        double gain = 1 - decay;
+        double y[NUM_STAGES];
+        double* stateStages = stages.data() + state * NUM_STAGES;
+        for (int stage = 0; stage < NUM_STAGES; ++stage)
+        {
+            y[stage] = stateStages[stage];
+        }
+
+        for (int samp = 0; samp < n; ++samp)
+        {
+            if (out != nullptr)
+            {
+                out[samp] = static_cast<float>(y[NUM_STAGES - 1] * outputScale);
+            }
+
+            for (int stage = NUM_STAGES - 1; stage > 0; --stage)
+            {
+                y[stage] = decay * y[stage] + gain * y[stage - 1];
+            }
+            y[0] *= decay;
+        }
+
+        for (int stage = 0; stage < NUM_STAGES; ++stage)
+        {
+            stateStages[stage] = y[stage];
+        }
+    }
+
+    void addSpike(int state, int timeConst, double amp, int subSample)
+    {
+        // the first stage's integral is amp / (1 - d) samples, i.e. amp * (time const / NUM_STAGES)
+        amp *= NUM_STAGES;
+        if (subSample != 0)
+        {
+            amp *= subSampleDecays[timeConst * SpikeTimeMapping::SUB_SAMPLE_STEPS + subSample];
+        }
+        stages[state * NUM_STAGES] += amp;
+    }
+
+    void setMaxSpikes(int, double) {}
+
+    int getAndResetNumDropped()
+    {
+        return 0;
+    }
+
+    void finishBlock(int state)
+    {
+        double* stateStages = stages.data() + state * NUM_STAGES;
+        for (int stage = 0; stage < NUM_STAGES; ++stage)
+        {
+            if (stateStages[stage] < ExponentialKernel::MIN_VALUE)
+            {
+                stateStages[stage] = 0.0;
+            }
+        }
+    }
+
+    double getValue(int state) const
+    {
+        return stages[state * NUM_STAGES + NUM_STAGES - 1];
+    }
+
+    int getSamplesUntilBelow(int, int, double) const
+    {
+        return INT_MAX;
+    }
+
+    void reset()
+    {
+        stages.assign(stages.size(), 0.0);
+    }
+
+private:
+    // per time constant
+    std::vector<double> decays;          // per stage, per sample
+    std::vector<double> subSampleDecays;
+
+    // per state
+    std::vector<double> stages;
+};
+
+/* Number of spikes in a sliding window of the last (time constant) samples, divided by
+ * the window length. Each state keeps a ring buffer of the spikes in its window, in
+ * order of the sample at which they leave it, so each spike costs O(1) to add and
+ * later remove. Between these events the output is constant. The ring buffers are
+ * sized for setMaxSpikes when it or the time constant is set (they only grow, up to
+ * MAX_CAPACITY), and spikes that arrive while a window is full are dropped and counted,
+ * so adding a spike never allocates.
+ *
+ * Changing the window length applies to spikes added afterwards. Sub-sample offsets
+ * are ignored.
+ */
+class BoxcarKernel
+{
+public:
+    // ring buffer size per state
+    static const int MIN_CAPACITY = 64;
+    static const int MAX_CAPACITY = 1 << 16;
+
+    static const bool HAS_ANALYTIC_CROSSINGS = false;
+
+    void setNumStates(int numStates, int numTimeConsts);
+    void setTimeConstant(int timeConst, double timeConstSamples, bool exact);
+
+    void fill(int state, int timeConst, float* out, int n, double outputScale);
+    void addSpike(int state, int timeConst, double amp, int subSample);
+
+    void setMaxSpikes(int timeConst, double maxSpikes);
+    int getAndResetNumDropped();
+
+    void finishBlock(int state)
+    {
+        // sums are adjusted incrementally, so reset exactly when the window is empty
+        if (windows[state].size == 0)
+        {
+            windows[state].sum = 0.0;
+        }
+    }
+
+    double getValue(int state) const
+    {
+        return windows[state].sum;
+    }
+
+    int getSamplesUntilBelow(int, int, double) const
+    {
+        return INT_MAX;
+    }
+
+    void reset();
+
+private:
+    struct WindowSpike
+    {
+        long long expiry;   // first sample at which the spike is no longer in the window
+        double amp;
+    };
+
+    struct Window
+    {
+        std::vector<WindowSpike> ring;  // size is a power of 2
+        int head;
+        int size;
+        double sum;
+        long long currSample;
+    };
+
+    // per time constant
+    std::vector<long long> windowLengths;
+
+    // per state
+    std::vector<Window> windows;
+    int statesPerTimeConst;
+    int numDropped;
+};
+
+#endif // RATE_KERNELS_H_INCLUDED
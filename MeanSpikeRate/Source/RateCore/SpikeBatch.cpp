@@ -0,0 +1,132 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SpikeBatch.h"
+#include <algorithm>
+
+SpikeBatch::SpikeBatch(int capacity)
+    : numSpikes     (0)
+    , numDropped    (0)
+    , sorted        (true)
+{
+    setCapacity(capacity);
+}
+
+void SpikeBatch::setCapacity(int capacity)
+{
+    spikes.resize(capacity > 0 ? capacity : 0);
+    scratch.resize(spikes.size());
+    numSpikes = std::min(numSpikes, getCapacity());
+}
+
+int SpikeBatch::getCapacity() const
+{
+    return static_cast<int>(spikes.size());
+}
+
+void SpikeBatch::clear()
+{
+    numSpikes = 0;
+    sorted = true;
+}
+
+bool SpikeBatch::add(int samplePosition, int source, int subSample, float weight)
+{
+    if (numSpikes == getCapacity())
+    {
+        ++numDropped;
+        return false;
+    }
+
+    if (numSpikes > 0 && samplePosition < spikes[numSpikes - 1].samplePosition)
+    {
+        sorted = false;
+    }
+
+    Spike& spike = spikes[numSpikes++];
+    spike.samplePosition = samplePosition;
+    spike.source = source;
+    spike.subSample = subSample;
+    spike.weight = weight;
+    return true;
+}
+
+void SpikeBatch::prepare(int numSamples)
+{
+    int lastSample = numSamples > 0 ? numSamples - 1 : 0;
+    for (int kSpike = 0; kSpike < numSpikes; ++kSpike)
+    {
+        Spike& spike = spikes[kSpike];
+        if (spike.samplePosition > lastSample)
+        {
+            // mapped past the end of the block from another sample rate
+            spike.samplePosition = lastSample;
+            spike.subSample = 0;
+        }
+        else if (spike.samplePosition < 0)
+        {
+            spike.samplePosition = 0;
+        }
+    }
+
+    if (!sorted)
+    {
+        // bottom-up merge sort into the preallocated scratch buffer (std::stable_sort may allocate)
+        auto byPosition = [](const Spike& a, const Spike& b) { return a.samplePosition < b.samplePosition; };
+        Spike* src = spikes.data();
+        Spike* dst = scratch.data();
+        for (int width = 1; width < numSpikes; width *= 2)
+        {
+            for (int start = 0; start < numSpikes; start += 2 * width)
+            {
+                int mid = std::min(start + width, numSpikes);
+                int end = std::min(start + 2 * width, numSpikes);
+                std::merge(src + start, src + mid, src + mid, src + end, dst + start, byPosition);
+            }
+            std::swap(src, dst);
+        }
+
+        if (src != spikes.data())
+        {
+            std::copy(src, src + numSpikes, spikes.data());
+        }
+        sorted = true;
+    }
+}
+
+int SpikeBatch::size() const
+{
+    return numSpikes;
+}
+
+const SpikeBatch::Spike& SpikeBatch::operator[](int index) const
+{
+    return spikes[index];
+}
+
+int SpikeBatch::getAndResetNumDropped()
+{
+    int dropped = numDropped;
+    numDropped = 0;
+    return dropped;
+}
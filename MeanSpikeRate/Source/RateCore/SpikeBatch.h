@@ -0,0 +1,76 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SPIKE_BATCH_H_INCLUDED
+#define SPIKE_BATCH_H_INCLUDED
+
+#include <vector>
+
+/* Fixed-capacity list of the spikes in one block, collected in arrival order and then
+ * sorted by sample position so that they can be processed in a single pass. Spikes
+ * from merged streams may arrive out of order; sorting is stable, so spikes at the
+ * same sample keep their arrival order.
+ *
+ * Only setCapacity allocates (sorting uses a preallocated scratch buffer). Spikes beyond
+ * the capacity are dropped and counted.
+ */
+class SpikeBatch
+{
+public:
+    struct Spike
+    {
+        int samplePosition;
+        int source;
+        int subSample;   // see SpikeTimeMapping
+        float weight;    // multiplies the spike's contribution (e.g. its electrode's weight in the mean)
+    };
+
+    explicit SpikeBatch(int capacity = 0);
+
+    // not for use on the audio thread
+    void setCapacity(int capacity);
+    int getCapacity() const;
+
+    void clear();
+
+    // returns false if the batch is full
+    bool add(int samplePosition, int source, int subSample = 0, float weight = 1.0f);
+
+    // sorts by sample position and clamps positions to [0, numSamples)
+    void prepare(int numSamples);
+
+    int size() const;
+    const Spike& operator[](int index) const;
+
+    // number of spikes dropped since the last call
+    int getAndResetNumDropped();
+
+private:
+    std::vector<Spike> spikes;
+    std::vector<Spike> scratch;  // for sorting
+    int numSpikes;
+    int numDropped;
+    bool sorted;       // whether spikes have been added in order so far
+};
+
+#endif // SPIKE_BATCH_H_INCLUDED
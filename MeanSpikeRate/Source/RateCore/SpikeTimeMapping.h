@@ -0,0 +1,87 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SPIKE_TIME_MAPPING_H_INCLUDED
+#define SPIKE_TIME_MAPPING_H_INCLUDED
+
+#include <cmath>
+
+/* Maps the sample position of a spike within a block, in the sample rate of the stream
+ * it was detected on, to a position in an output block with a different sample rate
+ * (both blocks covering the same span of time).
+ *
+ * A spike that falls between two output samples is placed on the later one, along with
+ * the fraction of a sample by which it precedes it (quantized to SUB_SAMPLE_STEPS), so
+ * that the estimator can decay its contribution by exactly that much.
+ */
+class SpikeTimeMapping
+{
+public:
+    static const int SUB_SAMPLE_STEPS = 256;
+
+    SpikeTimeMapping()
+        : ratio     (1.0)
+        , identity  (true)
+    {}
+
+    void setSampleRates(double spikeSampleRate, double outputSampleRate)
+    {
+        identity = spikeSampleRate == outputSampleRate || spikeSampleRate <= 0;
+        ratio = identity ? 1.0 : outputSampleRate / spikeSampleRate;
+    }
+
+    bool isIdentity() const
+    {
+        return identity;
+    }
+
+    // subSample is in units of 1 / SUB_SAMPLE_STEPS samples, in [0, SUB_SAMPLE_STEPS)
+    void map(int spikePosition, int* outputPosition, int* subSample) const
+    {
+        if (identity)
+        {
+            *outputPosition = spikePosition;
+            *subSample = 0;
+            return;
+        }
+
+        double exactPosition = spikePosition * ratio;
+        double outPos = std::ceil(exactPosition);
+        int steps = static_cast<int>((outPos - exactPosition) * SUB_SAMPLE_STEPS + 0.5);
+        if (steps == SUB_SAMPLE_STEPS)
+        {
+            // rounds to exactly one sample before outPos
+            outPos -= 1;
+            steps = 0;
+        }
+
+        *outputPosition = static_cast<int>(outPos);
+        *subSample = steps;
+    }
+
+private:
+    double ratio;    // output samples per spike stream sample
+    bool identity;
+};
+
+#endif // SPIKE_TIME_MAPPING_H_INCLUDED
@@ -0,0 +1,81 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TimeConstRamp.h"
+#include <cmath>
+
+TimeConstRamp::TimeConstRamp()
+    : rampLength    (0)
+    , startValue    (0)
+    , targetValue   (0)
+    , currValue     (0)
+    , rampPosition  (0)
+{}
+
+void TimeConstRamp::setRampLength(int numSamples)
+{
+    rampLength = numSamples > 0 ? numSamples : 0;
+}
+
+void TimeConstRamp::setTarget(double target)
+{
+    if (target == targetValue)
+    {
+        return;
+    }
+
+    targetValue = target;
+    if (rampLength == 0 || currValue <= 0 || target <= 0)
+    {
+        currValue = target;
+        rampPosition = rampLength;
+    }
+    else
+    {
+        startValue = currValue;
+        rampPosition = 0;
+    }
+}
+
+double TimeConstRamp::getTarget() const
+{
+    return targetValue;
+}
+
+double TimeConstRamp::nextBlock(int numSamples)
+{
+    double value = currValue;
+    if (isRamping())
+    {
+        rampPosition += numSamples;
+        currValue = rampPosition >= rampLength
+            ? targetValue
+            : startValue * std::pow(targetValue / startValue, static_cast<double>(rampPosition) / rampLength);
+    }
+    return value;
+}
+
+bool TimeConstRamp::isRamping() const
+{
+    return currValue != targetValue;
+}
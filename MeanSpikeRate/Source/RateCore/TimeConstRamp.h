@@ -0,0 +1,60 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef TIME_CONST_RAMP_H_INCLUDED
+#define TIME_CONST_RAMP_H_INCLUDED
+
+/* Moves a time constant (or other positive parameter) to a new target value along a
+ * geometric ramp over a given number of samples, so that changing it does not cause a
+ * discontinuity in the output. The value is held for each block, i.e. the ramp is a
+ * staircase with one step per block.
+ *
+ * A geometric ramp changes the value by the same factor on each step, so e.g. going
+ * from 10 ms to 1000 ms spends as long between 10 and 100 ms as between 100 and 1000.
+ */
+class TimeConstRamp
+{
+public:
+    TimeConstRamp();
+
+    // 0 = jump to a new target immediately
+    void setRampLength(int numSamples);
+
+    // starts a ramp from the current value (the first target is applied immediately)
+    void setTarget(double target);
+    double getTarget() const;
+
+    // returns the value to use for the next block of numSamples, and advances the ramp
+    double nextBlock(int numSamples);
+
+    bool isRamping() const;
+
+private:
+    int rampLength;
+    double startValue;
+    double targetValue;
+    double currValue;
+    long long rampPosition;   // samples since the ramp started
+};
+
+#endif // TIME_CONST_RAMP_H_INCLUDED
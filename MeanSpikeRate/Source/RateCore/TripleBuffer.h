@@ -0,0 +1,89 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef TRIPLE_BUFFER_H_INCLUDED
+#define TRIPLE_BUFFER_H_INCLUDED
+
+#include <atomic>
+
+/* Hands a value from one writer thread to one reader thread without locking or
+ * waiting on either side. The writer publishes complete values; the reader picks up
+ * the most recently published one whenever it calls update (e.g. at the start of each
+ * block) and sees a consistent, unchanging value in between.
+ *
+ * Three copies of the value are kept: one owned by each side, and one in the middle
+ * that they atomically swap with theirs.
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+    explicit TripleBuffer(const T& initialValue = T())
+        : writeIndex    (0)
+        , middle        (1)
+        , readIndex     (2)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            buffers[i] = initialValue;
+        }
+    }
+
+    // writer side
+    void publish(const T& value)
+    {
+        buffers[writeIndex] = value;
+        int prev = middle.exchange(writeIndex | NEW_DATA, std::memory_order_acq_rel);
+        writeIndex = prev & INDEX_MASK;
+    }
+
+    // reader side: returns true if a new value was picked up
+    bool update()
+    {
+        if ((middle.load(std::memory_order_relaxed) & NEW_DATA) == 0)
+        {
+            return false;
+        }
+
+        int prev = middle.exchange(readIndex, std::memory_order_acq_rel);
+        readIndex = prev & INDEX_MASK;
+        return true;
+    }
+
+    // reader side: the value picked up by the last update
+    const T& get() const
+    {
+        return buffers[readIndex];
+    }
+
+private:
+    static const int INDEX_MASK = 3;
+    static const int NEW_DATA = 4;
+
+    T buffers[3];
+    int writeIndex;             // owned by the writer
+    std::atomic<int> middle;    // index | NEW_DATA if published since the last update
+    int readIndex;              // owned by the reader
+};
+
+#endif // TRIPLE_BUFFER_H_INCLUDED
@@ -0,0 +1,310 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "UnitRateTable.h"
+#include "SpikeTimeMapping.h"
+#include <algorithm> // fill
+#include <cassert>
+#include <cmath>
+
+const double UnitRateTable::MIN_RATE = 1e-6;
+
+UnitRateTable::UnitRateTable()
+    : mask          (0)
+    , numUnits      (0)
+    , version       (0)
+    , numDropped    (0)
+{}
+
+void UnitRateTable::setCapacity(int maxUnits, int numTimeConsts)
+{
+    assert(maxUnits >= 0 && numTimeConsts > 0);
+
+    // keep the load factor at or below 1/2
+    size_t numBuckets = 4;
+    while (numBuckets < static_cast<size_t>(maxUnits) * 2)
+    {
+        numBuckets *= 2;
+    }
+    buckets.resize(numBuckets);
+    mask = numBuckets - 1;
+
+    timeConstsMs.assign(numTimeConsts, 0.0);
+    sampleRates.assign(numTimeConsts, 0.0);
+    spikeAmps.assign(numTimeConsts, 0.0);
+    decayTables.assign(numTimeConsts, DecayPowerTable());
+    subSampleDecays.assign(numTimeConsts * SpikeTimeMapping::SUB_SAMPLE_STEPS, 1.0);
+
+    slotKeys.resize(maxUnits);
+    lastSamples.resize(maxUnits);
+    rates.resize(maxUnits * numTimeConsts);
+    freeSlots.reserve(maxUnits);
+    reset();
+}
+
+int UnitRateTable::getCapacity() const
+{
+    return static_cast<int>(slotKeys.size());
+}
+
+int UnitRateTable::getNumTimeConsts() const
+{
+    return static_cast<int>(timeConstsMs.size());
+}
+
+void UnitRateTable::setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping)
+{
+    assert(timeConst >= 0 && timeConst < getNumTimeConsts());
+    assert(timeConstMs > 0 && sampleRate > 0);
+
+    if (timeConstMs == timeConstsMs[timeConst] && sampleRate == sampleRates[timeConst]
+        && (ramping || decayTables[timeConst].isExact()))
+    {
+        return;
+    }
+    timeConstsMs[timeConst] = timeConstMs;
+    sampleRates[timeConst] = sampleRate;
+
+    // same amplitude and decay as the estimator's exponential kernel
+    spikeAmps[timeConst] = 1000.0 / timeConstMs;
+    double decay = std::exp(-1000.0 / (timeConstMs * sampleRate));
+    decayTables[timeConst].setDecay(decay, !ramping);
+    DecayPowerTable::computeFractionalPowers(decay, SpikeTimeMapping::SUB_SAMPLE_STEPS,
+        subSampleDecays.data() + timeConst * SpikeTimeMapping::SUB_SAMPLE_STEPS, !ramping);
+}
+
+uint32_t UnitRateTable::makeKey(int electrode, int sortedId)
+{
+    assert(electrode >= 0 && electrode < 0x10000 && sortedId > 0 && sortedId < 0x10000);
+    return static_cast<uint32_t>(electrode) << 16 | static_cast<uint32_t>(sortedId);
+}
+
+int UnitRateTable::getElectrode(uint32_t key)
+{
+    return static_cast<int>(key >> 16);
+}
+
+int UnitRateTable::getSortedId(uint32_t key)
+{
+    return static_cast<int>(key & 0xffff);
+}
+
+int UnitRateTable::addSpike(uint32_t key, int64_t sample, int subSample)
+{
+    assert(subSample >= 0 && subSample < SpikeTimeMapping::SUB_SAMPLE_STEPS);
+
+    size_t bucket = findBucket(key);
+    int slot = buckets[bucket].slot;
+    if (slot == -1)
+    {
+        if (freeSlots.empty())
+        {
+            ++numDropped;
+            return -1;
+        }
+
+        // new unit, starting from 0 at this sample
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        buckets[bucket].key = key;
+        buckets[bucket].slot = slot;
+        slotKeys[slot] = key;
+        lastSamples[slot] = sample;
+        ++numUnits;
+        ++version;
+    }
+
+    int numTimeConsts = getNumTimeConsts();
+    double* unitRates = rates.data() + slot * numTimeConsts;
+    int64_t elapsed = sample - lastSamples[slot];
+    for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+    {
+        double amp = spikeAmps[timeConst];
+        if (subSample != 0)
+        {
+            amp *= subSampleDecays[timeConst * SpikeTimeMapping::SUB_SAMPLE_STEPS + subSample];
+        }
+
+        // bring the rate up to this spike, or an earlier spike forward to the rate's sample
+        const DecayPowerTable& decayTable = decayTables[timeConst];
+        if (elapsed >= 0)
+        {
+            unitRates[timeConst] = unitRates[timeConst] * decayTable.getPower(elapsed) + amp;
+        }
+        else
+        {
+            unitRates[timeConst] += amp * decayTable.getPower(-elapsed);
+        }
+    }
+
+    if (elapsed > 0)
+    {
+        lastSamples[slot] = sample;
+    }
+    return slot;
+}
+
+void UnitRateTable::readout(int64_t sample, float* values)
+{
+    int numSlots = getCapacity();
+    int numTimeConsts = getNumTimeConsts();
+    for (int slot = 0; slot < numSlots; ++slot)
+    {
+        float* slotValues = values + slot * numTimeConsts;
+        if (slotKeys[slot] == 0)
+        {
+            for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+            {
+                slotValues[timeConst] = 0;
+            }
+            continue;
+        }
+
+        // (a readout before the unit's last spike doesn't move the unit back)
+        double* unitRates = rates.data() + slot * numTimeConsts;
+        int64_t elapsed = sample - lastSamples[slot];
+        bool decayed = true;
+        for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+        {
+            if (elapsed > 0)
+            {
+                unitRates[timeConst] *= decayTables[timeConst].getPower(elapsed);
+            }
+            slotValues[timeConst] = static_cast<float>(unitRates[timeConst]);
+            decayed = decayed && unitRates[timeConst] < MIN_RATE;
+        }
+
+        if (elapsed > 0)
+        {
+            lastSamples[slot] = sample;
+        }
+
+        if (decayed)
+        {
+            removeUnit(slot);
+            for (int timeConst = 0; timeConst < numTimeConsts; ++timeConst)
+            {
+                slotValues[timeConst] = 0;
+            }
+        }
+    }
+}
+
+int UnitRateTable::getNumUnits() const
+{
+    return numUnits;
+}
+
+uint32_t UnitRateTable::getSlotKey(int slot) const
+{
+    return slotKeys[slot];
+}
+
+unsigned UnitRateTable::getVersion() const
+{
+    return version;
+}
+
+int64_t UnitRateTable::getAndResetNumDropped()
+{
+    int64_t dropped = numDropped;
+    numDropped = 0;
+    return dropped;
+}
+
+void UnitRateTable::reset()
+{
+    Bucket empty = { 0, -1 };
+    std::fill(buckets.begin(), buckets.end(), empty);
+    std::fill(slotKeys.begin(), slotKeys.end(), 0);
+    std::fill(lastSamples.begin(), lastSamples.end(), 0);
+    std::fill(rates.begin(), rates.end(), 0.0);
+
+    // lowest slots are used first
+    freeSlots.clear();
+    for (int slot = getCapacity() - 1; slot >= 0; --slot)
+    {
+        freeSlots.push_back(slot);
+    }
+
+    numUnits = 0;
+    ++version;
+    numDropped = 0;
+}
+
+// private
+
+uint32_t UnitRateTable::hash(uint32_t key)
+{
+    // murmur3 finalizer - sorted IDs are small, and the electrode is in the high bits
+    key ^= key >> 16;
+    key *= 0x85ebca6bU;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35U;
+    key ^= key >> 16;
+    return key;
+}
+
+size_t UnitRateTable::findBucket(uint32_t key) const
+{
+    // there is always an empty bucket, since the load factor is at most 1/2
+    size_t bucket = hash(key) & mask;
+    while (buckets[bucket].slot != -1 && buckets[bucket].key != key)
+    {
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+void UnitRateTable::removeUnit(int slot)
+{
+    size_t hole = findBucket(slotKeys[slot]);
+    assert(buckets[hole].slot == slot);
+
+    // backward-shift deletion: move later entries of the probe sequence into the hole
+    // (unless that would put them before their home bucket), so lookups never need tombstones
+    size_t bucket = hole;
+    while (true)
+    {
+        bucket = (bucket + 1) & mask;
+        if (buckets[bucket].slot == -1)
+        {
+            break;
+        }
+
+        size_t home = hash(buckets[bucket].key) & mask;
+        bool homeInRange = hole <= bucket ? (home > hole && home <= bucket) : (home > hole || home <= bucket);
+        if (!homeInRange)
+        {
+            buckets[hole] = buckets[bucket];
+            hole = bucket;
+        }
+    }
+    buckets[hole].slot = -1;
+
+    slotKeys[slot] = 0;
+    std::fill(rates.begin() + slot * getNumTimeConsts(), rates.begin() + (slot + 1) * getNumTimeConsts(), 0.0);
+    freeSlots.push_back(slot);
+    --numUnits;
+    ++version;
+}
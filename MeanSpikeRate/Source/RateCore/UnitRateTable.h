@@ -0,0 +1,123 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef UNIT_RATE_TABLE_H_INCLUDED
+#define UNIT_RATE_TABLE_H_INCLUDED
+
+#include "DecayKernel.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Exponentially weighted rates of sorted units (electrode + sorted ID), which appear as
+ * they first spike and are removed once their rate has decayed to nothing. Each unit has
+ * a slot (its position in the readout) that it keeps for as long as it is in the table.
+ *
+ * Units are found through an open-addressing hash table, and everything is allocated by
+ * setCapacity for a maximum number of units, so adding and removing units never allocates
+ * or rehashes. Spikes of units beyond the capacity are dropped and counted.
+ *
+ * Decay is applied lazily: each unit stores its rates as of the sample of its last spike
+ * (or readout), and is only decayed to the current sample when it spikes again or is read
+ * out. The cost is then in proportion to the number of spikes and readouts, not samples.
+ */
+class UnitRateTable
+{
+public:
+    UnitRateTable();
+
+    // not for use on the audio thread. removes all units.
+    void setCapacity(int maxUnits, int numTimeConsts);
+    int getCapacity() const;
+    int getNumTimeConsts() const;
+
+    // (only recomputes the decay if it has changed; approximately while ramping, as in RateEstimator).
+    // a change applies to the time since each unit's last spike or readout, like a change in the
+    // estimator applies from the next block.
+    void setTimeConstant(int timeConst, double timeConstMs, double sampleRate, bool ramping = false);
+
+    static uint32_t makeKey(int electrode, int sortedId);
+    static int getElectrode(uint32_t key);
+    static int getSortedId(uint32_t key);
+
+    // adds a spike at the given (absolute) output sample, subSample / SUB_SAMPLE_STEPS of a sample
+    // before it (see SpikeTimeMapping). spikes of a unit should be added in sample order, but an earlier
+    // one is still added with the right decay. returns the unit's slot, or -1 if the table is full.
+    int addSpike(uint32_t key, int64_t sample, int subSample = 0);
+
+    // writes the rate (Hz) of each slot at each time constant at the given sample, unit-major
+    // (values[slot * numTimeConsts + timeConst], 0 for empty slots), and removes units whose rates
+    // have all decayed below MIN_RATE.
+    void readout(int64_t sample, float* values);
+
+    int getNumUnits() const;
+
+    // key of the unit in the slot, or 0 if it is empty (sorted IDs are never 0)
+    uint32_t getSlotKey(int slot) const;
+
+    // changes whenever a unit is added or removed
+    unsigned getVersion() const;
+
+    // number of spikes dropped because the table was full, since the last call
+    int64_t getAndResetNumDropped();
+
+    // removes all units
+    void reset();
+
+    // units are removed once all of their rates are below this (Hz)
+    static const double MIN_RATE;
+
+private:
+    static uint32_t hash(uint32_t key);
+
+    // index of the key's bucket, or of the empty bucket where it would go
+    size_t findBucket(uint32_t key) const;
+    void removeUnit(int slot);
+
+    struct Bucket
+    {
+        uint32_t key;
+        int slot;           // -1 = empty
+    };
+
+    std::vector<Bucket> buckets;
+    size_t mask;
+    std::vector<int> freeSlots;     // stack
+    int numUnits;
+    unsigned version;
+    int64_t numDropped;
+
+    // per time constant
+    std::vector<double> timeConstsMs;
+    std::vector<double> sampleRates;
+    std::vector<double> spikeAmps;
+    std::vector<DecayPowerTable> decayTables;
+    std::vector<double> subSampleDecays; // SUB_SAMPLE_STEPS per time constant
+
+    // per slot
+    std::vector<uint32_t> slotKeys;
+    std::vector<int64_t> lastSamples;
+    std::vector<double> rates;          // unit-major
+};
+
+#endif // UNIT_RATE_TABLE_H_INCLUDED
@@ -0,0 +1,237 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "WaveformFeatures.h"
+#include <cassert>
+#include <cfloat>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MSR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define MSR_TARGET_AVX2
+#else
+#define MSR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define MSR_X86 0
+#endif
+
+namespace
+{
+    // minimum and maximum of n floats starting at an unaligned address
+    void minMaxScalar(const unsigned char* samples, int n, float* outMin, float* outMax)
+    {
+        float lo = *outMin;
+        float hi = *outMax;
+        for (int k = 0; k < n; ++k)
+        {
+            float value;
+            std::memcpy(&value, samples + k * sizeof(float), sizeof(float));
+            lo = value < lo ? value : lo;
+            hi = value > hi ? value : hi;
+        }
+        *outMin = lo;
+        *outMax = hi;
+    }
+
+#if MSR_X86
+    void minMaxSSE(const unsigned char* samples, int n, float* outMin, float* outMax)
+    {
+        int k = 0;
+        if (n >= 4)
+        {
+            __m128 lo = _mm_loadu_ps(reinterpret_cast<const float*>(samples));
+            __m128 hi = lo;
+            for (k = 4; k + 4 <= n; k += 4)
+            {
+                __m128 v = _mm_loadu_ps(reinterpret_cast<const float*>(samples + k * sizeof(float)));
+                lo = _mm_min_ps(lo, v);
+                hi = _mm_max_ps(hi, v);
+            }
+
+            // horizontal reduction
+            lo = _mm_min_ps(lo, _mm_movehl_ps(lo, lo));
+            lo = _mm_min_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+            hi = _mm_max_ps(hi, _mm_movehl_ps(hi, hi));
+            hi = _mm_max_ss(hi, _mm_shuffle_ps(hi, hi, 1));
+            float vecMin = _mm_cvtss_f32(lo);
+            float vecMax = _mm_cvtss_f32(hi);
+            *outMin = vecMin < *outMin ? vecMin : *outMin;
+            *outMax = vecMax > *outMax ? vecMax : *outMax;
+        }
+        minMaxScalar(samples + k * sizeof(float), n - k, outMin, outMax);
+    }
+
+    MSR_TARGET_AVX2
+    void minMaxAVX2(const unsigned char* samples, int n, float* outMin, float* outMax)
+    {
+        int k = 0;
+        if (n >= 8)
+        {
+            __m256 lo = _mm256_loadu_ps(reinterpret_cast<const float*>(samples));
+            __m256 hi = lo;
+            for (k = 8; k + 8 <= n; k += 8)
+            {
+                __m256 v = _mm256_loadu_ps(reinterpret_cast<const float*>(samples + k * sizeof(float)));
+                lo = _mm256_min_ps(lo, v);
+                hi = _mm256_max_ps(hi, v);
+            }
+
+            // horizontal reduction
+            __m128 lo4 = _mm_min_ps(_mm256_castps256_ps128(lo), _mm256_extractf128_ps(lo, 1));
+            __m128 hi4 = _mm_max_ps(_mm256_castps256_ps128(hi), _mm256_extractf128_ps(hi, 1));
+            lo4 = _mm_min_ps(lo4, _mm_movehl_ps(lo4, lo4));
+            lo4 = _mm_min_ss(lo4, _mm_shuffle_ps(lo4, lo4, 1));
+            hi4 = _mm_max_ps(hi4, _mm_movehl_ps(hi4, hi4));
+            hi4 = _mm_max_ss(hi4, _mm_shuffle_ps(hi4, hi4, 1));
+            float vecMin = _mm_cvtss_f32(lo4);
+            float vecMax = _mm_cvtss_f32(hi4);
+            *outMin = vecMin < *outMin ? vecMin : *outMin;
+            *outMax = vecMax > *outMax ? vecMax : *outMax;
+        }
+        minMaxScalar(samples + k * sizeof(float), n - k, outMin, outMax);
+    }
+#endif // MSR_X86
+
+    void minMax(const unsigned char* samples, int n, float* outMin, float* outMax, DecayKernel::Path path)
+    {
+        switch (path)
+        {
+#if MSR_X86
+        case DecayKernel::AVX2:
+            minMaxAVX2(samples, n, outMin, outMax);
+            break;
+
+        case DecayKernel::SSE:
+            minMaxSSE(samples, n, outMin, outMax);
+            break;
+#endif
+
+        default:
+            minMaxScalar(samples, n, outMin, outMax);
+            break;
+        }
+    }
+
+    // position of the first sample equal to value
+    int findSample(const unsigned char* samples, int n, float value)
+    {
+        for (int k = 0; k < n; ++k)
+        {
+            float sample;
+            std::memcpy(&sample, samples + k * sizeof(float), sizeof(float));
+            if (sample == value)
+            {
+                return k;
+            }
+        }
+        return 0;
+    }
+}
+
+/*** WaveformFeatures ***/
+
+WaveformFeatures WaveformFeatures::compute(const void* samples, int numChannels, int numSamples)
+{
+    return compute(samples, numChannels, numSamples, DecayKernel::getBestPath());
+}
+
+WaveformFeatures WaveformFeatures::compute(const void* samples, int numChannels, int numSamples, DecayKernel::Path path)
+{
+    assert(numChannels >= 0 && numSamples >= 0);
+
+    WaveformFeatures features = { 0.0f, 0.0f, 0 };
+    const unsigned char* bytes = static_cast<const unsigned char*>(samples);
+    size_t channelBytes = static_cast<size_t>(numSamples) * sizeof(float);
+    int widestChannel = -1;
+    float widestMin = 0;
+    float widestMax = 0;
+
+    for (int chan = 0; chan < numChannels; ++chan)
+    {
+        float lo = FLT_MAX;
+        float hi = -FLT_MAX;
+        minMax(bytes + chan * channelBytes, numSamples, &lo, &hi, path);
+        if (numSamples == 0)
+        {
+            continue;
+        }
+
+        float peak = hi > -lo ? hi : -lo;
+        features.peak = peak > features.peak ? peak : features.peak;
+        if (widestChannel == -1 || hi - lo > features.peakToTrough)
+        {
+            features.peakToTrough = hi - lo;
+            widestChannel = chan;
+            widestMin = lo;
+            widestMax = hi;
+        }
+    }
+
+    // only the widest channel needs the positions of its extremes
+    if (widestChannel != -1)
+    {
+        const unsigned char* channel = bytes + widestChannel * channelBytes;
+        int minPos = findSample(channel, numSamples, widestMin);
+        int maxPos = findSample(channel, numSamples, widestMax);
+        features.width = maxPos > minPos ? maxPos - minPos : minPos - maxPos;
+    }
+    return features;
+}
+
+/*** WaveformGate ***/
+
+WaveformGate::WaveformGate()
+    : minPeak           (0)
+    , maxPeak           (0)
+    , minPeakToTrough   (0)
+    , minWidth          (0)
+    , maxWidth          (0)
+{}
+
+bool WaveformGate::isActive() const
+{
+    return minPeak > 0 || maxPeak > 0 || minPeakToTrough > 0 || minWidth > 0 || maxWidth > 0;
+}
+
+bool WaveformGate::passes(const WaveformFeatures& features) const
+{
+    return (minPeak <= 0 || features.peak >= minPeak)
+        && (maxPeak <= 0 || features.peak <= maxPeak)
+        && (minPeakToTrough <= 0 || features.peakToTrough >= minPeakToTrough)
+        && (minWidth <= 0 || features.width >= minWidth)
+        && (maxWidth <= 0 || features.width <= maxWidth);
+}
+
+bool WaveformGate::operator==(const WaveformGate& other) const
+{
+    return minPeak == other.minPeak && maxPeak == other.maxPeak && minPeakToTrough == other.minPeakToTrough
+        && minWidth == other.minWidth && maxWidth == other.maxWidth;
+}
+
+bool WaveformGate::operator!=(const WaveformGate& other) const
+{
+    return !(*this == other);
+}
@@ -0,0 +1,72 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef WAVEFORM_FEATURES_H_INCLUDED
+#define WAVEFORM_FEATURES_H_INCLUDED
+
+#include "DecayKernel.h"
+
+/* Features of a spike waveform over all channels of its electrode, used to reject noise
+ * and artifact spikes:
+ *  - peak: the largest absolute sample value on any channel
+ *  - peakToTrough: the largest difference between the maximum and minimum of a channel
+ *  - width: the number of samples between the minimum and maximum of that channel
+ *
+ * The minimum and maximum of each channel are found with a vectorized scan (using the
+ * same paths as DecayKernel), directly on the samples as they are serialized in a spike
+ * event (numChannels runs of numSamples floats, which need not be aligned), so the event
+ * doesn't have to be deserialized or copied. The results are identical on every path.
+ */
+struct WaveformFeatures
+{
+    float peak;
+    float peakToTrough;
+    int width;
+
+    // samples: numChannels * numSamples floats (channel-major), at any alignment
+    static WaveformFeatures compute(const void* samples, int numChannels, int numSamples);
+    static WaveformFeatures compute(const void* samples, int numChannels, int numSamples, DecayKernel::Path path);
+};
+
+/* Limits on the waveform features of an electrode's spikes; spikes outside them don't count.
+ * A limit of 0 is no limit. */
+struct WaveformGate
+{
+    float minPeak;
+    float maxPeak;
+    float minPeakToTrough;
+    int minWidth;
+    int maxWidth;
+
+    WaveformGate();
+
+    // whether any limit is set (otherwise the features needn't be computed)
+    bool isActive() const;
+
+    bool passes(const WaveformFeatures& features) const;
+
+    bool operator==(const WaveformGate& other) const;
+    bool operator!=(const WaveformGate& other) const;
+};
+
+#endif // WAVEFORM_FEATURES_H_INCLUDED
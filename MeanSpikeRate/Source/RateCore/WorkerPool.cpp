@@ -0,0 +1,261 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "WorkerPool.h"
+#include <cassert>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h> // _mm_pause
+#define MSR_X86 1
+#else
+#define MSR_X86 0
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    // spins before yielding while waiting (roughly a few microseconds)
+    const int SPINS_BEFORE_YIELD = 2000;
+}
+
+WorkerPool::WorkerPool()
+    : numPinned     (0)
+    , runState      (0)
+    , job           (nullptr)
+    , numPending    (0)
+    , stopping      (false)
+    , numParked     (0)
+{}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::start(int numWorkers)
+{
+    assert(numWorkers >= 0 && numWorkers <= MAX_WORKERS);
+    stop();
+
+    numPinned = 0;
+    stopping = false;
+
+    // the workers start from the current run state, read here rather than once they are first scheduled,
+    // which could be after the first run has been published (and would then be taken as already seen)
+    unsigned seen = runState.load(std::memory_order_relaxed);
+    for (int worker = 0; worker < numWorkers; ++worker)
+    {
+        workers.push_back(std::thread(&WorkerPool::workerLoop, this, worker, seen));
+        if (pinToCpu(workers.back(), worker))
+        {
+            ++numPinned;
+        }
+    }
+}
+
+void WorkerPool::stop()
+{
+    stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(parkMutex);
+    }
+    parkCondition.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+}
+
+int WorkerPool::getNumWorkers() const
+{
+    return static_cast<int>(workers.size());
+}
+
+int WorkerPool::getNumPinned() const
+{
+    return numPinned;
+}
+
+int WorkerPool::getNumParked() const
+{
+    return numParked.load(std::memory_order_acquire);
+}
+
+void WorkerPool::run(Job& newJob, int newNumParts)
+{
+    assert(newNumParts >= 1 && newNumParts <= getNumWorkers() + 1);
+
+    job = &newJob;
+    numPending.store(newNumParts - 1, std::memory_order_relaxed);
+    unsigned runCount = (runState.load(std::memory_order_relaxed) >> 8) + 1;
+    runState.store((runCount << 8) | static_cast<unsigned>(newNumParts), std::memory_order_seq_cst);
+
+    // (a worker counts itself as parked before checking the run state for the last time, so one
+    // that is about to park either sees this run or is counted here)
+    if (numParked.load(std::memory_order_seq_cst) > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(parkMutex);
+        }
+        parkCondition.notify_all();
+    }
+
+    newJob.runPart(0);
+
+    // barrier: wait for the workers' parts
+    for (int spins = 0; numPending.load(std::memory_order_acquire) > 0; ++spins)
+    {
+        if (spins < SPINS_BEFORE_YIELD)
+        {
+            pause();
+        }
+        else
+        {
+            std::this_thread::yield(); // (e.g. more workers than free CPUs)
+        }
+    }
+}
+
+// private
+
+void WorkerPool::workerLoop(int worker, unsigned seen)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration parkAfter = std::chrono::milliseconds(PARK_AFTER_MS);
+
+    // (runs this worker sits out don't count as work, so it parks while they fall back to fewer parts)
+    Clock::time_point lastPart = Clock::now();
+    int spins = 0;
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        unsigned current = runState.load(std::memory_order_acquire);
+        if (current == seen)
+        {
+            if (spins < SPINS_BEFORE_YIELD)
+            {
+                ++spins;
+                pause();
+            }
+            else if (Clock::now() - lastPart < parkAfter)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                park(seen);
+            }
+            continue;
+        }
+
+        seen = current;
+
+        // workers beyond this run's parts sit it out
+        int part = worker + 1;
+        if (part < static_cast<int>(current & 0xff))
+        {
+            job->runPart(part);
+            numPending.fetch_sub(1, std::memory_order_acq_rel);
+            lastPart = Clock::now();
+            spins = 0;
+        }
+    }
+}
+
+void WorkerPool::park(unsigned seen)
+{
+    std::unique_lock<std::mutex> lock(parkMutex);
+    numParked.fetch_add(1, std::memory_order_seq_cst);
+    parkCondition.wait(lock, [this, seen]
+    {
+        return runState.load(std::memory_order_seq_cst) != seen || stopping.load(std::memory_order_seq_cst);
+    });
+    numParked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool WorkerPool::pinToCpu(std::thread& thread, int worker)
+{
+#if defined(_WIN32)
+    DWORD_PTR processMask, systemMask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) || processMask == 0)
+    {
+        return false;
+    }
+
+    // the (worker + 1)th allowed CPU, wrapping around
+    std::vector<DWORD_PTR> allowed;
+    for (int cpu = 0; cpu < static_cast<int>(sizeof(DWORD_PTR) * 8); ++cpu)
+    {
+        if (processMask & (static_cast<DWORD_PTR>(1) << cpu))
+        {
+            allowed.push_back(static_cast<DWORD_PTR>(1) << cpu);
+        }
+    }
+    DWORD_PTR mask = allowed[(worker + 1) % allowed.size()];
+    return SetThreadAffinityMask(thread.native_handle(), mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t processSet;
+    if (sched_getaffinity(0, sizeof(processSet), &processSet) != 0)
+    {
+        return false;
+    }
+
+    std::vector<int> allowed;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &processSet))
+        {
+            allowed.push_back(cpu);
+        }
+    }
+    if (allowed.empty())
+    {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(allowed[(worker + 1) % allowed.size()], &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    // (macOS only has affinity hints)
+    (void)thread;
+    (void)worker;
+    return false;
+#endif
+}
+
+void WorkerPool::pause()
+{
+#if MSR_X86
+    _mm_pause();
+#endif
+}
@@ -0,0 +1,108 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed pool of worker threads that run the parts of a job together with the calling
+ * (audio) thread, for work that has to finish within the call, e.g. one block of a
+ * ParallelRateEstimator.
+ *
+ * Nothing is locked or allocated per run: the caller publishes the job by bumping a
+ * run counter, runs part 0 itself and then spins on a countdown of the other
+ * parts (a one-shot barrier). Idle workers spin briefly and then yield rather than
+ * sleep, so they pick up a run within microseconds - at the cost of keeping their CPUs
+ * busy. A worker that hasn't had a part of a run for PARK_AFTER_MS parks on a condition
+ * variable instead, which run() only signals (locking for it) when some worker is parked;
+ * a run that wakes workers takes longer by their wake-up latency. So a pool that is used
+ * every buffer keeps its CPUs busy, and one whose runs fall back to fewer parts (or stop)
+ * releases the CPUs it doesn't use. Where the platform allows it, each worker is pinned
+ * to its own CPU (other than the first one the process may use, which is left to the caller).
+ */
+class WorkerPool
+{
+public:
+    class Job
+    {
+    public:
+        virtual ~Job() {}
+
+        // called with part = 0 on the calling thread and 1 ... numParts - 1 on the workers
+        virtual void runPart(int part) = 0;
+    };
+
+    WorkerPool();
+    ~WorkerPool();
+
+    // (the number of parts, workers + 1, has to fit in the low byte of the run state)
+    static const int MAX_WORKERS = 254;
+
+    // time without a part to run after which a worker stops spinning and sleeps until the next run
+    static const int PARK_AFTER_MS = 50;
+
+    // (re)starts the pool with the given number of worker threads; not for use on the audio thread
+    void start(int numWorkers);
+    void stop();
+
+    int getNumWorkers() const;
+
+    // number of workers that could be pinned to a CPU
+    int getNumPinned() const;
+
+    // number of workers sleeping until the next run
+    int getNumParked() const;
+
+    // runs numParts (<= number of workers + 1) parts of the job and returns when all are done
+    void run(Job& job, int numParts);
+
+private:
+    void workerLoop(int worker, unsigned seen);
+
+    // waits until the run state is no longer seen (or the pool is stopping)
+    void park(unsigned seen);
+
+    static bool pinToCpu(std::thread& thread, int worker);
+    static void pause();
+
+    std::vector<std::thread> workers;
+    std::atomic<int> numPinned;
+
+    // (run count << 8) | number of parts, written (after job) to start a run. the number of parts goes
+    // with the count so that a worker that sits out a run can't mistake the next run's for it.
+    std::atomic<unsigned> runState;
+    Job* job;
+    std::atomic<int> numPending;            // parts the workers have not finished yet
+    std::atomic<bool> stopping;
+
+    std::mutex parkMutex;
+    std::condition_variable parkCondition;
+    std::atomic<int> numParked;
+};
+
+#endif // WORKER_POOL_H_INCLUDED
@@ -0,0 +1,138 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SpikeChannelSelector.h"
+
+SpikeChannelSelector::SpikeChannelSelector(Listener* listener, int toggleWidth, int toggleHeight, int rowLength, int margin)
+    : listener      (listener)
+    , lastClicked   (-1)
+    , toggleWidth   (toggleWidth)
+    , toggleHeight  (toggleHeight)
+    , rowLength     (rowLength)
+    , margin        (margin)
+{
+    jassert(listener != nullptr && rowLength > 0);
+}
+
+void SpikeChannelSelector::setLabels(const StringArray& newLabels)
+{
+    labels = newLabels;
+    lastClicked = -1;
+
+    int numRows = (labels.size() + rowLength - 1) / rowLength;
+    setSize(margin * 2 + rowLength * toggleWidth, margin * 2 + numRows * toggleHeight);
+    repaint();
+}
+
+int SpikeChannelSelector::getNumChannels() const
+{
+    return labels.size();
+}
+
+int SpikeChannelSelector::getChannelAt(Point<int> position) const
+{
+    int x = position.x - margin;
+    int y = position.y - margin;
+    if (x < 0 || y < 0 || x >= rowLength * toggleWidth)
+    {
+        return -1;
+    }
+
+    int index = (y / toggleHeight) * rowLength + x / toggleWidth;
+    return index < labels.size() ? index : -1;
+}
+
+void SpikeChannelSelector::paint(Graphics& g)
+{
+    int numChannels = labels.size();
+    if (numChannels == 0)
+    {
+        return;
+    }
+
+    // only the rows that intersect the area being painted
+    Rectangle<int> clip = g.getClipBounds();
+    int firstRow = jmax(0, (clip.getY() - margin) / toggleHeight);
+    int lastRow = jmin((numChannels - 1) / rowLength, (clip.getBottom() - margin) / toggleHeight);
+
+    g.setFont(Font("Small Text", 10, Font::plain));
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        int end = jmin(numChannels, (row + 1) * rowLength);
+        for (int index = row * rowLength; index < end; ++index)
+        {
+            bool enabled = listener->isSpikeChannelEnabled(index);
+            Rectangle<float> bounds = getToggleBounds(index).toFloat().reduced(0.5f);
+
+            g.setColour(enabled ? Colours::orange : Colours::darkgrey);
+            g.fillRoundedRectangle(bounds, 3.0f);
+            g.setColour(Colours::black);
+            g.drawRoundedRectangle(bounds, 3.0f, 1.0f);
+
+            g.setColour(enabled ? Colours::black : Colours::white);
+            g.drawText(labels[index], bounds, Justification::centred, false);
+        }
+    }
+}
+
+void SpikeChannelSelector::mouseDown(const MouseEvent& event)
+{
+    int index = getChannelAt(event.getPosition());
+    if (index == -1)
+    {
+        return;
+    }
+
+    if (event.mods.isPopupMenu())
+    {
+        listener->spikeChannelRightClicked(index);
+        return;
+    }
+
+    bool enabled = !listener->isSpikeChannelEnabled(index);
+    if (event.mods.isShiftDown() && lastClicked != -1)
+    {
+        listener->spikeChannelsClicked(jmin(index, lastClicked), jmax(index, lastClicked), enabled);
+    }
+    else
+    {
+        listener->spikeChannelsClicked(index, index, enabled);
+    }
+    lastClicked = index;
+    repaint();
+}
+
+String SpikeChannelSelector::getTooltip()
+{
+    int index = getChannelAt(getMouseXYRelative());
+    return index == -1 ? String() : listener->getSpikeChannelTooltip(index);
+}
+
+// private
+
+Rectangle<int> SpikeChannelSelector::getToggleBounds(int index) const
+{
+    int row = index / rowLength;
+    int col = index % rowLength;
+    return Rectangle<int>(margin + col * toggleWidth, margin + row * toggleHeight, toggleWidth, toggleHeight);
+}
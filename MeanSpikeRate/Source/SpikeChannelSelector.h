@@ -0,0 +1,89 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SPIKE_CHANNEL_SELECTOR_H_INCLUDED
+#define SPIKE_CHANNEL_SELECTOR_H_INCLUDED
+
+#include <EditorHeaders.h>
+
+/* Grid of toggles for the spike channels (electrodes), one per channel in rows of a
+ * fixed length. The toggles are painted rather than being components of their own,
+ * and only the rows that are visible (e.g. within a Viewport) are drawn, so thousands
+ * of channels cost no more than a few until they are scrolled into view.
+ *
+ * The enabled states are not stored here; they are asked for from the listener when
+ * painting. Clicking a toggle flips it, shift-clicking sets all channels from the last
+ * one clicked to this one to the same new state, and right-clicking is passed on to the
+ * listener (e.g. to show a menu of bulk selections).
+ */
+class SpikeChannelSelector
+    : public Component
+    , public TooltipClient
+{
+public:
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+
+        virtual bool isSpikeChannelEnabled(int index) = 0;
+
+        // channels first to last (inclusive) were clicked to the given state
+        virtual void spikeChannelsClicked(int first, int last, bool enabled) = 0;
+
+        virtual void spikeChannelRightClicked(int index) = 0;
+
+        virtual String getSpikeChannelTooltip(int index) = 0;
+    };
+
+    SpikeChannelSelector(Listener* listener, int toggleWidth, int toggleHeight, int rowLength, int margin);
+
+    // one label per channel; resizes the component to fit all rows
+    void setLabels(const StringArray& newLabels);
+    int getNumChannels() const;
+
+    // index of the channel whose toggle contains the position, or -1
+    int getChannelAt(Point<int> position) const;
+
+    void paint(Graphics& g) override;
+    void mouseDown(const MouseEvent& event) override;
+
+    // implements TooltipClient (for the toggle under the mouse)
+    String getTooltip() override;
+
+private:
+    Rectangle<int> getToggleBounds(int index) const;
+
+    Listener* listener;
+    StringArray labels;
+    int lastClicked; // -1 = none since the labels changed
+
+    const int toggleWidth;
+    const int toggleHeight;
+    const int rowLength;
+    const int margin;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SpikeChannelSelector);
+};
+
+#endif // SPIKE_CHANNEL_SELECTOR_H_INCLUDED